@@ -0,0 +1,166 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bantrie.h>
+
+#include <string.h>
+
+struct CBanTrie::Node
+{
+    //! Address bits leading to this node, of which the first nBits are used
+    uint8_t prefix[16];
+    int nBits;
+    //! Whether this node is a banned subnet rather than only a branch point
+    bool fEntry;
+    int64_t nBanUntil;
+    std::unique_ptr<Node> children[2];
+
+    Node(const uint8_t* prefixIn, int nBitsIn) : nBits(nBitsIn), fEntry(false), nBanUntil(0)
+    {
+        memcpy(prefix, prefixIn, sizeof(prefix));
+    }
+};
+
+static inline int GetBit(const uint8_t* addr, int n)
+{
+    return (addr[n >> 3] >> (7 - (n & 7))) & 1;
+}
+
+/** Number of leading bits a and b have in common, given the first nStart match, up to nMax. */
+static int CommonBits(const uint8_t* a, const uint8_t* b, int nStart, int nMax)
+{
+    int n = nStart;
+    while (n < nMax && (n & 7) != 0 && GetBit(a, n) == GetBit(b, n))
+        ++n;
+    while (n + 8 <= nMax && a[n >> 3] == b[n >> 3])
+        n += 8;
+    while (n < nMax && GetBit(a, n) == GetBit(b, n))
+        ++n;
+    return n;
+}
+
+static void GetAddressBytes(const CNetAddr& addr, uint8_t* bytes)
+{
+    for (int i = 0; i < 16; i++)
+        bytes[i] = addr.GetByte(15 - i);
+}
+
+static const uint8_t ZERO_PREFIX[16] = {};
+
+CBanTrie::CBanTrie() : root(new Node(ZERO_PREFIX, 0)), nEntries(0) {}
+
+CBanTrie::~CBanTrie() {}
+
+void CBanTrie::Insert(const CSubNet& subnet, int64_t nBanUntil)
+{
+    // Invalid subnets never match anything
+    if (!subnet.IsValid())
+        return;
+    const int nBits = subnet.GetPrefixLength();
+    if (nBits < 0) {
+        mapIrregular[subnet] = nBanUntil;
+        return;
+    }
+    uint8_t prefix[16];
+    GetAddressBytes(subnet.GetNetwork(), prefix);
+
+    Node* node = root.get();
+    while (node->nBits < nBits) {
+        std::unique_ptr<Node>& child = node->children[GetBit(prefix, node->nBits)];
+        if (!child) {
+            child.reset(new Node(prefix, nBits));
+            node = child.get();
+            break;
+        }
+        int nCommon = CommonBits(prefix, child->prefix, node->nBits, std::min(nBits, child->nBits));
+        if (nCommon < child->nBits) {
+            // Branch off where the subnet leaves the path to child
+            std::unique_ptr<Node> split(new Node(prefix, nCommon));
+            split->children[GetBit(child->prefix, nCommon)] = std::move(child);
+            child = std::move(split);
+        }
+        node = child.get();
+    }
+    if (!node->fEntry) {
+        node->fEntry = true;
+        ++nEntries;
+    }
+    node->nBanUntil = nBanUntil;
+}
+
+void CBanTrie::Compact(std::unique_ptr<Node>& slot)
+{
+    Node* node = slot.get();
+    if (node->fEntry || (node->children[0] && node->children[1]))
+        return;
+    std::unique_ptr<Node> child = std::move(node->children[node->children[0] ? 0 : 1]);
+    slot = std::move(child);
+}
+
+bool CBanTrie::Erase(const CSubNet& subnet)
+{
+    if (!subnet.IsValid())
+        return false;
+    const int nBits = subnet.GetPrefixLength();
+    if (nBits < 0)
+        return mapIrregular.erase(subnet) > 0;
+    uint8_t prefix[16];
+    GetAddressBytes(subnet.GetNetwork(), prefix);
+
+    std::unique_ptr<Node>* parent = nullptr;
+    std::unique_ptr<Node>* slot = &root;
+    while ((*slot)->nBits < nBits) {
+        std::unique_ptr<Node>& child = (*slot)->children[GetBit(prefix, (*slot)->nBits)];
+        if (!child || child->nBits > nBits || CommonBits(prefix, child->prefix, (*slot)->nBits, child->nBits) < child->nBits)
+            return false;
+        parent = slot;
+        slot = &child;
+    }
+    if (!(*slot)->fEntry)
+        return false;
+    (*slot)->fEntry = false;
+    --nEntries;
+
+    // Keep the trie compressed: drop the node if it no longer branches, and
+    // its parent if that leaves the parent a mere pass-through.
+    if (slot != &root) {
+        Compact(*slot);
+        if (parent != &root)
+            Compact(*parent);
+    }
+    return true;
+}
+
+void CBanTrie::Clear()
+{
+    root.reset(new Node(ZERO_PREFIX, 0));
+    nEntries = 0;
+    mapIrregular.clear();
+}
+
+bool CBanTrie::Match(const CNetAddr& addr, int64_t nNow) const
+{
+    if (!addr.IsValid())
+        return false;
+    uint8_t bytes[16];
+    GetAddressBytes(addr, bytes);
+
+    const Node* node = root.get();
+    while (node) {
+        if (node->fEntry && nNow < node->nBanUntil)
+            return true;
+        if (node->nBits == 128)
+            break;
+        const Node* child = node->children[GetBit(bytes, node->nBits)].get();
+        if (child && CommonBits(bytes, child->prefix, node->nBits, child->nBits) < child->nBits)
+            break;
+        node = child;
+    }
+
+    for (const auto& entry : mapIrregular) {
+        if (nNow < entry.second && entry.first.Match(addr))
+            return true;
+    }
+    return false;
+}
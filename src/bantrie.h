@@ -0,0 +1,51 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BANTRIE_H
+#define BITCOIN_BANTRIE_H
+
+#include <netaddress.h>
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+
+/**
+ * Index of banned subnets for matching addresses against them.
+ *
+ * Subnets are kept in a path-compressed binary trie over the 128 bits of
+ * CNetAddr, in which IPv4 and onion addresses are mapped into IPv6 space.
+ * Checking an address walks at most one node per address bit, however many
+ * bans there are. The few subnets whose netmask is not a prefix cannot be
+ * placed in the trie and are checked one by one.
+ */
+class CBanTrie
+{
+public:
+    CBanTrie();
+    ~CBanTrie();
+
+    /** Set the ban expiry of a subnet, adding it if it is not present yet. */
+    void Insert(const CSubNet& subnet, int64_t nBanUntil);
+    /** Remove a subnet. Returns false if it was not present. */
+    bool Erase(const CSubNet& subnet);
+    void Clear();
+    size_t size() const { return nEntries + mapIrregular.size(); }
+
+    /** Whether addr is in a subnet that is banned until after nNow. */
+    bool Match(const CNetAddr& addr, int64_t nNow) const;
+
+private:
+    struct Node;
+
+    /** Remove a node that holds no ban and no longer branches. */
+    static void Compact(std::unique_ptr<Node>& slot);
+
+    std::unique_ptr<Node> root;
+    size_t nEntries;
+    //! Subnets with a netmask that is not a prefix
+    std::map<CSubNet, int64_t> mapIrregular;
+};
+
+#endif // BITCOIN_BANTRIE_H
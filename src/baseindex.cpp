@@ -0,0 +1,317 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <baseindex.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <checkqueue.h>
+#include <util.h>
+#include <validation.h>
+
+#include <functional>
+
+#include <boost/thread/thread.hpp>
+
+static const char DB_BEST_BLOCK = 'B';
+
+//! Blocks read from disk at once while catching up
+static const size_t SYNC_BATCH_SIZE = 16;
+//! Threads reading them
+static const int SYNC_READ_THREADS = 4;
+//! Size at which a batch of index entries is written out while catching up
+static const size_t SYNC_MAX_BATCH_SIZE = 16 << 20;
+static const int64_t SYNC_LOG_INTERVAL = 30; // seconds
+static const int64_t SYNC_LOCATOR_WRITE_INTERVAL = 30; // seconds
+
+namespace {
+
+/** A block read from disk while catching up, run on a CCheckQueue. */
+class CBlockRead
+{
+private:
+    CBlock* pblock;
+    const CBlockIndex* pindex;
+    const Consensus::Params* consensusParams;
+
+public:
+    CBlockRead() : pblock(nullptr), pindex(nullptr), consensusParams(nullptr) {}
+    CBlockRead(CBlock& blockIn, const CBlockIndex* pindexIn, const Consensus::Params& consensusParamsIn)
+        : pblock(&blockIn), pindex(pindexIn), consensusParams(&consensusParamsIn) {}
+
+    bool operator()() { return ReadBlockFromDisk(*pblock, pindex, *consensusParams); }
+
+    void swap(CBlockRead& read)
+    {
+        std::swap(pblock, read.pblock);
+        std::swap(pindex, read.pindex);
+        std::swap(consensusParams, read.consensusParams);
+    }
+};
+
+} // namespace
+
+CBaseIndex::DB::DB(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+    : CDBWrapper(path, nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CBaseIndex::DB::ReadBestBlock(CBlockLocator& locator) const
+{
+    bool success = Read(DB_BEST_BLOCK, locator);
+    if (!success) {
+        locator.SetNull();
+    }
+    return success;
+}
+
+void CBaseIndex::DB::WriteBestBlock(CDBBatch& batch, const CBlockLocator& locator)
+{
+    batch.Write(DB_BEST_BLOCK, locator);
+}
+
+CBaseIndex::CBaseIndex() : fSynced(false), pindexBest(nullptr)
+{
+}
+
+CBaseIndex::~CBaseIndex()
+{
+    // Stop() should have been called already, while the database was there
+    // to write the best block to.
+    UnregisterValidationInterface(this);
+    interrupt();
+    if (threadSync.joinable()) {
+        threadSync.join();
+    }
+}
+
+void CBaseIndex::Start()
+{
+    CBlockLocator locator;
+    GetDB().ReadBestBlock(locator);
+
+    LOCK(cs_main);
+    if (!locator.IsNull()) {
+        // Start from the block last written even if it has since left the
+        // active chain, so that its entries are rewound.
+        BlockMap::iterator it = mapBlockIndex.find(locator.vHave.front());
+        pindexBest = it != mapBlockIndex.end() ? it->second : FindForkInGlobalIndex(chainActive, locator);
+    }
+    fSynced = pindexBest.load() == chainActive.Tip();
+    interrupt.reset();
+    RegisterValidationInterface(this);
+    threadSync = std::thread(&TraceThread<std::function<void()>>, GetName(), std::bind(&CBaseIndex::ThreadSync, this));
+}
+
+void CBaseIndex::Stop()
+{
+    UnregisterValidationInterface(this);
+    interrupt();
+    if (threadSync.joinable()) {
+        threadSync.join();
+        LOCK(cs_main);
+        CommitBestBlock();
+    }
+}
+
+bool CBaseIndex::CommitBestBlock()
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindex = pindexBest;
+    if (!pindex)
+        return true;
+    CDBBatch batch(GetDB());
+    GetDB().WriteBestBlock(batch, chainActive.GetLocator(pindex));
+    if (!GetDB().WriteBatch(batch))
+        return error("%s: Failed to write the best block of %s", __func__, GetName());
+    return true;
+}
+
+void CBaseIndex::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const CBlockIndex* pindex = pindexBest;
+    int64_t nLastLog = 0;
+    int64_t nLastLocatorWrite = GetTime();
+
+    // The readers are started once for the whole catch-up; this thread reads
+    // alongside them.
+    CCheckQueue<CBlockRead> readqueue(1);
+    struct ReaderGroup {
+        boost::thread_group group;
+        ~ReaderGroup()
+        {
+            group.interrupt_all();
+            group.join_all();
+        }
+    } readers;
+    if (!fSynced) {
+        for (int t = 1; t < SYNC_READ_THREADS; t++)
+            readers.group.create_thread([&readqueue] { readqueue.Thread(); });
+    }
+
+    while (!fSynced) {
+        if (interrupt)
+            return;
+
+        const CBlockIndex* pindexStale = nullptr;
+        std::vector<const CBlockIndex*> vToWrite;
+        {
+            LOCK(cs_main);
+            if (pindex && !chainActive.Contains(pindex)) {
+                pindexStale = pindex;
+            } else {
+                const CBlockIndex* pindexNext = pindex ? chainActive.Next(pindex) : chainActive.Genesis();
+                if (!pindexNext) {
+                    // Caught up. Blocks connected from here on are notified
+                    // after this, as cs_main is held.
+                    pindexBest = pindex;
+                    fSynced = true;
+                    break;
+                }
+                for (; pindexNext && vToWrite.size() < SYNC_BATCH_SIZE; pindexNext = chainActive.Next(pindexNext)) {
+                    vToWrite.push_back(pindexNext);
+                }
+            }
+        }
+
+        if (pindexStale) {
+            CBlock block;
+            CDBBatch batch(GetDB());
+            if (!ReadBlockFromDisk(block, pindexStale, consensusParams) || !RewindBlock(batch, block, pindexStale) ||
+                !GetDB().WriteBatch(batch)) {
+                error("%s: Failed to rewind block %s from %s", __func__, pindexStale->GetBlockHash().ToString(), GetName());
+                return;
+            }
+            pindex = pindexStale->pprev;
+            pindexBest = pindex;
+            continue;
+        }
+
+        std::vector<CBlock> vBlocks(vToWrite.size());
+        std::vector<CBlockRead> vReads;
+        vReads.reserve(vToWrite.size());
+        for (size_t i = 0; i < vToWrite.size(); i++) {
+            vReads.emplace_back(vBlocks[i], vToWrite[i], consensusParams);
+        }
+        CCheckQueueControl<CBlockRead> control(&readqueue);
+        control.Add(vReads);
+        if (!control.Wait()) {
+            error("%s: Failed to read blocks for %s", __func__, GetName());
+            return;
+        }
+
+        CDBBatch batch(GetDB());
+        for (size_t i = 0; i < vToWrite.size(); i++) {
+            if (!WriteBlock(batch, vBlocks[i], vToWrite[i])) {
+                error("%s: Failed to write block %s to %s", __func__, vToWrite[i]->GetBlockHash().ToString(), GetName());
+                return;
+            }
+            // Bound the memory used by blocks with many entries
+            if (batch.SizeEstimate() > SYNC_MAX_BATCH_SIZE) {
+                if (!GetDB().WriteBatch(batch)) {
+                    error("%s: Failed to write blocks to %s", __func__, GetName());
+                    return;
+                }
+                batch.Clear();
+            }
+        }
+        if (!GetDB().WriteBatch(batch)) {
+            error("%s: Failed to write blocks to %s", __func__, GetName());
+            return;
+        }
+        pindex = vToWrite.back();
+        pindexBest = pindex;
+
+        int64_t nNow = GetTime();
+        if (nLastLog + SYNC_LOG_INTERVAL < nNow) {
+            LogPrintf("Syncing %s with block chain from height %d\n", GetName(), pindex->nHeight);
+            nLastLog = nNow;
+        }
+        if (nLastLocatorWrite + SYNC_LOCATOR_WRITE_INTERVAL < nNow) {
+            LOCK(cs_main);
+            CommitBestBlock();
+            nLastLocatorWrite = nNow;
+        }
+    }
+
+    if (pindex) {
+        LogPrintf("%s is enabled at height %d\n", GetName(), pindex->nHeight);
+    } else {
+        LogPrintf("%s is enabled\n", GetName());
+    }
+}
+
+void CBaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex,
+                                const std::vector<CTransactionRef>& txnConflicted)
+{
+    if (!fSynced)
+        return;
+
+    const CBlockIndex* pindexPrevBest = pindexBest;
+    if (pindexPrevBest && pindexPrevBest->GetAncestor(pindex->nHeight) == pindex) {
+        // Written by ThreadSync while its notification was queued
+        return;
+    }
+    if (pindex->pprev != pindexPrevBest) {
+        // Can happen right after catching up, for blocks of a branch that
+        // has been reorganized away while their notifications were queued.
+        LogPrintf("%s: WARNING: Block %s does not connect to the best block of %s (%s); not updating index\n", __func__,
+                  pindex->GetBlockHash().ToString(), GetName(), pindexPrevBest ? pindexPrevBest->GetBlockHash().ToString() : "none");
+        return;
+    }
+
+    CDBBatch batch(GetDB());
+    if (!WriteBlock(batch, *block, pindex) || !GetDB().WriteBatch(batch)) {
+        error("%s: Failed to write block %s to %s", __func__, pindex->GetBlockHash().ToString(), GetName());
+        return;
+    }
+    pindexBest = pindex;
+}
+
+void CBaseIndex::BlockDisconnected(const std::shared_ptr<const CBlock>& block)
+{
+    if (!fSynced)
+        return;
+
+    const CBlockIndex* pindex = pindexBest;
+    if (!pindex || pindex->GetBlockHash() != block->GetHash()) {
+        LogPrintf("%s: WARNING: Block %s is not the best block of %s; not updating index\n", __func__,
+                  block->GetHash().ToString(), GetName());
+        return;
+    }
+
+    CDBBatch batch(GetDB());
+    if (!RewindBlock(batch, *block, pindex) || !GetDB().WriteBatch(batch)) {
+        error("%s: Failed to rewind block %s from %s", __func__, pindex->GetBlockHash().ToString(), GetName());
+        return;
+    }
+    pindexBest = pindex->pprev;
+}
+
+void CBaseIndex::SetBestChain(const CBlockLocator& locator)
+{
+    if (!fSynced)
+        return;
+
+    LOCK(cs_main);
+    CommitBestBlock();
+}
+
+bool CBaseIndex::BlockUntilSyncedToCurrentChain()
+{
+    if (!fSynced)
+        return false;
+
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexTip = chainActive.Tip();
+        const CBlockIndex* pindex = pindexBest;
+        if (!pindexTip || (pindex && pindex->GetAncestor(pindexTip->nHeight) == pindexTip))
+            return true;
+    }
+
+    SyncWithValidationInterfaceQueue();
+    return true;
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BASEINDEX_H
+#define BITCOIN_BASEINDEX_H
+
+#include <dbwrapper.h>
+#include <primitives/block.h>
+#include <threadinterrupt.h>
+#include <validationinterface.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * Base of indexes that are built in the background from the blocks of the
+ * active chain, kept in a database of their own (under indexes/).
+ *
+ * On Start(), a thread catches up from the block the index was last written
+ * for, reading a batch of blocks from disk on several threads at a time and
+ * writing them in order. Once it reaches the tip, the index follows the chain
+ * through the BlockConnected and BlockDisconnected notifications, which are
+ * delivered off the validation thread, so that connecting a block does not
+ * wait for the index. The best block is written to the database as a locator
+ * whenever the chainstate is flushed, and indexing resumes from there after
+ * a restart.
+ */
+class CBaseIndex : public CValidationInterface
+{
+protected:
+    class DB : public CDBWrapper
+    {
+    public:
+        DB(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+        /** Read the locator of the block the index is up to. */
+        bool ReadBestBlock(CBlockLocator& locator) const;
+        /** Write, in batch, the locator of the block the index is up to. */
+        void WriteBestBlock(CDBBatch& batch, const CBlockLocator& locator);
+    };
+
+private:
+    //! Whether the index has caught up with the active chain and follows
+    //! notifications from then on
+    std::atomic<bool> fSynced;
+    //! The last block written to the index
+    std::atomic<const CBlockIndex*> pindexBest;
+
+    std::thread threadSync;
+    CThreadInterrupt interrupt;
+
+    /** Catch up with the active chain, then mark the index as synced. */
+    void ThreadSync();
+
+    /** Write the locator of pindexBest. Requires cs_main. */
+    bool CommitBestBlock();
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex,
+                        const std::vector<CTransactionRef>& txnConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block) override;
+    void SetBestChain(const CBlockLocator& locator) override;
+
+    /** Write the index entries for a block, in batch. */
+    virtual bool WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex) = 0;
+    /** Remove the index entries of a block that was disconnected, in batch. */
+    virtual bool RewindBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex) { return true; }
+
+    virtual DB& GetDB() const = 0;
+    /** Name of the index, for logging. */
+    virtual const char* GetName() const = 0;
+
+public:
+    CBaseIndex();
+    virtual ~CBaseIndex();
+
+    /** Start following the chain and catching up with it in the background. */
+    void Start();
+    /**
+     * Stop following the chain, wait for the background thread to exit and
+     * write the best block. Notifications already queued may still be
+     * delivered, so drain the queue before destroying the index.
+     */
+    void Stop();
+
+    bool IsSynced() const { return fSynced; }
+    /** The last block written to the index, if any. */
+    const CBlockIndex* GetBestBlock() const { return pindexBest; }
+
+    /**
+     * Wait until the index has caught up with the tip the active chain had
+     * when called, so that lookups see everything up to it. Returns false
+     * right away if the index is still catching up in the background. Must
+     * not be called with cs_main held.
+     */
+    bool BlockUntilSyncedToCurrentChain();
+};
+
+#endif // BITCOIN_BASEINDEX_H
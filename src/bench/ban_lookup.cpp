@@ -0,0 +1,101 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <addrdb.h>
+#include <bantrie.h>
+#include <netaddress.h>
+#include <random.h>
+#include <utiltime.h>
+
+#include <vector>
+
+static const size_t BANS = 100000;
+static const size_t LOOKUPS = 1000;
+
+static CNetAddr RandomAddress(FastRandomContext& rng, bool fIPv6)
+{
+    CNetAddr addr;
+    if (fIPv6) {
+        std::vector<unsigned char> bytes = rng.randbytes(16);
+        bytes[0] = 0x20; // 2000::/8, routable
+        addr.SetRaw(NET_IPV6, bytes.data());
+    } else {
+        std::vector<unsigned char> bytes = rng.randbytes(4);
+        addr.SetRaw(NET_IPV4, bytes.data());
+    }
+    return addr;
+}
+
+// A large imported ban list: mostly single IPv4 and IPv6 addresses, and a
+// few ranges.
+static banmap_t MakeBanList(FastRandomContext& rng)
+{
+    banmap_t banmap;
+    CBanEntry entry(GetTime());
+    entry.nBanUntil = GetTime() + 24 * 60 * 60;
+    while (banmap.size() < BANS) {
+        uint64_t n = rng.randrange(100);
+        if (n < 70) {
+            banmap[CSubNet(RandomAddress(rng, false))] = entry;
+        } else if (n < 90) {
+            banmap[CSubNet(RandomAddress(rng, true))] = entry;
+        } else if (n < 98) {
+            banmap[CSubNet(RandomAddress(rng, false), 24)] = entry;
+        } else {
+            banmap[CSubNet(RandomAddress(rng, true), 48)] = entry;
+        }
+    }
+    return banmap;
+}
+
+static std::vector<CNetAddr> MakeLookups(FastRandomContext& rng)
+{
+    std::vector<CNetAddr> addrs;
+    for (size_t i = 0; i < LOOKUPS; ++i) {
+        addrs.push_back(RandomAddress(rng, i % 4 == 0));
+    }
+    return addrs;
+}
+
+// Checking connecting addresses against the ban list, as CConnman::IsBanned()
+// does on every accepted connection.
+static void BanTrieLookup(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    const banmap_t banmap = MakeBanList(rng);
+    const std::vector<CNetAddr> addrs = MakeLookups(rng);
+    CBanTrie trie;
+    for (const auto& entry : banmap) {
+        trie.Insert(entry.first, entry.second.nBanUntil);
+    }
+
+    while (state.KeepRunning()) {
+        int64_t nNow = GetTime();
+        for (const CNetAddr& addr : addrs) {
+            trie.Match(addr, nNow);
+        }
+    }
+}
+
+// The same lookups done by scanning every ban, for comparison.
+static void BanListScan(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    const banmap_t banmap = MakeBanList(rng);
+    const std::vector<CNetAddr> addrs = MakeLookups(rng);
+
+    while (state.KeepRunning()) {
+        int64_t nNow = GetTime();
+        for (const CNetAddr& addr : addrs) {
+            for (const auto& entry : banmap) {
+                if (entry.first.Match(addr) && nNow < entry.second.nBanUntil)
+                    break;
+            }
+        }
+    }
+}
+
+BENCHMARK(BanTrieLookup, 500);
+BENCHMARK(BanListScan, 1);
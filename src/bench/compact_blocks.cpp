@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <blockencodings.h>
+#include <policy/policy.h>
+#include <random.h>
+#include <txmempool.h>
+#include <util.h>
+#include <validation.h>
+
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+static const int MIN_CORES = 2;
+static const size_t MEMPOOL_TXS = 50000;
+static const size_t BLOCK_TXS = 2000;
+
+static CTransactionRef MakeTx(FastRandomContext& rng)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(rng.rand256(), 0);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    return MakeTransactionRef(tx);
+}
+
+// Reconstructing a block whose transactions are all in a large mempool, as
+// when a compact block announcement comes in.
+static void CompactBlockInitData(benchmark::State& state, int nThreads)
+{
+    FastRandomContext rng(true);
+    CTxMemPool pool;
+    CBlock block;
+    block.nBits = 0x207fffff;
+    block.vtx.push_back(MakeTx(rng));
+    {
+        LOCK(pool.cs);
+        for (size_t i = 0; i < MEMPOOL_TXS; i++) {
+            CTransactionRef tx = MakeTx(rng);
+            LockPoints lp;
+            pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000, 0, 1, false, false, 4, lp));
+            if (i % (MEMPOOL_TXS / BLOCK_TXS) == 0)
+                block.vtx.push_back(tx);
+        }
+    }
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    const std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+
+    // The shards run on ThreadShortIdScan workers, started as init does:
+    // the thread calling InitData takes one shard itself.
+    const int nScriptCheckThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    boost::thread_group tg;
+    for (int i = 0; i < nThreads - 1; i++)
+        tg.create_thread(&ThreadShortIdScan);
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        assert(partialBlock.InitData(cmpctblock, extra_txn) == READ_STATUS_OK);
+        assert(partialBlock.IsTxAvailable(block.vtx.size() - 1));
+    }
+    tg.interrupt_all();
+    tg.join_all();
+    nScriptCheckThreads = nScriptCheckThreadsPrev;
+}
+
+static void CompactBlockInitDataSerial(benchmark::State& state)
+{
+    CompactBlockInitData(state, 0);
+}
+
+static void CompactBlockInitDataParallel(benchmark::State& state)
+{
+    CompactBlockInitData(state, std::max(MIN_CORES, GetNumCores()));
+}
+
+BENCHMARK(CompactBlockInitDataSerial, 100);
+BENCHMARK(CompactBlockInitDataParallel, 100);
@@ -4,6 +4,7 @@
 
 #include <bench/bench.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <txmempool.h>
 
 #include <list>
@@ -112,4 +113,84 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+// Append a package of ten transactions, a parent with two children, those
+// with two children each and so on. Every entry has in-mempool parents or
+// children to keep track of.
+static void AddPackage(FastRandomContext& det_rand, std::vector<CTransactionRef>& vtx)
+{
+    const size_t nRoot = vtx.size();
+    for (int i = 0; i < 10; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        if (i == 0) {
+            tx.vin[0].prevout = COutPoint(det_rand.rand256(), 0);
+        } else {
+            tx.vin[0].prevout = COutPoint(vtx[nRoot + (i - 1) / 2]->GetHash(), (i - 1) % 2);
+        }
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(2);
+        for (CTxOut& txout : tx.vout) {
+            txout.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            txout.nValue = 10 * COIN;
+        }
+        vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+}
+
+// Fill the mempool with a hundred packages, then evict them all again.
+static void MempoolEvictionPackages(benchmark::State& state)
+{
+    FastRandomContext det_rand(true);
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vFees;
+    for (int i = 0; i < 100; i++) {
+        AddPackage(det_rand, vtx);
+        for (int j = 0; j < 10; j++) {
+            vFees.push_back(1000 + det_rand.randrange(10000));
+        }
+    }
+
+    CTxMemPool pool;
+
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vtx.size(); i++) {
+            AddTx(*vtx[i], vFees[i], pool);
+        }
+        pool.TrimToSize(pool.DynamicMemoryUsage() / 2);
+        pool.TrimToSize(0);
+    }
+}
+
+// Keep a pool of 50000 entries in packages at its size limit, as a full
+// mempool does when new transactions come in: each round adds ten packages
+// and evicts as much again. The cost of linking and accounting for entries
+// should not grow with the size of the pool.
+static void MempoolEvictionLargePool(benchmark::State& state)
+{
+    FastRandomContext det_rand(true);
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 5000; i++) {
+        AddPackage(det_rand, vtx);
+    }
+
+    CTxMemPool pool;
+    for (const CTransactionRef& ptx : vtx) {
+        AddTx(*ptx, 1000 + det_rand.randrange(10000), pool);
+    }
+    const size_t nLimit = pool.DynamicMemoryUsage();
+
+    while (state.KeepRunning()) {
+        vtx.clear();
+        for (int i = 0; i < 10; i++) {
+            AddPackage(det_rand, vtx);
+        }
+        for (const CTransactionRef& ptx : vtx) {
+            AddTx(*ptx, 1000 + det_rand.randrange(10000), pool);
+        }
+        pool.TrimToSize(nLimit);
+    }
+}
+
 BENCHMARK(MempoolEviction, 41000);
+BENCHMARK(MempoolEvictionPackages, 100);
+BENCHMARK(MempoolEvictionLargePool, 100);
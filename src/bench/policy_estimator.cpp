@@ -0,0 +1,48 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/fees.h>
+#include <policy/policy.h>
+#include <txmempool.h>
+
+#include <vector>
+
+// Track a full block's worth of transactions at a spread of feerates, then
+// confirm them all in the next block, as the estimator does for every block.
+static void BlockPolicyEstimatorProcessBlock(benchmark::State& state)
+{
+    const int nTxs = 4000;
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(uint256(), i);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        vtx.push_back(MakeTransactionRef(tx));
+    }
+
+    CBlockPolicyEstimator estimator;
+    unsigned int nHeight = 0;
+    LockPoints lp;
+    while (state.KeepRunning()) {
+        std::vector<CTxMemPoolEntry> vEntries;
+        vEntries.reserve(vtx.size());
+        for (int i = 0; i < nTxs; i++) {
+            const CAmount nFee = 100 + (i * 7919) % 100000;
+            vEntries.emplace_back(vtx[i], nFee, 0, nHeight, false, false, 4, lp);
+            estimator.processTransaction(vEntries.back(), true);
+        }
+        std::vector<const CTxMemPoolEntry*> vBlock;
+        for (const CTxMemPoolEntry& entry : vEntries) {
+            vBlock.push_back(&entry);
+        }
+        estimator.processBlock(++nHeight, vBlock);
+    }
+}
+
+BENCHMARK(BlockPolicyEstimatorProcessBlock, 10);
@@ -0,0 +1,96 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <key.h>
+#include <pubkey.h>
+#include <random.h>
+#include <script/interpreter.h>
+#include <script/sigcache.h>
+#include <util.h>
+
+#include <thread>
+#include <vector>
+
+static const int MIN_CORES = 2;
+static const size_t SIGNATURES = 1000;
+static const size_t LOOKUPS_PER_THREAD = 2000;
+
+namespace {
+struct SignatureData {
+    CPubKey pubkey;
+    std::vector<uint256> hashes;
+    std::vector<std::vector<unsigned char>> sigs;
+};
+} // namespace
+
+// Signatures and a warm signature cache shared by the benchmarks below, so
+// that only cache hits are measured.
+static const SignatureData& GetSignatureData()
+{
+    static ECCVerifyHandle verify_handle;
+    static SignatureData data = [] {
+        InitSignatureCache();
+        CKey key;
+        key.MakeNewKey(true);
+        SignatureData d;
+        d.pubkey = key.GetPubKey();
+        FastRandomContext insecure_rand(true);
+        for (size_t i = 0; i < SIGNATURES; ++i) {
+            d.hashes.push_back(insecure_rand.rand256());
+            d.sigs.emplace_back();
+            key.Sign(d.hashes.back(), d.sigs.back());
+        }
+        CMutableTransaction mtx;
+        const CTransaction tx(mtx);
+        PrecomputedTransactionData txdata(tx);
+        CachingTransactionSignatureChecker checker(&tx, 0, 0, true, txdata);
+        for (size_t i = 0; i < SIGNATURES; ++i) {
+            assert(checker.VerifySignature(d.sigs[i], d.pubkey, d.hashes[i]));
+        }
+        return d;
+    }();
+    return data;
+}
+
+// Look up cached signatures from as many threads as there are cores, as the
+// script check threads do during block validation. With store == false, hits
+// are also marked for erasure, as in ConnectBlock.
+static void SigCacheLookup(benchmark::State& state, bool store)
+{
+    const SignatureData& data = GetSignatureData();
+    CMutableTransaction mtx;
+    const CTransaction tx(mtx);
+    PrecomputedTransactionData txdata(tx);
+    const int nThreads = std::max(MIN_CORES, GetNumCores());
+
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nThreads; ++t) {
+            threads.emplace_back([&, t] {
+                CachingTransactionSignatureChecker checker(&tx, 0, 0, store, txdata);
+                for (size_t i = 0; i < LOOKUPS_PER_THREAD; ++i) {
+                    size_t n = (t * 7919 + i) % SIGNATURES;
+                    checker.VerifySignature(data.sigs[n], data.pubkey, data.hashes[n]);
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+static void SigCacheLookupStore(benchmark::State& state)
+{
+    SigCacheLookup(state, true);
+}
+
+static void SigCacheLookupErase(benchmark::State& state)
+{
+    SigCacheLookup(state, false);
+}
+
+BENCHMARK(SigCacheLookupStore, 100);
+BENCHMARK(SigCacheLookupErase, 100);
@@ -0,0 +1,163 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <compat.h>
+#include <netbase.h>
+#include <random.h>
+#include <util.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifndef WIN32
+
+// Peers that become readable per iteration, out of all connected ones
+static const size_t ACTIVE_PEERS = 10;
+
+namespace {
+/** Loopback TCP connections; the accepted ends play the part of our peers. */
+struct LoopbackPeers {
+    std::vector<SOCKET> vClient;
+    std::vector<SOCKET> vPeer;
+
+    explicit LoopbackPeers(size_t nPeers)
+    {
+        RaiseFileDescriptorLimit(2 * nPeers + 64);
+
+        SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        assert(hListen != INVALID_SOCKET);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        assert(bind(hListen, (struct sockaddr*)&addr, len) == 0);
+        assert(getsockname(hListen, (struct sockaddr*)&addr, &len) == 0);
+        assert(listen(hListen, SOMAXCONN) == 0);
+
+        for (size_t i = 0; i < nPeers; ++i) {
+            SOCKET hClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            assert(hClient != INVALID_SOCKET);
+            assert(connect(hClient, (struct sockaddr*)&addr, len) == 0);
+            SOCKET hPeer = accept(hListen, nullptr, nullptr);
+            assert(hPeer != INVALID_SOCKET);
+            SetSocketNoDelay(hClient);
+            SetSocketNonBlocking(hPeer, true);
+            vClient.push_back(hClient);
+            vPeer.push_back(hPeer);
+        }
+        CloseSocket(hListen);
+    }
+
+    ~LoopbackPeers()
+    {
+        for (SOCKET& hSocket : vClient) CloseSocket(hSocket);
+        for (SOCKET& hSocket : vPeer) CloseSocket(hSocket);
+    }
+
+    //! Make a few random peers readable, returning how many bytes are in flight.
+    size_t Wake(FastRandomContext& rng)
+    {
+        for (size_t i = 0; i < ACTIVE_PEERS; ++i) {
+            char c = 0;
+            assert(send(vClient[rng.randrange(vClient.size())], &c, 1, MSG_NOSIGNAL) == 1);
+        }
+        return ACTIVE_PEERS;
+    }
+};
+
+size_t Drain(SOCKET hSocket)
+{
+    char buf[256];
+    size_t nRead = 0;
+    ssize_t nBytes;
+    while ((nBytes = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        nRead += nBytes;
+    }
+    return nRead;
+}
+} // namespace
+
+// What CConnman::SocketEventsSelect() does per wakeup: build an fd_set over
+// every peer, then scan all of them for readiness.
+static void SocketEventsSelect(benchmark::State& state)
+{
+    // select() is limited to FD_SETSIZE, which bounds the number of peers.
+    LoopbackPeers peers(FD_SETSIZE / 2 - 64);
+    FastRandomContext rng(true);
+
+    while (state.KeepRunning()) {
+        size_t nPending = peers.Wake(rng);
+        while (nPending > 0) {
+            fd_set fdsetRecv;
+            FD_ZERO(&fdsetRecv);
+            SOCKET hSocketMax = 0;
+            for (SOCKET hSocket : peers.vPeer) {
+                FD_SET(hSocket, &fdsetRecv);
+                hSocketMax = std::max(hSocketMax, hSocket);
+            }
+            struct timeval timeout = {1, 0};
+            assert(select(hSocketMax + 1, &fdsetRecv, nullptr, nullptr, &timeout) > 0);
+            for (SOCKET hSocket : peers.vPeer) {
+                if (FD_ISSET(hSocket, &fdsetRecv)) {
+                    nPending -= Drain(hSocket);
+                }
+            }
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+// What CConnman::SocketEventsEpoll() does per wakeup: only the peers that
+// became readable are reported.
+static void SocketEventsEpollPeers(benchmark::State& state, size_t nPeers)
+{
+    LoopbackPeers peers(nPeers);
+    FastRandomContext rng(true);
+
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epollfd != -1);
+    for (SOCKET hSocket : peers.vPeer) {
+        struct epoll_event event;
+        event.data.fd = hSocket;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        assert(epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &event) == 0);
+    }
+
+    struct epoll_event events[256];
+    while (state.KeepRunning()) {
+        size_t nPending = peers.Wake(rng);
+        while (nPending > 0) {
+            int nEvents = epoll_wait(epollfd, events, 256, 1000);
+            assert(nEvents > 0);
+            for (int i = 0; i < nEvents; ++i) {
+                nPending -= Drain(events[i].data.fd);
+            }
+        }
+    }
+    close(epollfd);
+}
+
+static void SocketEventsEpoll(benchmark::State& state)
+{
+    SocketEventsEpollPeers(state, FD_SETSIZE / 2 - 64);
+}
+
+static void SocketEventsEpollManyPeers(benchmark::State& state)
+{
+    SocketEventsEpollPeers(state, 4000);
+}
+#endif
+
+BENCHMARK(SocketEventsSelect, 2000);
+#ifdef USE_EPOLL
+BENCHMARK(SocketEventsEpoll, 2000);
+BENCHMARK(SocketEventsEpollManyPeers, 2000);
+#endif
+
+#endif // WIN32
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <blockencodings.h>
+#include <checkqueue.h>
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
 #include <chainparams.h>
@@ -45,6 +46,60 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
 
 
 
+namespace {
+
+/**
+ * Computes the short IDs of a range of the mempool's transactions and
+ * collects those matching a compact block's as (block index, vTxHashes index).
+ */
+class CShortIdScan
+{
+private:
+    const CBlockHeaderAndShortTxIDs* cmpctblock;
+    const std::unordered_map<uint64_t, uint16_t>* shorttxids;
+    const std::vector<std::pair<uint256, CTxMemPool::txiter>>* vTxHashes;
+    size_t nBegin;
+    size_t nEnd;
+    std::vector<std::pair<uint16_t, size_t>>* vMatches;
+
+public:
+    CShortIdScan() : cmpctblock(nullptr), shorttxids(nullptr), vTxHashes(nullptr), nBegin(0), nEnd(0), vMatches(nullptr) {}
+    CShortIdScan(const CBlockHeaderAndShortTxIDs& cmpctblockIn, const std::unordered_map<uint64_t, uint16_t>& shorttxidsIn,
+                 const std::vector<std::pair<uint256, CTxMemPool::txiter>>& vTxHashesIn, size_t nBeginIn, size_t nEndIn,
+                 std::vector<std::pair<uint16_t, size_t>>& vMatchesIn) :
+        cmpctblock(&cmpctblockIn), shorttxids(&shorttxidsIn), vTxHashes(&vTxHashesIn), nBegin(nBeginIn), nEnd(nEndIn), vMatches(&vMatchesIn) {}
+
+    bool operator()()
+    {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            auto idit = shorttxids->find(cmpctblock->GetShortID((*vTxHashes)[i].first));
+            if (idit != shorttxids->end())
+                vMatches->emplace_back(idit->second, i);
+        }
+        return true;
+    }
+
+    void swap(CShortIdScan& check)
+    {
+        std::swap(cmpctblock, check.cmpctblock);
+        std::swap(shorttxids, check.shorttxids);
+        std::swap(vTxHashes, check.vTxHashes);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(vMatches, check.vMatches);
+    }
+};
+
+// Every scan is a single range, so hand them out one at a time
+CCheckQueue<CShortIdScan> shortidscanqueue(1);
+
+} // namespace
+
+void ThreadShortIdScan() {
+    RenameThread("bitcoin-shortid");
+    shortidscanqueue.Thread();
+}
+
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
     if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
         return READ_STATUS_INVALID;
@@ -102,32 +157,60 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
+    auto add_mempool_tx = [&](uint16_t index, const CTxMemPool::txiter& it) {
+        if (!have_txn[index]) {
+            txn_available[index] = it->GetSharedTx();
+            have_txn[index] = true;
+            mempool_count++;
+        } else {
+            // If we find two mempool txn that match the short id, just request it.
+            // This should be rare enough that the extra bandwidth doesn't matter,
+            // but eating a round-trip due to FillBlock failure would be annoying
+            if (txn_available[index]) {
+                txn_available[index].reset();
+                mempool_count--;
+            }
+        }
+    };
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
-                mempool_count++;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
-                }
-            }
+    // Computing a short ID for every mempool transaction dominates the time
+    // spent here with a large mempool, so split that up over the script
+    // verification threads' worth of cores if there is enough to do.
+    const size_t nShards = std::max<size_t>(1, std::min<size_t>(nScriptCheckThreads, vTxHashes.size() / MIN_SHORTID_SCAN_PER_THREAD));
+    if (nShards == 1) {
+        for (size_t i = 0; i < vTxHashes.size(); i++) {
+            uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+            std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
+            if (idit != shorttxids.end())
+                add_mempool_tx(idit->second, vTxHashes[i].second);
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids.size())
+                break;
+        }
+    } else {
+        // Each shard collects its matches as (block index, vTxHashes index);
+        // they are applied in mempool order afterwards, as a single scan would.
+        // The shards run on the ThreadShortIdScan workers, which this thread
+        // joins; pool->cs stays held by it until all shards are done.
+        std::vector<std::vector<std::pair<uint16_t, size_t>>> vMatches(nShards);
+        std::vector<CShortIdScan> vScans;
+        vScans.reserve(nShards);
+        for (size_t nShard = 0; nShard < nShards; nShard++) {
+            const size_t nBegin = vTxHashes.size() * nShard / nShards;
+            const size_t nEnd = vTxHashes.size() * (nShard + 1) / nShards;
+            vScans.emplace_back(cmpctblock, shorttxids, vTxHashes, nBegin, nEnd, vMatches[nShard]);
+        }
+        CCheckQueueControl<CShortIdScan> control(&shortidscanqueue);
+        control.Add(vScans);
+        control.Wait();
+        for (const auto& matches : vMatches) {
+            for (const auto& match : matches)
+                add_mempool_tx(match.first, vTxHashes[match.second].second);
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
     }
 
@@ -11,6 +11,12 @@
 
 class CTxMemPool;
 
+/** Minimum number of mempool transactions per thread when scanning the mempool for a compact block's transactions */
+static const size_t MIN_SHORTID_SCAN_PER_THREAD = 5000;
+
+/** Worker thread scanning the mempool for compact blocks, one per script verification thread */
+void ThreadShortIdScan();
+
 // Dumb helper to handle CTransaction compression at serialize-time
 struct TransactionCompressor {
 private:
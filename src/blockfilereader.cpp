@@ -0,0 +1,154 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilereader.h>
+
+#include <clientversion.h>
+#include <consensus/consensus.h>
+#include <consensus/validation.h>
+#include <streams.h>
+#include <util.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <string.h>
+
+CBlockFileReader::CBlockFileReader(FILE* fileIn, const CMessageHeader::MessageStartChars& messageStartIn,
+                                   const Consensus::Params& consensusParamsIn, const CDiskBlockPos& pos, int nWorkers)
+    : messageStart(messageStartIn), consensusParams(consensusParamsIn), fReadDone(false), fStop(false)
+{
+    threads.emplace_back(&CBlockFileReader::ThreadRead, this, fileIn, pos);
+    for (int i = 0; i < std::max(nWorkers, 1); i++) {
+        threads.emplace_back(&CBlockFileReader::ThreadWork, this);
+    }
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    {
+        WaitableLock lock(cs);
+        fStop = true;
+    }
+    condWork.notify_all();
+    condSpace.notify_all();
+    condReady.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+std::shared_ptr<CBlockFileReader::PendingBlock> CBlockFileReader::Next()
+{
+    WaitableLock lock(cs);
+    condReady.wait(lock, [this] {
+        return fStop || (queueInOrder.empty() ? fReadDone : queueInOrder.front()->fReady);
+    });
+    if (fStop || queueInOrder.empty())
+        return nullptr;
+    std::shared_ptr<PendingBlock> pending = queueInOrder.front();
+    queueInOrder.pop_front();
+    condSpace.notify_one();
+    return pending;
+}
+
+void CBlockFileReader::ThreadRead(FILE* fileIn, CDiskBlockPos pos)
+{
+    RenameThread("bitcoin-loadblkread");
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof()) {
+            {
+                WaitableLock lock(cs);
+                condSpace.wait(lock, [this] { return fStop || queueInOrder.size() < MAX_BLOCKS_IN_FLIGHT; });
+                if (fStop)
+                    break;
+            }
+
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(messageStart[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                // read the block, leaving it to the workers to deserialize
+                std::shared_ptr<PendingBlock> pending = std::make_shared<PendingBlock>();
+                pending->pos = pos;
+                pending->pos.nPos = blkdat.GetPos();
+                blkdat.SetLimit(pending->pos.nPos + nSize);
+                pending->vchBlock.resize(nSize);
+                blkdat.read(pending->vchBlock.data(), nSize);
+                nRewind = blkdat.GetPos();
+                {
+                    WaitableLock lock(cs);
+                    queueInOrder.push_back(pending);
+                    queueToWork.push_back(pending);
+                }
+                condWork.notify_one();
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: I/O error - %s\n", __func__, e.what());
+    }
+    {
+        WaitableLock lock(cs);
+        fReadDone = true;
+    }
+    condReady.notify_all();
+}
+
+void CBlockFileReader::ThreadWork()
+{
+    RenameThread("bitcoin-loadblkwork");
+    while (true) {
+        std::shared_ptr<PendingBlock> pending;
+        {
+            WaitableLock lock(cs);
+            condWork.wait(lock, [this] { return fStop || !queueToWork.empty(); });
+            if (fStop)
+                return;
+            pending = queueToWork.front();
+            queueToWork.pop_front();
+        }
+
+        try {
+            CDataStream ss(pending->vchBlock, SER_DISK, CLIENT_VERSION);
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            ss >> *pblock;
+            // The outcome is cached in the block, so AcceptBlock need not
+            // check it again. A failure is left for AcceptBlock to find and
+            // report.
+            CValidationState state;
+            CheckBlock(*pblock, state, consensusParams);
+            pending->pblock = pblock;
+        } catch (const std::exception& e) {
+            pending->strError = e.what();
+        }
+        std::vector<char>().swap(pending->vchBlock);
+
+        {
+            WaitableLock lock(cs);
+            pending->fReady = true;
+        }
+        condReady.notify_all();
+    }
+}
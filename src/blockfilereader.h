@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEREADER_H
+#define BITCOIN_BLOCKFILEREADER_H
+
+#include <chain.h>
+#include <primitives/block.h>
+#include <protocol.h>
+#include <sync.h>
+
+#include <deque>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Consensus { struct Params; }
+
+/**
+ * Reads the blocks in a block file, as found by -reindex and -loadblock.
+ *
+ * One thread scans the file for the network magic and reads the bytes of
+ * each block, a number of worker threads deserialize them and run
+ * CheckBlock, which caches its outcome in the block, and Next() hands the
+ * blocks out in the order they are stored in. At most a fixed number of
+ * blocks are in flight at any time, which bounds the memory used.
+ */
+class CBlockFileReader
+{
+public:
+    struct PendingBlock
+    {
+        //! Where the block was found; nFile is only set when reading a block file
+        CDiskBlockPos pos;
+        //! The block, or null if it could not be deserialized
+        std::shared_ptr<CBlock> pblock;
+        //! Why it could not be deserialized
+        std::string strError;
+
+    private:
+        friend class CBlockFileReader;
+        std::vector<char> vchBlock;
+        bool fReady = false;
+    };
+
+    /** Start reading fileIn, which is closed when done. pos is the file being read, if any. */
+    CBlockFileReader(FILE* fileIn, const CMessageHeader::MessageStartChars& messageStart,
+                     const Consensus::Params& consensusParams, const CDiskBlockPos& pos, int nWorkers);
+    /** Stop reading and wait for the threads to exit. */
+    ~CBlockFileReader();
+
+    /** The next block in the file, or null once the whole file has been read. */
+    std::shared_ptr<PendingBlock> Next();
+
+private:
+    //! Blocks read ahead of the one Next() will return
+    static const size_t MAX_BLOCKS_IN_FLIGHT = 64;
+
+    void ThreadRead(FILE* fileIn, CDiskBlockPos pos);
+    void ThreadWork();
+
+    const CMessageHeader::MessageStartChars& messageStart;
+    const Consensus::Params& consensusParams;
+
+    CWaitableCriticalSection cs;
+    CConditionVariable condReady;
+    CConditionVariable condWork;
+    CConditionVariable condSpace;
+    //! Blocks not handed out yet, in file order
+    std::deque<std::shared_ptr<PendingBlock>> queueInOrder;
+    //! Blocks waiting for a worker
+    std::deque<std::shared_ptr<PendingBlock>> queueToWork;
+    bool fReadDone;
+    bool fStop;
+
+    std::vector<std::thread> threads;
+};
+
+#endif // BITCOIN_BLOCKFILEREADER_H
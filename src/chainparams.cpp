@@ -59,6 +59,11 @@ void CChainParams::UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64
     consensus.vDeployments[d].nTimeout = nTimeout;
 }
 
+void CChainParams::UpdateAssumeutxo(const uint256& hashBlock, const AssumeutxoData& data)
+{
+    mapAssumeutxo[hashBlock] = data;
+}
+
 /**
  * Main network
  */
@@ -394,3 +399,8 @@ void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime,
 {
     globalChainParams->UpdateVersionBitsParameters(d, nStartTime, nTimeout);
 }
+
+void UpdateAssumeutxo(const uint256& hashBlock, const AssumeutxoData& data)
+{
+    globalChainParams->UpdateAssumeutxo(hashBlock, data);
+}
@@ -25,6 +25,17 @@ struct CCheckpointData {
     MapCheckpoints mapCheckpoints;
 };
 
+/** Assumed-valid UTXO set for a block, see utxosnapshot.h. */
+struct AssumeutxoData {
+    //! Expected content hash of the UTXO snapshot taken at the block
+    uint256 hashContents;
+    //! Number of transactions up to and including the block
+    unsigned int nChainTx;
+};
+
+//! UTXO snapshots that may be loaded, keyed by base block hash
+typedef std::map<uint256, AssumeutxoData> MapAssumeutxo;
+
 struct ChainTxData {
     int64_t nTime;
     int64_t nTxCount;
@@ -74,7 +85,9 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    const MapAssumeutxo& Assumeutxo() const { return mapAssumeutxo; }
     void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
+    void UpdateAssumeutxo(const uint256& hashBlock, const AssumeutxoData& data);
 protected:
     CChainParams() {}
 
@@ -93,6 +106,7 @@ protected:
     bool fMineBlocksOnDemand;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeutxo mapAssumeutxo;
 };
 
 /**
@@ -119,4 +133,9 @@ void SelectParams(const std::string& chain);
  */
 void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 
+/**
+ * Allows adding regtest UTXO snapshots that may be loaded.
+ */
+void UpdateAssumeutxo(const uint256& hashBlock, const AssumeutxoData& data);
+
 #endif // BITCOIN_CHAINPARAMS_H
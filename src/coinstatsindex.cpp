@@ -0,0 +1,157 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstatsindex.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <hash.h>
+#include <primitives/block.h>
+#include <undo.h>
+#include <util.h>
+
+#include <boost/thread.hpp>
+
+static const char DB_COINSTATS = 's';
+
+std::unique_ptr<CCoinStatsIndex> g_coin_stats_index;
+
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin, bool fRemove)
+{
+    // Only commit to what undo data can restore, so that spent coins hash
+    // the same as they did when they were created.
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    if (fRemove) {
+        muhash.Remove((const unsigned char*)ss.data(), ss.size());
+    } else {
+        muhash.Insert((const unsigned char*)ss.data(), ss.size());
+    }
+}
+
+uint64_t GetBogoSize(const Coin& coin)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + coin.out.scriptPubKey.size() /* scriptPubKey */;
+}
+
+static void AddCoin(CCoinStatsIndexEntry& entry, const COutPoint& outpoint, const Coin& coin)
+{
+    ApplyCoinHash(entry.muhash, outpoint, coin);
+    entry.nTransactionOutputs++;
+    entry.nBogoSize += GetBogoSize(coin);
+    entry.nTotalAmount += coin.out.nValue;
+}
+
+static void RemoveCoin(CCoinStatsIndexEntry& entry, const COutPoint& outpoint, const Coin& coin)
+{
+    ApplyCoinHash(entry.muhash, outpoint, coin, true);
+    entry.nTransactionOutputs--;
+    entry.nBogoSize -= GetBogoSize(coin);
+    entry.nTotalAmount -= coin.out.nValue;
+}
+
+CCoinStatsIndex::CCoinStatsIndex(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "indexes" / "coinstats", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CCoinStatsIndex::ReadEntry(const uint256& hashBlock, CCoinStatsIndexEntry& entry) const
+{
+    if (hashBlock == hashLastBlock) {
+        entry = lastEntry;
+        return true;
+    }
+    return db.Read(std::make_pair(DB_COINSTATS, hashBlock), entry);
+}
+
+bool CCoinStatsIndex::Init(CCoinsView& view, const CBlockIndex* pindexTip)
+{
+    if (!pindexTip) return true;
+
+    CCoinStatsIndexEntry entry;
+    if (ReadEntry(pindexTip->GetBlockHash(), entry)) return true;
+
+    LogPrintf("Building coin stats index from the UTXO set at height %d...\n", pindexTip->nHeight);
+    std::unique_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    if (pcursor->GetBestBlock() != pindexTip->GetBlockHash()) {
+        return error("%s: UTXO set is not at the chain tip", __func__);
+    }
+    entry.nHeight = pindexTip->nHeight;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            return error("%s: unable to read value", __func__);
+        }
+        AddCoin(entry, key, coin);
+        pcursor->Next();
+    }
+    if (!db.Write(std::make_pair(DB_COINSTATS, pindexTip->GetBlockHash()), entry)) {
+        return error("%s: failed to write coin stats index entry", __func__);
+    }
+    hashLastBlock = pindexTip->GetBlockHash();
+    lastEntry = entry;
+    LogPrintf("Coin stats index built: %u unspent outputs\n", entry.nTransactionOutputs);
+    return true;
+}
+
+bool CCoinStatsIndex::BlockConnected(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo)
+{
+    assert(pindex->pprev);
+
+    CCoinStatsIndexEntry entry;
+    if (!ReadEntry(pindex->pprev->GetBlockHash(), entry)) {
+        if (pindex->pprev->pprev != nullptr) {
+            // We don't know the state this block builds on, so leave it
+            // out of the index (the index was enabled on top of an
+            // existing chain and was not built yet).
+            return true;
+        }
+        // The genesis block's outputs are unspendable; everything starts
+        // from the empty set.
+    }
+    entry.nHeight = pindex->nHeight;
+
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& txid = tx.GetHash();
+
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); ++j) {
+                RemoveCoin(entry, tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+        }
+
+        // The coinbases of these two blocks duplicate earlier ones and
+        // overwrote their still unspent outputs (see BIP30). The
+        // overwritten coins are identical but for their height.
+        int nOverwrittenHeight = -1;
+        if (i == 0 && pindex->nHeight == 91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) {
+            nOverwrittenHeight = 91812;
+        } else if (i == 0 && pindex->nHeight == 91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")) {
+            nOverwrittenHeight = 91722;
+        }
+
+        for (size_t n = 0; n < tx.vout.size(); ++n) {
+            if (tx.vout[n].scriptPubKey.IsUnspendable()) continue;
+            const COutPoint outpoint(txid, n);
+            if (nOverwrittenHeight >= 0) {
+                RemoveCoin(entry, outpoint, Coin(tx.vout[n], nOverwrittenHeight, true, false));
+            }
+            AddCoin(entry, outpoint, Coin(tx.vout[n], pindex->nHeight, i == 0, false));
+        }
+    }
+
+    if (!db.Write(std::make_pair(DB_COINSTATS, pindex->GetBlockHash()), entry)) {
+        return error("%s: failed to write coin stats index entry", __func__);
+    }
+    hashLastBlock = pindex->GetBlockHash();
+    lastEntry = entry;
+    return true;
+}
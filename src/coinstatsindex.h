@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATSINDEX_H
+#define BITCOIN_COINSTATSINDEX_H
+
+#include <amount.h>
+#include <crypto/muhash.h>
+#include <dbwrapper.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <memory>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class CCoinsView;
+class COutPoint;
+class Coin;
+
+//! -coinstatsindex default
+static const bool DEFAULT_COINSTATSINDEX = false;
+//! Max memory allocated to the coin stats index database cache (MiB)
+static const int64_t nMaxCoinStatsIndexCache = 8;
+
+/** Add a coin to (or, with fRemove, remove it from) a MuHash of the UTXO set. */
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin, bool fRemove = false);
+
+/** Contribution of a single coin to the bogosize UTXO set size metric. */
+uint64_t GetBogoSize(const Coin& coin);
+
+/** Statistics about the UTXO set as of some block, as kept by the coin stats index. */
+struct CCoinStatsIndexEntry
+{
+    int nHeight;
+    //! Rolling hash of the set of unspent outputs
+    MuHash3072 muhash;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    CCoinStatsIndexEntry() : nHeight(0), nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(muhash);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+    }
+};
+
+/**
+ * Index of UTXO set statistics per block (indexes/coinstats/).
+ *
+ * The statistics are updated incrementally as blocks are connected, from the
+ * block itself and its undo data, so that they can be answered without
+ * scanning the UTXO set. Entries are keyed by block hash, so disconnecting a
+ * block needs no update: the entry for its parent is still valid.
+ */
+class CCoinStatsIndex
+{
+private:
+    CDBWrapper db;
+
+    //! The most recently written entry, to avoid reading it back for the next block
+    uint256 hashLastBlock;
+    CCoinStatsIndexEntry lastEntry;
+
+public:
+    explicit CCoinStatsIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    CCoinStatsIndex(const CCoinStatsIndex&) = delete;
+    CCoinStatsIndex& operator=(const CCoinStatsIndex&) = delete;
+
+    /**
+     * Make sure there is an entry for pindexTip, building it with a full scan
+     * of view (whose best block must be pindexTip) if needed.
+     */
+    bool Init(CCoinsView& view, const CBlockIndex* pindexTip);
+
+    //! Compute and store the entry for a block from the entry of its parent.
+    //! Returns false only on database errors; if the parent's entry is
+    //! missing, the block is skipped.
+    bool BlockConnected(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo);
+
+    bool ReadEntry(const uint256& hashBlock, CCoinStatsIndexEntry& entry) const;
+};
+
+/** The coin stats index, if enabled with -coinstatsindex (protected by cs_main). */
+extern std::unique_ptr<CCoinStatsIndex> g_coin_stats_index;
+
+#endif // BITCOIN_COINSTATSINDEX_H
@@ -48,6 +48,15 @@
 #include <unistd.h>
 #endif
 
+#if defined(__linux__)
+#define USE_POLL
+#define USE_EPOLL
+#endif
+
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+
 #ifndef WIN32
 typedef unsigned int SOCKET;
 #include <errno.h>
@@ -86,6 +95,7 @@ typedef int32_t ssize_t;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+/** Whether s can be waited on with select(), i.e. fits into an fd_set. */
 bool static inline IsSelectableSocket(const SOCKET& s) {
 #ifdef WIN32
     return true;
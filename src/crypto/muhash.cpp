@@ -0,0 +1,166 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+#include <string.h>
+
+namespace {
+
+/** 2^3072 - MAX_PRIME_DIFF is the prime modulus. */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+/** Add n * MAX_PRIME_DIFF to the number, returning the carry out of the top limb. */
+uint32_t AddScaledDiff(uint32_t* limbs, uint64_t n)
+{
+    uint64_t carry = n * MAX_PRIME_DIFF;
+    for (int i = 0; i < Num3072::LIMBS && carry; ++i) {
+        carry += limbs[i];
+        limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return (uint32_t)carry;
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char* data)
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    memset(limbs + 1, 0, (LIMBS - 1) * sizeof(limbs[0]));
+}
+
+bool Num3072::IsOverflow() const
+{
+    // The number is at least the modulus iff all limbs but the lowest are
+    // maximal and the lowest is at least 2^32 - MAX_PRIME_DIFF.
+    if (limbs[0] <= UINT32_MAX - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != UINT32_MAX) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting the modulus is adding MAX_PRIME_DIFF and dropping the carry.
+    AddScaledDiff(limbs, 1);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook multiplication into a double-width product.
+    uint32_t prod[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            carry += (uint64_t)limbs[i] * a.limbs[j] + prod[i + j];
+            prod[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        prod[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // Reduce using 2^3072 == MAX_PRIME_DIFF (mod p): low + high * MAX_PRIME_DIFF.
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        carry += (uint64_t)prod[i + LIMBS] * MAX_PRIME_DIFF + prod[i];
+        limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    // Fold the remaining carry back in the same way. This can carry out
+    // again at most once, and only if the result is then tiny.
+    while (carry) {
+        carry = AddScaledDiff(limbs, carry);
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat's little theorem: a^-1 == a^(p - 2) (mod p). The exponent
+    // p - 2 = 2^3072 - (MAX_PRIME_DIFF + 2) has all bits set except for
+    // some in its lowest limb, so use plain left-to-right exponentiation.
+    const uint32_t low = (uint32_t)0 - (MAX_PRIME_DIFF + 2);
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const uint32_t exp = i == 0 ? low : UINT32_MAX;
+        for (int bit = 31; bit >= 0; --bit) {
+            result.Multiply(result);
+            if ((exp >> bit) & 1) result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char* out) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hash);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    ChaCha20(hash, sizeof(hash)).Output(expanded, sizeof(expanded));
+    return Num3072(expanded);
+}
+
+MuHash3072::MuHash3072(const unsigned char* data, size_t len) : numerator(ToNum3072(data, len)) {}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char* out)
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
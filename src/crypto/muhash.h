@@ -0,0 +1,95 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An element of the multiplicative group of integers modulo 2^3072 - 1103717. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+    static const int LIMBS = 96;
+
+    //! Little-endian 32-bit limbs, always fully reduced.
+    uint32_t limbs[LIMBS];
+
+    //! Construct the number one.
+    Num3072() { SetToOne(); }
+    //! Construct from BYTE_SIZE little-endian bytes, reducing modulo the prime.
+    explicit Num3072(const unsigned char* data);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char* out) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/** A hash of a set of byte strings that can be updated incrementally.
+ *
+ * Each element is hashed to a number modulo the 3072-bit prime 2^3072 - 1103717
+ * (by expanding its SHA256 with ChaCha20), and the set is represented by the
+ * product of those numbers. Adding and removing elements are thus multiplication
+ * and division, which commute, so the result does not depend on the order of
+ * operations. To make removal cheap, numerator and denominator are tracked
+ * separately and the (slow) modular inverse is only computed in Finalize().
+ *
+ * See https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf for the underlying
+ * construction and its security.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    //! The hash of the empty set.
+    MuHash3072() {}
+    //! The hash of the set containing only the given element.
+    MuHash3072(const unsigned char* data, size_t len);
+
+    //! Add an element to the set.
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    //! Remove an element from the set.
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Union of two sets.
+    MuHash3072& operator*=(const MuHash3072& mul);
+    //! Difference of two sets.
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Compute the 32-byte hash of the set.
+    void Finalize(unsigned char* out);
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        unsigned char buf[Num3072::BYTE_SIZE];
+        numerator.ToBytes(buf);
+        s.write((const char*)buf, sizeof(buf));
+        denominator.ToBytes(buf);
+        s.write((const char*)buf, sizeof(buf));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        unsigned char buf[Num3072::BYTE_SIZE];
+        s.read((char*)buf, sizeof(buf));
+        numerator = Num3072(buf);
+        s.read((char*)buf, sizeof(buf));
+        denominator = Num3072(buf);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
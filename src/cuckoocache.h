@@ -475,6 +475,26 @@ public:
             }
         return false;
     }
+
+    /** for_each calls f on every element which has not been marked for
+     * erasure.
+     *
+     * Elements from older epochs are visited before those of the current
+     * epoch, so inserting them into a fresh cache in the order visited keeps
+     * the most recent ones in the newest epoch.
+     *
+     * for_each is not threadsafe with any concurrent insert or erase.
+     *
+     * @param f a callable taking a const Element&
+     */
+    template <typename F>
+    void for_each(F f) const
+    {
+        for (bool recent : {false, true})
+            for (uint32_t i = 0; i < size; ++i)
+                if (!collection_flags.bit_is_set(i) && epoch_flags[i] == recent)
+                    f(table[i]);
+    }
 };
 } // namespace CuckooCache
 
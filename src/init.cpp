@@ -11,9 +11,12 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockencodings.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "clientversion.h"
+#include "coinstatsindex.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
 #include "fs.h"
@@ -34,15 +37,19 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "scriptindex.h"
 #include "sidechain.h"
 #include "sidechaindb.h"
+#include "streams.h"
 #include "timedata.h"
 #include "txdb.h"
+#include "txindex.h"
 #include "txmempool.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxosnapshot.h"
 #include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include <wallet/init.h>
@@ -121,6 +128,7 @@ static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 
 std::atomic<bool> fRequestShutdown(false);
 std::atomic<bool> fDumpMempoolLater(false);
+static std::atomic<bool> fDumpSigCacheLater(false);
 
 void StartShutdown()
 {
@@ -204,6 +212,9 @@ void Shutdown()
     peerLogic.reset();
     g_connman.reset();
 
+    if (g_block_templates) UnregisterValidationInterface(g_block_templates.get());
+    g_block_templates.reset();
+
     StopTorControl();
 
     // After everything has been shut down, but before things get flushed, stop the
@@ -215,6 +226,11 @@ void Shutdown()
         DumpMempool();
     }
 
+    if (fDumpSigCacheLater && gArgs.GetBoolArg("-persistsigcache", DEFAULT_PERSIST_SIGCACHE)) {
+        DumpSignatureCache();
+        DumpScriptExecutionCache();
+    }
+
     if (fFeeEstimatesInitialized)
     {
         ::feeEstimator.FlushUnconfirmed();
@@ -242,6 +258,15 @@ void Shutdown()
     // up with our current chain to avoid any strange pruning edge cases and make
     // next startup faster by avoiding rescan.
 
+    if (g_txindex) {
+        g_txindex->Stop();
+        g_txindex.reset();
+    }
+    if (g_scriptindex) {
+        g_scriptindex->Stop();
+        g_scriptindex.reset();
+    }
+
     {
         LOCK(cs_main);
         if (pcoinsTip != nullptr) {
@@ -251,6 +276,7 @@ void Shutdown()
         pcoinscatcher.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
+        g_coin_stats_index.reset();
     }
 #ifdef ENABLE_WALLET
     StopWallets();
@@ -365,6 +391,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
     strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-persistsigcache", strprintf(_("Whether to save the signature and script execution caches on shutdown and load them on restart (default: %u)"), DEFAULT_PERSIST_SIGCACHE));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file. Relative paths will be prefixed by a net-specific datadir location. (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -373,10 +400,14 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
+    strUsage += HelpMessageOpt("-loadutxosnapshot=<file>", _("Build an empty chain state (e.g. with -reindex-chainstate) from a UTXO snapshot written by dumptxoutset instead of from the blocks up to its base block. "
+            "Only snapshots known to the chain parameters are accepted, and the base block and its ancestors must be in the block index"));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
-    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-coinstatsindex", strprintf(_("Maintain statistics about the UTXO set per block, used by the gettxoutsetinfo rpc call (default: %u)"), DEFAULT_COINSTATSINDEX));
+    strUsage += HelpMessageOpt("-scriptindex", strprintf(_("Maintain an index of outputs and their spends by script, used by the getscripthashoutputs rpc call. It is built in the background and can be enabled or disabled without a reindex (default: %u)"), DEFAULT_SCRIPTINDEX));
+    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call. It is built in the background and can be enabled or disabled without a reindex (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open (see the `addnode` RPC command help for more info)"));
@@ -396,6 +427,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads to process peer messages with (1 to %d, default: %d)"), MAX_MSGHANDLER_THREADS, DEFAULT_MSGHANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
@@ -404,6 +436,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+#ifdef USE_EPOLL
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Wait for socket events with <mode>: select or epoll (default: %s)"), DEFAULT_SOCKETEVENTS));
+#else
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Wait for socket events with <mode>: select (default: %s)"), DEFAULT_SOCKETEVENTS));
+#endif
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -451,6 +488,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-vbparams=deployment:start:end", "Use given start/end times for specified version bits deployment (regtest-only)");
+        strUsage += HelpMessageOpt("-assumeutxo=blockhash:contenthash", "Accept UTXO snapshots of the given block with the given content hash, see -loadutxosnapshot (regtest-only)");
     }
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + ListLogCategories() + ".");
@@ -496,6 +534,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", _("Set maximum BIP141 block weight to this * 4. Deprecated, use blockmaxweight"));
     strUsage += HelpMessageOpt("-blockmaxweight=<n>", strprintf(_("Set maximum BIP141 block weight (default: %d)"), DEFAULT_BLOCK_MAX_WEIGHT));
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
+    strUsage += HelpMessageOpt("-longpollfeedelta=<amt>", strprintf(_("Answer getblocktemplate long polls once the fees of the block template rose by this much (in %s) (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_LONGPOLL_FEE_DELTA)));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
@@ -834,6 +873,7 @@ namespace { // Variables internal to initialization process only
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+SocketEventsMode socketEventsMode;
 ServiceFlags nLocalServices = ServiceFlags(NODE_NETWORK | NODE_NETWORK_LIMITED);
 
 } // namespace
@@ -910,6 +950,8 @@ bool AppInitParameterInteraction()
     if (gArgs.GetArg("-prune", 0)) {
         if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX))
+            return InitError(_("Prune mode is incompatible with -scriptindex."));
     }
 
     // -bind and -whitebind can't be set when not listening
@@ -918,13 +960,27 @@ bool AppInitParameterInteraction()
         return InitError("Cannot set -bind or -whitebind together with -listen=0");
     }
 
+    std::string strSocketEvents = gArgs.GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (strSocketEvents == "select") {
+        socketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef USE_EPOLL
+    } else if (strSocketEvents == "epoll") {
+        socketEventsMode = SOCKETEVENTS_EPOLL;
+#endif
+    } else {
+        return InitError(strprintf(_("Invalid -socketevents ('%s') specified."), strSocketEvents));
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max(nUserBind, size_t(1));
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+    // (select() can only wait for sockets below FD_SETSIZE)
+    if (socketEventsMode == SOCKETEVENTS_SELECT) {
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+    }
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1075,6 +1131,12 @@ bool AppInitParameterInteraction()
         if (!ParseMoney(gArgs.GetArg("-blockmintxfee", ""), n))
             return InitError(AmountErrMsg("blockmintxfee", gArgs.GetArg("-blockmintxfee", "")));
     }
+    if (gArgs.IsArgSet("-longpollfeedelta"))
+    {
+        CAmount n = 0;
+        if (!ParseMoney(gArgs.GetArg("-longpollfeedelta", ""), n))
+            return InitError(AmountErrMsg("longpollfeedelta", gArgs.GetArg("-longpollfeedelta", "")));
+    }
 
     // Feerate used to define dust.  Shouldn't be changed lightly as old
     // implementations may inadvertently create non-standard transactions
@@ -1156,6 +1218,25 @@ bool AppInitParameterInteraction()
             }
         }
     }
+
+    if (gArgs.IsArgSet("-assumeutxo")) {
+        // Allow adding UTXO snapshots for testing
+        if (!chainparams.MineBlocksOnDemand()) {
+            return InitError("UTXO snapshots may only be added on regtest.");
+        }
+        for (const std::string& strSnapshot : gArgs.GetArgs("-assumeutxo")) {
+            std::vector<std::string> vSnapshotParams;
+            boost::split(vSnapshotParams, strSnapshot, boost::is_any_of(":"));
+            if (vSnapshotParams.size() != 2 || !IsHex(vSnapshotParams[0]) || !IsHex(vSnapshotParams[1])) {
+                return InitError("UTXO snapshot parameters malformed, expecting blockhash:contenthash");
+            }
+            AssumeutxoData data;
+            data.hashContents = uint256S(vSnapshotParams[1]);
+            data.nChainTx = 0;
+            UpdateAssumeutxo(uint256S(vSnapshotParams[0]), data);
+            LogPrintf("Accepting UTXO snapshots of block %s with content hash %s\n", vSnapshotParams[0], vSnapshotParams[1]);
+        }
+    }
     return true;
 }
 
@@ -1202,6 +1283,52 @@ bool AppInitLockDataDirectory()
     return true;
 }
 
+/** Load the -loadutxosnapshot file into the empty chainstate database. */
+static bool LoadUTXOSnapshotAtStartup(const CChainParams& chainparams, std::string& strLoadError)
+{
+    const fs::path path = fs::absolute(gArgs.GetArg("-loadutxosnapshot", ""), GetDataDir());
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strLoadError = strprintf(_("Unable to open UTXO snapshot %s"), path.string());
+        return false;
+    }
+
+    // The chainstate is activated at the base block, so all blocks up to it
+    // have to be known already.
+    SnapshotMetadata metadata;
+    try {
+        file >> metadata;
+    } catch (const std::exception& e) {
+        strLoadError = strprintf(_("Unable to read UTXO snapshot %s: %s"), path.string(), e.what());
+        return false;
+    }
+    if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+        strLoadError = strprintf(_("Unable to read UTXO snapshot %s"), path.string());
+        return false;
+    }
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(metadata.hashBaseBlock);
+        if (it == mapBlockIndex.end() || it->second->nChainTx == 0) {
+            strLoadError = strprintf(_("The blocks up to the base block %s of the UTXO snapshot are not in the block index"), metadata.hashBaseBlock.ToString());
+            return false;
+        }
+        const MapAssumeutxo& mapAssumeutxo = chainparams.Assumeutxo();
+        MapAssumeutxo::const_iterator itData = mapAssumeutxo.find(metadata.hashBaseBlock);
+        if (itData != mapAssumeutxo.end() && itData->second.nChainTx != 0 && itData->second.nChainTx != it->second->nChainTx) {
+            strLoadError = strprintf(_("The block index does not match the chain of the UTXO snapshot at block %s"), metadata.hashBaseBlock.ToString());
+            return false;
+        }
+    }
+
+    std::string strError;
+    if (!LoadUTXOSnapshot(file, *pcoinsdbview, chainparams, metadata, strError)) {
+        strLoadError = strprintf(_("Unable to load UTXO snapshot %s: %s"), path.string(), strError);
+        return false;
+    }
+    return true;
+}
+
 bool AppInitMain()
 {
     const CChainParams& chainparams = Params();
@@ -1239,11 +1366,18 @@ bool AppInitMain()
 
     InitSignatureCache();
     InitScriptExecutionCache();
+    if (gArgs.GetBoolArg("-persistsigcache", DEFAULT_PERSIST_SIGCACHE)) {
+        LoadSignatureCache();
+        LoadScriptExecutionCache();
+        fDumpSigCacheLater = true;
+    }
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadShortIdScan);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -1293,6 +1427,9 @@ bool AppInitMain()
     peerLogic.reset(new PeerLogicValidation(&connman, scheduler));
     RegisterValidationInterface(peerLogic.get());
 
+    g_block_templates.reset(new BlockTemplateManager(chainparams));
+    RegisterValidationInterface(g_block_templates.get());
+
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
     for (const std::string& cmt : gArgs.GetArgs("-uacomment")) {
@@ -1403,8 +1540,23 @@ bool AppInitMain()
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    nBlockTreeDBCache = std::min(nBlockTreeDBCache, nMaxBlockDBCache << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nTxIndexCache = 0;
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        nTxIndexCache = std::min(nTotalCache / 8, nMaxTxIndexCache << 20);
+        nTotalCache -= nTxIndexCache;
+    }
+    int64_t nScriptIndexCache = 0;
+    if (gArgs.GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX)) {
+        nScriptIndexCache = std::min(nTotalCache / 8, nMaxScriptIndexCache << 20);
+        nTotalCache -= nScriptIndexCache;
+    }
+    int64_t nCoinStatsIndexCache = 0;
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        nCoinStatsIndexCache = std::min(nTotalCache / 8, nMaxCoinStatsIndexCache << 20);
+        nTotalCache -= nCoinStatsIndexCache;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
@@ -1412,6 +1564,15 @@ bool AppInitMain()
     int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nTxIndexCache > 0) {
+        LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (nScriptIndexCache > 0) {
+        LogPrintf("* Using %.1fMiB for script index database\n", nScriptIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (nCoinStatsIndexCache > 0) {
+        LogPrintf("* Using %.1fMiB for coin stats index database\n", nCoinStatsIndexCache * (1.0 / 1024 / 1024));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
@@ -1440,9 +1601,8 @@ bool AppInitMain()
 
                 if (fRequestShutdown) break;
 
-                // LoadBlockIndex will load fTxIndex from the db, or set it if
-                // we're reindexing. It will also load fHavePruned if we've
-                // ever removed a block file from disk.
+                // LoadBlockIndex will load fHavePruned if we've ever removed a
+                // block file from disk.
                 // Note that it also sets fReindex based on the disk flag!
                 // From here on out fReindex and fReset mean something different!
                 if (!LoadBlockIndex(chainparams)) {
@@ -1455,12 +1615,6 @@ bool AppInitMain()
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
                     return InitError(_("Incorrect or no genesis block found. Wrong datadir for network?"));
 
-                // Check for changed -txindex state
-                if (fTxIndex != gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
-                    break;
-                }
-
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1490,6 +1644,28 @@ bool AppInitMain()
                     break;
                 }
 
+                // Build an empty chainstate from a snapshot instead of from
+                // the blocks. An interrupted earlier attempt is wiped and
+                // started over; a populated chainstate is left alone.
+                bool fSnapshotLoaded = false;
+                if (gArgs.IsArgSet("-loadutxosnapshot") && !fReset) {
+                    if (IsSnapshotLoadIncomplete(*pcoinsdbview)) {
+                        LogPrintf("Wiping the chainstate of an interrupted UTXO snapshot load\n");
+                        pcoinscatcher.reset();
+                        pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, true));
+                        pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
+                    }
+                    if (pcoinsdbview->GetBestBlock().IsNull() && pcoinsdbview->GetHeadBlocks().empty()) {
+                        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+                        if (!LoadUTXOSnapshotAtStartup(chainparams, strLoadError)) {
+                            break;
+                        }
+                        fSnapshotLoaded = true;
+                    } else {
+                        LogPrintf("Chainstate is not empty, ignoring -loadutxosnapshot\n");
+                    }
+                }
+
                 // ReplayBlocks is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
                 if (!ReplayBlocks(chainparams, pcoinsdbview.get())) {
                     strLoadError = _("Unable to replay blocks. You will need to rebuild the database using -reindex-chainstate.");
@@ -1499,7 +1675,7 @@ bool AppInitMain()
                 // The on-disk coinsdb is now in a good state, create the cache
                 pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
 
-                bool is_coinsview_empty = fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull();
+                bool is_coinsview_empty = !fSnapshotLoaded && (fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull());
                 if (!is_coinsview_empty) {
                     // LoadChainTip sets chainActive based on pcoinsTip's best block
                     if (!LoadChainTip(chainparams)) {
@@ -1574,6 +1750,29 @@ bool AppInitMain()
         }
     }
 
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        uiInterface.InitMessage(_("Loading coin stats index..."));
+        LOCK(cs_main);
+        g_coin_stats_index.reset(new CCoinStatsIndex(nCoinStatsIndexCache, false, fReindex || fReindexChainState));
+        // The index is built from the on-disk UTXO set if it has no entry for the tip
+        if (chainActive.Tip()) {
+            FlushStateToDisk();
+            if (!g_coin_stats_index->Init(*pcoinsdbview, chainActive.Tip())) {
+                return InitError(_("Failed to initialize the coin stats index"));
+            }
+        }
+    }
+
+    // The transaction and script indexes catch up in the background
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        g_txindex = std::make_shared<CTxIndex>(nTxIndexCache, false, fReindex);
+        g_txindex->Start();
+    }
+    if (gArgs.GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX)) {
+        g_scriptindex = std::make_shared<CScriptIndex>(nScriptIndexCache, false, fReindex);
+        g_scriptindex->Start();
+    }
+
     bool drivechainsEnabled = IsDrivechainEnabled(chainActive.Tip(), chainparams.GetConsensus());
 
     // Synchronize SCDB
@@ -1734,7 +1933,9 @@ bool AppInitMain()
     connOptions.m_msgproc = peerLogic.get();
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.nMessageHandlerThreads = gArgs.GetArg("-msghandlerthreads", DEFAULT_MSGHANDLER_THREADS);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
+    connOptions.socketEventsMode = socketEventsMode;
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
@@ -220,17 +220,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
-void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
+void BlockAssembler::onlyUnconfirmed(CTxMemPool::vecEntries& package)
 {
-    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
-        // Only test txs not already in the block
-        if (inBlock.count(*iit)) {
-            testSet.erase(iit++);
-        }
-        else {
-            iit++;
-        }
-    }
+    // Only test txs not already in the block
+    package.erase(std::remove_if(package.begin(), package.end(),
+        [this](CTxMemPool::txiter it) { return inBlock.count(it) != 0; }), package.end());
 }
 
 bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const
@@ -247,7 +241,7 @@ bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost
 // - transaction finality (locktime)
 // - premature witness (in case segwit transactions are added to mempool before
 //   segwit activation)
-bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& package)
+bool BlockAssembler::TestPackageTransactions(const CTxMemPool::vecEntries& package)
 {
     for (const CTxMemPool::txiter it : package) {
         if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
@@ -277,16 +271,18 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     }
 }
 
-int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::vecEntries& alreadyAdded,
         indexed_modified_transaction_set &mapModifiedTx)
 {
     int nDescendantsUpdated = 0;
+    CTxMemPool::vecEntries descendants;
     for (const CTxMemPool::txiter it : alreadyAdded) {
-        CTxMemPool::setEntries descendants;
         mempool.CalculateDescendants(it, descendants);
-        // Insert all descendants (not yet in block) into the modified set
+        // Insert all descendants (not yet in block) into the modified set.
+        // Transactions are added to the block after their ancestors, so
+        // the only descendants in it are the ones just added.
         for (CTxMemPool::txiter desc : descendants) {
-            if (alreadyAdded.count(desc))
+            if (inBlock.count(desc))
                 continue;
             ++nDescendantsUpdated;
             modtxiter mit = mapModifiedTx.find(desc);
@@ -452,15 +448,13 @@ bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_tran
     return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
 }
 
-void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries)
+void BlockAssembler::SortForBlock(CTxMemPool::vecEntries& package)
 {
     // Sort package by ancestor count
     // If a transaction A depends on transaction B, then A's ancestor count
     // must be greater than B's.  So this is sufficient to validly order the
     // transactions for block inclusion.
-    sortedEntries.clear();
-    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+    std::sort(package.begin(), package.end(), CompareTxIterByAncestorCount());
 }
 
 // This transaction selection algorithm orders the mempool based
@@ -483,7 +477,10 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
 
     // Start by adding all descendants of previously added txs to mapModifiedTx
     // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+    UpdatePackagesForAdded(CTxMemPool::vecEntries(inBlock.begin(), inBlock.end()), mapModifiedTx);
+
+    // Reused for every package, so evaluating one does not allocate
+    CTxMemPool::vecEntries ancestors;
 
     CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
     CTxMemPool::txiter iter;
@@ -566,13 +563,12 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
             continue;
         }
 
-        CTxMemPool::setEntries ancestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
         std::string dummy;
         mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
 
         onlyUnconfirmed(ancestors);
-        ancestors.insert(iter);
+        ancestors.push_back(iter);
 
         // Test if all tx's are Final
         if (!TestPackageTransactions(ancestors)) {
@@ -587,13 +583,12 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         nConsecutiveFailed = 0;
 
         // Package can be added. Sort the entries in a valid order.
-        std::vector<CTxMemPool::txiter> sortedEntries;
-        SortForBlock(ancestors, iter, sortedEntries);
+        SortForBlock(ancestors);
 
-        for (size_t i=0; i<sortedEntries.size(); ++i) {
-            AddToBlock(sortedEntries[i]);
+        for (size_t i=0; i<ancestors.size(); ++i) {
+            AddToBlock(ancestors[i]);
             // Erase from the modified set, if present
-            mapModifiedTx.erase(sortedEntries[i]);
+            mapModifiedTx.erase(ancestors[i]);
         }
 
         ++nPackagesSelected;
@@ -603,6 +598,240 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+std::unique_ptr<BlockTemplateManager> g_block_templates;
+
+static bool IsSidechainScript(const CScript& scriptPubKey)
+{
+    return ValidSidechainField.find(HexStr(scriptPubKey)) != ValidSidechainField.end();
+}
+
+BlockTemplateManager::BlockTemplateManager(const CChainParams& params) :
+    chainparams(params), options(DefaultOptions(params)), fMineWitnessTx(true), pindexPrev(nullptr),
+    nTimeAssembled(0), fOutdated(false), fRequested(false)
+{
+    // Limit weight as BlockAssembler does
+    nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
+}
+
+void BlockTemplateManager::Assemble()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    pblocktemplate.reset();
+    std::unique_ptr<CBlockTemplate> pblocktemplateNew = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey, fMineWitnessTx);
+    if (!pblocktemplateNew)
+        return;
+    pblocktemplate = std::move(pblocktemplateNew);
+    const CBlock& block = pblocktemplate->block;
+
+    pindexPrev = chainActive.Tip();
+    nTimeAssembled = GetTime();
+    fOutdated = false;
+    fRequested = false;
+
+    setTxids.clear();
+    setSpent.clear();
+    nBlockSigOpsCost = 0;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        setTxids.insert(tx.GetHash());
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin) {
+                setSpent.insert(txin.prevout);
+            }
+        }
+        // WT^ payouts come after the mempool transactions and have no entry
+        nBlockSigOpsCost += i < pblocktemplate->vTxSigOpsCost.size() ? pblocktemplate->vTxSigOpsCost[i] : WITNESS_SCALE_FACTOR * GetLegacySigOpCount(tx);
+    }
+    nBlockWeight = GetBlockWeight(block);
+    nFees = -pblocktemplate->vTxFees[0];
+    nHeight = pindexPrev->nHeight + 1;
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : block.GetBlockTime();
+    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
+}
+
+void BlockTemplateManager::Reassemble()
+{
+    AssertLockHeld(cs);
+
+    try {
+        Assemble();
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        pblocktemplate.reset();
+    }
+}
+
+bool BlockTemplateManager::AddTransaction(const CTransaction& tx)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    AssertLockHeld(cs);
+
+    const uint256& hash = tx.GetHash();
+    CTxMemPool::txiter it = mempool.mapTx.find(hash);
+    if (it == mempool.mapTx.end() || setTxids.count(hash))
+        return true;
+
+    // Transactions no template would include
+    if (it->GetModifiedFee() < options.blockMinFeeRate.GetFee(it->GetTxSize()))
+        return true;
+    if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
+        return true;
+    if (!fIncludeWitness && tx.HasWitness())
+        return true;
+
+    // Critical data changes the coinbase commitments, and sidechain
+    // deposits and withdrawals are checked against the SCDB. Leave those
+    // to BlockAssembler.
+    if (!tx.criticalData.IsNull() || it->GetSpendsCriticalData())
+        return false;
+    for (const CTxOut& txout : tx.vout) {
+        if (IsSidechainScript(txout.scriptPubKey))
+            return false;
+    }
+
+    if (nBlockWeight + it->GetTxWeight() >= nBlockMaxWeight)
+        return false;
+    if (nBlockSigOpsCost + it->GetSigOpCost() >= MAX_BLOCK_SIGOPS_COST)
+        return false;
+
+    for (const CTxIn& txin : tx.vin) {
+        if (setSpent.count(txin.prevout))
+            return false;
+        // An in-mempool parent has to be in the template already. The
+        // mempool holds the parents of what it holds, so any other input
+        // is confirmed.
+        CTxMemPool::txiter itParent = mempool.mapTx.find(txin.prevout.hash);
+        const CTxOut* txout;
+        if (itParent != mempool.mapTx.end()) {
+            if (!setTxids.count(txin.prevout.hash))
+                return false;
+            txout = &itParent->GetTx().vout[txin.prevout.n];
+        } else {
+            const Coin& coin = pcoinsTip->AccessCoin(txin.prevout);
+            if (coin.IsSpent())
+                return false;
+            txout = &coin.out;
+        }
+        if (IsSidechainScript(txout->scriptPubKey))
+            return false;
+    }
+
+    // Insert it after the mempool transactions, ahead of any WT^ payouts,
+    // and pay its fee to the coinbase.
+    CBlock& block = pblocktemplate->block;
+    const CAmount nTxFee = it->GetFee();
+    CMutableTransaction coinbaseTx(*block.vtx[0]);
+    coinbaseTx.vout[0].nValue += nTxFee;
+    if (!pblocktemplate->vchCoinbaseCommitment.empty()) {
+        // The witness commitment is added last
+        coinbaseTx.vout.pop_back();
+    }
+    block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    block.vtx.insert(block.vtx.begin() + pblocktemplate->vTxFees.size(), it->GetSharedTx());
+    pblocktemplate->vTxFees.push_back(nTxFee);
+    pblocktemplate->vTxFees[0] -= nTxFee;
+    pblocktemplate->vTxSigOpsCost.push_back(it->GetSigOpCost());
+    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(block, pindexPrev, chainparams.GetConsensus());
+
+    setTxids.insert(hash);
+    for (const CTxIn& txin : tx.vin) {
+        setSpent.insert(txin.prevout);
+    }
+    nBlockWeight += it->GetTxWeight();
+    nBlockSigOpsCost += it->GetSigOpCost();
+    nFees += nTxFee;
+    return true;
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateManager::GetTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTxIn)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+
+    if (!pblocktemplate || pindexPrev != chainActive.Tip() ||
+        scriptPubKeyIn != scriptPubKey || fMineWitnessTxIn != fMineWitnessTx ||
+        (fOutdated && GetTime() - nTimeAssembled > TEMPLATE_REASSEMBLE_INTERVAL))
+    {
+        scriptPubKey = scriptPubKeyIn;
+        fMineWitnessTx = fMineWitnessTxIn;
+        Assemble();
+        if (!pblocktemplate)
+            return nullptr;
+    }
+    fRequested = true;
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*pblocktemplate));
+}
+
+CAmount BlockTemplateManager::GetTemplateFees(const uint256& hashPrevBlock) const
+{
+    LOCK(cs);
+    if (!pblocktemplate || pblocktemplate->block.hashPrevBlock != hashPrevBlock)
+        return -1;
+    return nFees;
+}
+
+void BlockTemplateManager::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    {
+        LOCK(cs);
+        if (!pblocktemplate)
+            return;
+    }
+
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    if (!pblocktemplate || pindexPrev == chainActive.Tip())
+        return;
+    // Nobody mines on the last tip's template; wait for them to ask again.
+    if (fInitialDownload || !fRequested) {
+        pblocktemplate.reset();
+        return;
+    }
+    Reassemble();
+}
+
+void BlockTemplateManager::TransactionAddedToMempool(const CTransactionRef& ptx)
+{
+    {
+        LOCK(cs);
+        if (!pblocktemplate)
+            return;
+    }
+
+    bool fImproved = false;
+    {
+        LOCK2(cs_main, mempool.cs);
+        LOCK(cs);
+        // The new tip's template is on its way
+        if (!pblocktemplate || pindexPrev != chainActive.Tip())
+            return;
+        const CAmount nFeesBefore = nFees;
+        if (!AddTransaction(*ptx))
+            fOutdated = true;
+        if (fOutdated && fRequested && GetTime() - nTimeAssembled > TEMPLATE_REASSEMBLE_INTERVAL)
+            Reassemble();
+        fImproved = pblocktemplate && nFees > nFeesBefore;
+    }
+
+    // Let long polls see the new fees
+    if (fImproved) {
+        WaitableLock lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
+}
+
+void BlockTemplateManager::TransactionRemovedFromMempool(const CTransactionRef& ptx)
+{
+    LOCK(cs);
+    if (setTxids.count(ptx->GetHash()))
+        fOutdated = true;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -7,10 +7,13 @@
 #define BITCOIN_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
+#include <validationinterface.h>
 
 #include <stdint.h>
 #include <memory>
+#include <set>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 
@@ -21,6 +24,10 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -longpollfeedelta, the rise in template fees that answers a getblocktemplate long poll */
+static const CAmount DEFAULT_LONGPOLL_FEE_DELTA = 10000;
+/** Seconds a block template that misses mempool changes is used before it is assembled again */
+static const int64_t TEMPLATE_REASSEMBLE_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -172,30 +179,97 @@ private:
     void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated);
 
     // helper functions for addPackageTxs()
-    /** Remove confirmed (inBlock) entries from given set */
-    void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
+    /** Remove confirmed (inBlock) entries from given package */
+    void onlyUnconfirmed(CTxMemPool::vecEntries& package);
     /** Test if a new package would "fit" in the block */
     bool TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const;
     /** Perform checks on each transaction in a package:
       * locktime, premature-witness, serialized size (if necessary)
       * These checks should always succeed, and they're here
       * only as an extra check in case of suboptimal node configuration */
-    bool TestPackageTransactions(const CTxMemPool::setEntries& package);
+    bool TestPackageTransactions(const CTxMemPool::vecEntries& package);
     /** Return true if given transaction from mapTx has already been evaluated,
       * or if the transaction's cached data in mapTx is incorrect. */
     bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx);
-    /** Sort the package in an order that is valid to appear in a block */
-    void SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries);
+    /** Sort the package in place in an order that is valid to appear in a block */
+    void SortForBlock(CTxMemPool::vecEntries& package);
     /** Add descendants of given transactions to mapModifiedTx with ancestor
       * state updated assuming given transactions are inBlock. Returns number
       * of updated descendants. */
-    int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+    int UpdatePackagesForAdded(const CTxMemPool::vecEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 
     // SidechainDB
     /** Returns a WT^ payout transaction for nSidechain if there is one */
     CTransaction CreateWTPrimePayout(uint8_t nSidechain);
 };
 
+/**
+ * Keeps the block template handed out by getblocktemplate up to date with
+ * the mempool, so that serving one only takes a copy.
+ *
+ * A transaction entering the mempool is added to the template when checking
+ * the transaction alone is enough: it is final, fits, spends only confirmed
+ * outputs or those of transactions in the template, and conflicts with none
+ * of them. Its scripts were checked against the same tip when the mempool
+ * accepted it, so the rest of the template is not validated again. Anything
+ * else, such as a transaction leaving the mempool while in the template,
+ * marks the template outdated, and an outdated template is assembled from
+ * scratch once it is TEMPLATE_REASSEMBLE_INTERVAL seconds old. A new tip
+ * gets a new template right away. Both happen on the validation interface
+ * thread, and only while templates are being asked for.
+ */
+class BlockTemplateManager final : public CValidationInterface
+{
+public:
+    explicit BlockTemplateManager(const CChainParams& params);
+
+    /** A copy of the template for the current tip, paying to scriptPubKeyIn. */
+    std::unique_ptr<CBlockTemplate> GetTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTx);
+    /** The fees of the template building on hashPrevBlock, or -1 if there is none. */
+    CAmount GetTemplateFees(const uint256& hashPrevBlock) const;
+
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx) override;
+
+private:
+    /** Assemble the template from scratch on the current tip. */
+    void Assemble();
+    /** Assemble the template again, dropping it if that fails. */
+    void Reassemble();
+    /** Add a mempool transaction to the template. Returns false if the
+     *  template may now be missing transactions a new one would have. */
+    bool AddTransaction(const CTransaction& tx);
+
+    const CChainParams& chainparams;
+    const BlockAssembler::Options options;
+    uint64_t nBlockMaxWeight;
+
+    mutable CCriticalSection cs;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    CScript scriptPubKey;
+    bool fMineWitnessTx;
+    //! The tip the template builds on
+    const CBlockIndex* pindexPrev;
+    int64_t nTimeAssembled;
+    //! Whether the mempool changed in a way the template does not reflect
+    bool fOutdated;
+    //! Whether the template was handed out since it was assembled
+    bool fRequested;
+
+    // What adding a transaction has to check against
+    std::set<uint256> setTxids;
+    std::set<COutPoint> setSpent;
+    uint64_t nBlockWeight;
+    int64_t nBlockSigOpsCost;
+    CAmount nFees;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    bool fIncludeWitness;
+};
+
+extern std::unique_ptr<BlockTemplateManager> g_block_templates;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
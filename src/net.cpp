@@ -24,6 +24,11 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -448,6 +453,11 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         CloseSocket(hSocket);
         return nullptr;
     }
+    if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
+        LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
+        CloseSocket(hSocket);
+        return nullptr;
+    }
 
     // Add node
     NodeId id = GetNewNodeId();
@@ -495,6 +505,7 @@ void CConnman::ClearBanned()
     {
         LOCK(cs_setBanned);
         setBanned.clear();
+        RebuildBanIndex();
         setBannedIsDirty = true;
     }
     DumpBanlist(); //store banlist to disk
@@ -505,15 +516,7 @@ void CConnman::ClearBanned()
 bool CConnman::IsBanned(CNetAddr ip)
 {
     LOCK(cs_setBanned);
-    for (const auto& it : setBanned) {
-        CSubNet subNet = it.first;
-        CBanEntry banEntry = it.second;
-
-        if (subNet.Match(ip) && GetTime() < banEntry.nBanUntil) {
-            return true;
-        }
-    }
-    return false;
+    return banTrie.Match(ip, GetTime());
 }
 
 bool CConnman::IsBanned(CSubNet subnet)
@@ -549,6 +552,11 @@ void CConnman::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t ba
         LOCK(cs_setBanned);
         if (setBanned[subNet].nBanUntil < banEntry.nBanUntil) {
             setBanned[subNet] = banEntry;
+            banTrie.Insert(subNet, banEntry.nBanUntil);
+            banExpiry.emplace(banEntry.nBanUntil, subNet);
+            // Don't let entries for lifted or extended bans pile up
+            if (banExpiry.size() > 2 * setBanned.size() + 100)
+                RebuildBanIndex();
             setBannedIsDirty = true;
         }
         else
@@ -577,6 +585,7 @@ bool CConnman::Unban(const CSubNet &subNet) {
         LOCK(cs_setBanned);
         if (!setBanned.erase(subNet))
             return false;
+        banTrie.Erase(subNet);
         setBannedIsDirty = true;
     }
     if(clientInterface)
@@ -597,29 +606,40 @@ void CConnman::SetBanned(const banmap_t &banMap)
 {
     LOCK(cs_setBanned);
     setBanned = banMap;
+    RebuildBanIndex();
     setBannedIsDirty = true;
 }
 
+void CConnman::RebuildBanIndex()
+{
+    AssertLockHeld(cs_setBanned);
+    banTrie.Clear();
+    banExpiry = decltype(banExpiry)();
+    for (const auto& entry : setBanned) {
+        banTrie.Insert(entry.first, entry.second.nBanUntil);
+        banExpiry.emplace(entry.second.nBanUntil, entry.first);
+    }
+}
+
 void CConnman::SweepBanned()
 {
     int64_t now = GetTime();
     bool notifyUI = false;
     {
         LOCK(cs_setBanned);
-        banmap_t::iterator it = setBanned.begin();
-        while(it != setBanned.end())
+        while (!banExpiry.empty() && now > banExpiry.top().first)
         {
-            CSubNet subNet = (*it).first;
-            CBanEntry banEntry = (*it).second;
-            if(now > banEntry.nBanUntil)
+            const CSubNet& subNet = banExpiry.top().second;
+            banmap_t::iterator it = setBanned.find(subNet);
+            if (it != setBanned.end() && it->second.nBanUntil == banExpiry.top().first)
             {
-                setBanned.erase(it++);
+                setBanned.erase(it);
+                banTrie.Erase(subNet);
                 setBannedIsDirty = true;
                 notifyUI = true;
                 LogPrint(BCLog::NET, "%s: Removed banned node ip/subnet from banlist.dat: %s\n", __func__, subNet.ToString());
             }
-            else
-                ++it;
+            banExpiry.pop();
         }
     }
     // update UI
@@ -743,10 +763,16 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     nRecvBytes += nBytes;
     while (nBytes > 0) {
 
-        // get current incomplete message, or create a new one
+        // get current incomplete message, or reuse or create a new one
         if (vRecvMsg.empty() ||
-            vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.back().complete()) {
+            if (!vRecvMsgPool.empty()) {
+                vRecvMsg.splice(vRecvMsg.end(), vRecvMsgPool, vRecvMsgPool.begin());
+                vRecvMsg.back().Reset(Params().MessageStart(), INIT_PROTO_VERSION);
+            } else {
+                vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            }
+        }
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -786,6 +812,18 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+void CNode::RecycleMessages(std::list<CNetMessage>& msgs)
+{
+    LOCK(cs_vRecv);
+    auto it = msgs.begin();
+    while (it != msgs.end() && vRecvMsgPool.size() < MAX_RECV_MSG_POOL_SIZE) {
+        auto next = std::next(it);
+        if (it->vRecv.capacity() <= MAX_RECV_MSG_POOL_BUFFER)
+            vRecvMsgPool.splice(vRecvMsgPool.end(), msgs, it);
+        it = next;
+    }
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -813,6 +851,21 @@ int CNode::GetSendVersion() const
 }
 
 
+void CNetMessage::Reset(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nVersionIn)
+{
+    hasher.Reset();
+    data_hash.SetNull();
+    in_data = false;
+    hdrbuf.clear();
+    hdrbuf.resize(24);
+    hdr = CMessageHeader(pchMessageStartIn);
+    nHdrPos = 0;
+    vRecv.clear();
+    nDataPos = 0;
+    nTime = 0;
+    SetVersion(nVersionIn);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -877,41 +930,94 @@ const uint256& CNetMessage::GetMessageHash() const
 
 
 
+#ifdef WIN32
+static const int MAX_SEND_SEGMENTS = 1;
+#else
+// Header and payload segments gathered into a single sendmsg() call
+static const int MAX_SEND_SEGMENTS = 64;
+#endif
+
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
-    auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
-    while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+    while (!pnode->vSendMsg.empty()) {
+        // Gather the unsent parts of the queued messages, starting at nSendOffset
+        const unsigned char* vSegmentData[MAX_SEND_SEGMENTS];
+        size_t vSegmentSize[MAX_SEND_SEGMENTS];
+        int nSegments = 0;
+        size_t nGathered = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (auto it = pnode->vSendMsg.begin(); it != pnode->vSendMsg.end() && nSegments < MAX_SEND_SEGMENTS; ++it) {
+            const CSendBuffer& buffer = **it;
+            assert(buffer.size() > nOffset);
+            if (nOffset < CMessageHeader::HEADER_SIZE) {
+                vSegmentData[nSegments] = buffer.header + nOffset;
+                vSegmentSize[nSegments] = CMessageHeader::HEADER_SIZE - nOffset;
+                nGathered += vSegmentSize[nSegments++];
+                nOffset = 0;
+            } else {
+                nOffset -= CMessageHeader::HEADER_SIZE;
+            }
+            if (nOffset < buffer.payload.size() && nSegments < MAX_SEND_SEGMENTS) {
+                vSegmentData[nSegments] = buffer.payload.data() + nOffset;
+                vSegmentSize[nSegments] = buffer.payload.size() - nOffset;
+                nGathered += vSegmentSize[nSegments++];
+            }
+            nOffset = 0;
+        }
+
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(vSegmentData[0]), vSegmentSize[0], MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            struct iovec vIov[MAX_SEND_SEGMENTS];
+            for (int i = 0; i < nSegments; ++i) {
+                vIov[i].iov_base = const_cast<unsigned char*>(vSegmentData[i]);
+                vIov[i].iov_len = vSegmentSize[i];
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = vIov;
+            msg.msg_iovlen = nSegments;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Release the messages that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const CSendBuffer& buffer = *pnode->vSendMsg.front();
+                size_t nRemaining = buffer.size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= buffer.size();
                 pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-                it++;
-            } else {
-                // could not send full message; stop sending more
+                pnode->vSendMsg.pop_front();
+            }
+            if ((size_t)nBytes < nGathered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
             if (nBytes < 0) {
                 // error
                 int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                if (nErr == WSAEWOULDBLOCK) {
+                    // the socket's send buffer is full; wait for it to become writable again
+                    pnode->fSendReady = false;
+                } else if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                 {
                     LogPrintf("socket send error %s\n", NetworkErrorString(nErr));
                     pnode->CloseSocketDisconnect();
@@ -922,11 +1028,10 @@ size_t CConnman::SocketSendData(CNode *pnode) const
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (pnode->vSendMsg.empty()) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
     return nSentSize;
 }
 
@@ -1103,7 +1208,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1142,15 +1247,193 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint(BCLog::NET, "connection from %s accepted\n", addr.ToString());
 
+    RegisterSocketEvents(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
+void CConnman::RegisterSocketEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+
+    // Edge-triggered: an event is only reported when the socket becomes
+    // readable or writable, so the readiness flags on the node are what keeps
+    // track of it afterwards. The registration goes away by itself when the
+    // socket is closed.
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+    struct epoll_event event;
+    event.data.ptr = pnode;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
+void CConnman::SocketEventsSelect(std::set<SOCKET>& setListenReady)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+        {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+                continue;
+            }
+            if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
+            }
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            return;
+    }
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+            setListenReady.insert(hListenSocket.socket);
+        }
+    }
+
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes)
+    {
+        bool recvSet = false;
+        bool sendSet = false;
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket != INVALID_SOCKET) {
+                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError);
+                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
+            }
+        }
+        pnode->fRecvReady = recvSet;
+        LOCK(pnode->cs_vSend);
+        pnode->fSendReady = sendSet;
+    }
+}
+
+#ifdef USE_EPOLL
+void CConnman::SocketEventsEpoll(bool fOnlyPoll, std::set<SOCKET>& setListenReady)
+{
+    const int nMaxEvents = 256;
+    struct epoll_event events[nMaxEvents];
+
+    // Only sockets that changed state are reported, so this does not depend
+    // on the number of connected peers.
+    int nEvents = epoll_wait(epollfd, events, nMaxEvents, fOnlyPoll ? 0 : 50);
+    if (interruptNet)
+        return;
+
+    if (nEvents < 0)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(50));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        bool fListenSocket = false;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            if (events[i].data.ptr == &hListenSocket) {
+                setListenReady.insert(hListenSocket.socket);
+                fListenSocket = true;
+                break;
+            }
+        }
+        if (fListenSocket)
+            continue;
+
+        // Nodes are only deleted by this thread, and a node's socket (and
+        // with it its registration) is closed before that.
+        CNode* pnode = static_cast<CNode*>(events[i].data.ptr);
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+            pnode->fRecvReady = true;
+        }
+        if (events[i].events & EPOLLOUT) {
+            LOCK(pnode->cs_vSend);
+            pnode->fSendReady = true;
+        }
+    }
+}
+#endif
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    bool fMoreWork = false;
     while (!interruptNet)
     {
         //
@@ -1215,93 +1498,25 @@ void CConnman::ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Find which sockets are ready
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> setListenReady;
+#ifdef USE_EPOLL
+        if (socketEventsMode == SOCKETEVENTS_EPOLL)
+            SocketEventsEpoll(fMoreWork, setListenReady);
+        else
+#endif
+            SocketEventsSelect(setListenReady);
         if (interruptNet)
             return;
-
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
+        fMoreWork = false;
 
         //
         // Accept new connections
         //
         for (const ListenSocket& hListenSocket : vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && setListenReady.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1322,21 +1537,30 @@ void CConnman::ThreadSocketHandler()
             if (interruptNet)
                 return;
 
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
             {
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
             }
-            if (recvSet || errorSet)
+            bool recvSet = pnode->fRecvReady;
+            bool sendSet = false;
+            {
+                LOCK(pnode->cs_vSend);
+                bool fSendPending = !pnode->vSendMsg.empty();
+                sendSet = pnode->fSendReady && fSendPending;
+                if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+                    // Readiness is not reset between iterations here, so apply
+                    // the policy SocketEventsSelect() uses to pick the sockets
+                    // to wait for: drain the send buffer before receiving more,
+                    // and leave paused peers alone.
+                    recvSet = recvSet && !fSendPending && !pnode->fPauseRecv;
+                }
+            }
+
+            //
+            // Receive
+            //
+            if (recvSet)
             {
                 // typical socket buffer is 8K-64K
                 char pchBuf[0x10000];
@@ -1347,6 +1571,10 @@ void CConnman::ThreadSocketHandler()
                         continue;
                     nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
                 }
+                // A short read means the socket's receive buffer was drained;
+                // anything arriving later will be reported as a new event.
+                if (nBytes < (int)sizeof(pchBuf))
+                    pnode->fRecvReady = false;
                 if (nBytes > 0)
                 {
                     bool notify = false;
@@ -1394,12 +1622,20 @@ void CConnman::ThreadSocketHandler()
             //
             // Send
             //
-            if (sendSet)
             {
                 LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes) {
-                    RecordBytesSent(nBytes);
+                if (sendSet) {
+                    size_t nBytes = SocketSendData(pnode);
+                    if (nBytes) {
+                        RecordBytesSent(nBytes);
+                    }
+                }
+                // With epoll, a socket that is still ready and has work left is
+                // not reported again, so poll instead of waiting next time.
+                if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+                    bool fSendPending = !pnode->vSendMsg.empty();
+                    if ((pnode->fSendReady && fSendPending) || (pnode->fRecvReady && !fSendPending && !pnode->fPauseRecv))
+                        fMoreWork = true;
                 }
             }
 
@@ -1448,9 +1684,9 @@ void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        vMsgProcWake.assign(vMsgProcWake.size(), true);
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 
@@ -1985,13 +2221,14 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         pnode->m_manual_connection = true;
 
     m_msgproc->InitializeNode(pnode);
+    RegisterSocketEvents(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
     while (!flagInterruptMsgProc)
     {
@@ -2008,6 +2245,8 @@ void CConnman::ThreadMessageHandler()
 
         for (CNode* pnode : vNodesCopy)
         {
+            if (pnode->GetId() % nMessageHandlerThreads != nThread)
+                continue;
             if (pnode->fDisconnect)
                 continue;
 
@@ -2034,9 +2273,9 @@ void CConnman::ThreadMessageHandler()
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, nThread] { return vMsgProcWake[nThread]; });
         }
-        fMsgProcWake = false;
+        vMsgProcWake[nThread] = false;
     }
 }
 
@@ -2203,6 +2442,9 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nReceiveFloodSize = 0;
     flagInterruptMsgProc = false;
     SetTryNewOutboundPeer(false);
+#ifdef USE_EPOLL
+    epollfd = -1;
+#endif
 
     Options connOptions;
     Init(connOptions);
@@ -2268,6 +2510,27 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         return false;
     }
 
+#ifdef USE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("Failed to create epoll instance: %s\n", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        // Listening sockets are level-triggered: one connection is accepted
+        // per iteration, as with select().
+        for (ListenSocket& hListenSocket : vhListenSocket) {
+            struct epoll_event event;
+            event.data.ptr = &hListenSocket;
+            event.events = EPOLLIN;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                LogPrintf("Failed to add listening socket to epoll instance: %s\n", NetworkErrorString(WSAGetLastError()));
+                return false;
+            }
+        }
+    }
+#endif
+
     for (const auto& strDest : connOptions.vSeedNodes) {
         AddOneShot(strDest);
     }
@@ -2325,12 +2588,6 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     assert(m_msgproc);
     InterruptSocks5(false);
     interruptNet.reset();
-    flagInterruptMsgProc = false;
-
-    {
-        std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
-    }
 
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
@@ -2355,7 +2612,7 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    StartMessageHandlers();
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2363,6 +2620,28 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     return true;
 }
 
+void CConnman::StartMessageHandlers()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutexMsgProc);
+        flagInterruptMsgProc = false;
+        vMsgProcWake.assign(nMessageHandlerThreads, false);
+    }
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        std::string strThreadName = i == 0 ? "msghand" : strprintf("msghand.%d", i);
+        threadMessageHandlers.emplace_back([this, i, strThreadName] { TraceThread(strThreadName.c_str(), std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i))); });
+    }
+}
+
+void CConnman::StopMessageHandlers()
+{
+    for (std::thread& threadMessageHandler : threadMessageHandlers) {
+        if (threadMessageHandler.joinable())
+            threadMessageHandler.join();
+    }
+    threadMessageHandlers.clear();
+}
+
 class CNetCleanup
 {
 public:
@@ -2404,8 +2683,7 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    StopMessageHandlers();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2428,6 +2706,12 @@ void CConnman::Stop()
         if (hListenSocket.socket != INVALID_SOCKET)
             if (!CloseSocket(hListenSocket.socket))
                 LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
 
     // clean up some globals (to help leak detection)
     for (CNode *pnode : vNodes) {
@@ -2740,6 +3024,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fRecvReady = false;
+    fSendReady = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2797,19 +3083,35 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+CSendBufferRef CConnman::PrepareMessage(CSerializedNetMsg&& msg) const
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
-
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    uint256 hash = Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    std::shared_ptr<CSendBuffer> buffer = g_send_buffer_pool.MakeBuffer(std::move(msg.data));
+    buffer->command = std::move(msg.command);
+    unsigned char* pch = buffer->header;
+    memcpy(pch, hdr.pchMessageStart, CMessageHeader::MESSAGE_START_SIZE);
+    pch += CMessageHeader::MESSAGE_START_SIZE;
+    memcpy(pch, hdr.pchCommand, CMessageHeader::COMMAND_SIZE);
+    pch += CMessageHeader::COMMAND_SIZE;
+    WriteLE32(pch, hdr.nMessageSize);
+    pch += CMessageHeader::MESSAGE_SIZE_SIZE;
+    memcpy(pch, hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE);
+    return buffer;
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, PrepareMessage(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSendBufferRef& buffer)
+{
+    size_t nMessageSize = buffer->payload.size();
+    size_t nTotalSize = buffer->size();
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(buffer->command.c_str()), nMessageSize, pnode->GetId());
 
     size_t nBytesSent = 0;
     {
@@ -2817,14 +3119,12 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[buffer->command] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(buffer);
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
@@ -2834,6 +3134,59 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         RecordBytesSent(nBytesSent);
 }
 
+struct CSendBufferPool::State
+{
+    std::mutex mutex;
+    std::vector<std::vector<unsigned char>> vFree;
+    size_t nFreeBytes = 0;
+
+    void Release(std::vector<unsigned char>&& payload)
+    {
+        size_t nCapacity = payload.capacity();
+        if (nCapacity == 0 || nCapacity > MAX_PROTOCOL_MESSAGE_LENGTH)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (vFree.size() >= MAX_SEND_BUFFER_POOL_SIZE || nFreeBytes + nCapacity > MAX_SEND_BUFFER_POOL_BYTES)
+            return;
+        payload.clear();
+        nFreeBytes += nCapacity;
+        vFree.push_back(std::move(payload));
+    }
+};
+
+CSendBufferPool g_send_buffer_pool;
+
+CSendBufferPool::CSendBufferPool() : state(std::make_shared<State>()) {}
+
+std::vector<unsigned char> CSendBufferPool::GetPayload()
+{
+    std::vector<unsigned char> payload;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (!state->vFree.empty()) {
+        payload = std::move(state->vFree.back());
+        state->vFree.pop_back();
+        state->nFreeBytes -= payload.capacity();
+    }
+    return payload;
+}
+
+std::shared_ptr<CSendBuffer> CSendBufferPool::MakeBuffer(std::vector<unsigned char>&& payload)
+{
+    CSendBuffer* buffer = new CSendBuffer();
+    buffer->payload = std::move(payload);
+    std::shared_ptr<State> stateIn = state;
+    return std::shared_ptr<CSendBuffer>(buffer, [stateIn](CSendBuffer* p) {
+        stateIn->Release(std::move(p->payload));
+        delete p;
+    });
+}
+
+size_t CSendBufferPool::GetFreeCount() const
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->vFree.size();
+}
+
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode* pnode)> func)
 {
     CNode* found = nullptr;
@@ -9,6 +9,7 @@
 #include <addrdb.h>
 #include <addrman.h>
 #include <amount.h>
+#include <bantrie.h>
 #include <bloom.h>
 #include <compat.h>
 #include <hash.h>
@@ -27,6 +28,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <queue>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -83,6 +85,25 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -msghandlerthreads default */
+static const int DEFAULT_MSGHANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
+/** Number of processed messages a peer keeps so their receive buffers can be reused */
+static const size_t MAX_RECV_MSG_POOL_SIZE = 2;
+/** Receive buffers larger than this are freed after processing rather than reused */
+static const size_t MAX_RECV_MSG_POOL_BUFFER = 256 * 1024;
+
+/** How ThreadSocketHandler waits for socket readiness (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
@@ -113,6 +134,48 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** A message with its header serialized, ready to be sent to any number of peers. */
+struct CSendBuffer
+{
+    std::string command;
+    unsigned char header[CMessageHeader::HEADER_SIZE];
+    std::vector<unsigned char> payload;
+
+    size_t size() const { return CMessageHeader::HEADER_SIZE + payload.size(); }
+};
+
+typedef std::shared_ptr<const CSendBuffer> CSendBufferRef;
+
+/** Maximum number of payload vectors kept for reuse by CSendBufferPool */
+static const size_t MAX_SEND_BUFFER_POOL_SIZE = 64;
+/** Maximum total capacity of the payload vectors kept for reuse by CSendBufferPool */
+static const size_t MAX_SEND_BUFFER_POOL_BYTES = 2 * MAX_PROTOCOL_MESSAGE_LENGTH;
+
+/**
+ * Recycles the payload storage of sent messages. Buffers made by the pool
+ * hand their payload back to it once the last peer has sent them, so that
+ * serializing the next message does not need a fresh allocation.
+ */
+class CSendBufferPool
+{
+public:
+    CSendBufferPool();
+
+    /** An empty vector, with capacity left over from an earlier message if one is available. */
+    std::vector<unsigned char> GetPayload();
+    /** Wrap a payload into a buffer whose storage returns to the pool when it is released. */
+    std::shared_ptr<CSendBuffer> MakeBuffer(std::vector<unsigned char>&& payload);
+    /** Number of payload vectors currently available for reuse. */
+    size_t GetFreeCount() const;
+
+private:
+    struct State;
+    // Shared with the buffers' deleters, which may run after the pool is gone
+    std::shared_ptr<State> state;
+};
+
+extern CSendBufferPool g_send_buffer_pool;
+
 class NetEventsInterface;
 class CConnman
 {
@@ -145,6 +208,8 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
+        int nMessageHandlerThreads = DEFAULT_MSGHANDLER_THREADS;
     };
 
     void Init(const Options& connOptions) {
@@ -158,6 +223,8 @@ public:
         m_msgproc = connOptions.m_msgproc;
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
+        socketEventsMode = connOptions.socketEventsMode;
+        nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MSGHANDLER_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -183,6 +250,9 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    /** Serialize a message's header once, so the result can be pushed to many peers without copying it. */
+    CSendBufferRef PrepareMessage(CSerializedNetMsg&& msg) const;
+    void PushMessage(CNode* pnode, const CSendBufferRef& buffer);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -329,8 +399,16 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
+    /** Start the message handler threads, and wait for them once interrupted. */
+    void StartMessageHandlers();
+    void StopMessageHandlers();
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void RegisterSocketEvents(CNode* pnode);
+    void SocketEventsSelect(std::set<SOCKET>& setListenReady);
+#ifdef USE_EPOLL
+    void SocketEventsEpoll(bool fOnlyPoll, std::set<SOCKET>& setListenReady);
+#endif
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -356,6 +434,8 @@ private:
     void SetBannedSetDirty(bool dirty=true);
     //!clean unused entries (if bantime has expired)
     void SweepBanned();
+    //!rebuild banTrie and banExpiry from setBanned, requires cs_setBanned
+    void RebuildBanIndex();
     void DumpAddresses();
     void DumpData();
     void DumpBanlist();
@@ -387,8 +467,18 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    SocketEventsMode socketEventsMode;
+#ifdef USE_EPOLL
+    //! epoll instance all listening and peer sockets are registered with, in SOCKETEVENTS_EPOLL mode
+    int epollfd;
+#endif
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
+    //! setBanned indexed for matching addresses against it
+    CBanTrie banTrie;
+    //! Expiry times of setBanned entries, earliest first. Entries whose ban
+    //! was lifted or extended since are skipped when they come up.
+    std::priority_queue<std::pair<int64_t, CSubNet>, std::vector<std::pair<int64_t, CSubNet>>, std::greater<std::pair<int64_t, CSubNet>>> banExpiry;
     CCriticalSection cs_setBanned;
     bool setBannedIsDirty;
     bool fAddressesInitialized;
@@ -418,8 +508,15 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * Messages of a node are always handled by the same message handler
+     * thread (the node id modulo nMessageHandlerThreads), which keeps them
+     * in order; state shared between nodes is protected by its own locks.
+     */
+    int nMessageHandlerThreads;
+
+    /** flags for waking the message processor threads. */
+    std::vector<bool> vMsgProcWake;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -431,7 +528,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -592,6 +689,9 @@ public:
         vRecv.SetVersion(nVersionIn);
     }
 
+    /** Prepare for receiving a new message, keeping the capacity of the data buffer. */
+    void Reset(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nVersionIn);
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -608,7 +708,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendBufferRef> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -660,6 +760,11 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Socket readiness as last reported by select() or epoll. With epoll
+    // (edge-triggered) it stays set until a recv() or send() shows the socket
+    // buffer has been drained or filled.
+    bool fRecvReady; // only used by the socket handler thread
+    bool fSendReady; // protected by cs_vSend
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -670,6 +775,7 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    CCriticalSection cs_vAddrToSend; // protects vAddrToSend and addrKnown, which other peers' messages add to
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -733,6 +839,7 @@ private:
     const int nMyStartingHeight;
     int nSendVersion;
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+    std::list<CNetMessage> vRecvMsgPool; // Processed messages for reuse, protected by cs_vRecv
 
     mutable CCriticalSection cs_addrName;
     std::string addrName;
@@ -761,6 +868,8 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /** Hand processed messages back, so that their buffers are used for the next ones received. */
+    void RecycleMessages(std::list<CNetMessage>& msgs);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -792,11 +901,13 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
     void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand)
     {
+        LOCK(cs_vAddrToSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
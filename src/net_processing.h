@@ -14,8 +14,6 @@
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
-/** Minimum time between orphan transactions expire time checks in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 /** Headers download timeout expressed in microseconds
@@ -74,8 +72,15 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nMaxBlocksInFlight;
+    int64_t nBlockDeliveryUsec;
 };
 
+/** Number of blocks to have in flight from a peer that takes nDeliveryUsec microseconds per block on average (0 if not known yet). */
+int GetMaxBlocksInFlight(int64_t nDeliveryUsec);
+/** Size of the block download window when a block comes in every nDeliveryUsec microseconds on average (0 if not known yet). */
+int GetBlockDownloadWindow(int64_t nDeliveryUsec);
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -714,6 +714,23 @@ std::string CSubNet::ToString() const
     return network.ToString() + "/" + strNetmask;
 }
 
+int CSubNet::GetPrefixLength() const
+{
+    int n = 0;
+    for (; n < 16 && netmask[n] == 0xff; ++n) {}
+    int bits = n * 8;
+    if (n < 16) {
+        int nMaskBits = NetmaskBits(netmask[n]);
+        if (nMaskBits < 0)
+            return -1;
+        bits += nMaskBits;
+        for (++n; n < 16; ++n)
+            if (netmask[n] != 0x00)
+                return -1;
+    }
+    return bits;
+}
+
 bool CSubNet::IsValid() const
 {
     return valid;
@@ -122,6 +122,10 @@ class CSubNet
         std::string ToString() const;
         bool IsValid() const;
 
+        const CNetAddr& GetNetwork() const { return network; }
+        /** Length of the netmask over all 128 address bits, or -1 if it is not a prefix */
+        int GetPrefixLength() const;
+
         friend bool operator==(const CSubNet& a, const CSubNet& b);
         friend bool operator!=(const CSubNet& a, const CSubNet& b);
         friend bool operator<(const CSubNet& a, const CSubNet& b);
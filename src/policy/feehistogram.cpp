@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <policy/feehistogram.h>
+
+#include <policy/feerate.h>
+
+#include <algorithm>
+#include <assert.h>
+
+constexpr CAmount CFeeRateHistogram::MIN_BUCKET_FEERATE;
+constexpr CAmount CFeeRateHistogram::MAX_BUCKET_FEERATE;
+constexpr double CFeeRateHistogram::FEE_SPACING;
+
+CFeeRateHistogram::CFeeRateHistogram()
+{
+    vBuckets.emplace_back(0);
+    for (double nBoundary = MIN_BUCKET_FEERATE; nBoundary < MAX_BUCKET_FEERATE; nBoundary *= FEE_SPACING) {
+        vBuckets.emplace_back((CAmount)nBoundary);
+    }
+    vBuckets.emplace_back(MAX_BUCKET_FEERATE);
+}
+
+size_t CFeeRateHistogram::BucketIndex(CAmount nFee, uint64_t nSize) const
+{
+    const CAmount nFeeRate = CFeeRate(nFee, nSize).GetFeePerK();
+    auto it = std::upper_bound(vBuckets.begin(), vBuckets.end(), nFeeRate, [](CAmount nFeeRate, const Bucket& bucket) {
+        return nFeeRate < bucket.nMinFeeRate;
+    });
+    return it == vBuckets.begin() ? 0 : it - vBuckets.begin() - 1;
+}
+
+void CFeeRateHistogram::Add(CAmount nFee, uint64_t nSize)
+{
+    Bucket& bucket = vBuckets[BucketIndex(nFee, nSize)];
+    bucket.nCount++;
+    bucket.nSize += nSize;
+    bucket.nFees += nFee;
+}
+
+void CFeeRateHistogram::Remove(CAmount nFee, uint64_t nSize)
+{
+    Bucket& bucket = vBuckets[BucketIndex(nFee, nSize)];
+    assert(bucket.nCount > 0 && bucket.nSize >= nSize);
+    bucket.nCount--;
+    bucket.nSize -= nSize;
+    bucket.nFees -= nFee;
+}
+
+void CFeeRateHistogram::Clear()
+{
+    for (Bucket& bucket : vBuckets) {
+        bucket.nCount = 0;
+        bucket.nSize = 0;
+        bucket.nFees = 0;
+    }
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POLICY_FEEHISTOGRAM_H
+#define BITCOIN_POLICY_FEEHISTOGRAM_H
+
+#include <amount.h>
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Number, virtual size and fees of a set of transactions, bucketed by
+ * feerate. The mempool keeps one up to date as transactions enter and leave
+ * it, which shows how much is waiting at or above a given feerate.
+ *
+ * The first bucket holds everything below MIN_BUCKET_FEERATE, and the
+ * others start at feerates spaced FEE_SPACING apart, the last one holding
+ * everything from MAX_BUCKET_FEERATE up. Adding or removing a transaction
+ * takes time logarithmic in the number of buckets.
+ */
+class CFeeRateHistogram
+{
+public:
+    //! Feerates in satoshis per kB
+    static constexpr CAmount MIN_BUCKET_FEERATE = 1000;
+    static constexpr CAmount MAX_BUCKET_FEERATE = 10000000;
+    static constexpr double FEE_SPACING = 1.1;
+
+    struct Bucket
+    {
+        //! Lowest feerate in the bucket, in satoshis per kB
+        CAmount nMinFeeRate;
+        uint64_t nCount;
+        //! Sum of the virtual sizes
+        uint64_t nSize;
+        CAmount nFees;
+
+        explicit Bucket(CAmount nMinFeeRateIn) : nMinFeeRate(nMinFeeRateIn), nCount(0), nSize(0), nFees(0) {}
+    };
+
+    CFeeRateHistogram();
+
+    void Add(CAmount nFee, uint64_t nSize);
+    void Remove(CAmount nFee, uint64_t nSize);
+    void Clear();
+
+    /** The buckets, from the lowest feerate up. */
+    const std::vector<Bucket>& GetBuckets() const { return vBuckets; }
+
+private:
+    size_t BucketIndex(CAmount nFee, uint64_t nSize) const;
+
+    std::vector<Bucket> vBuckets;
+};
+
+#endif // BITCOIN_POLICY_FEEHISTOGRAM_H
@@ -257,6 +257,9 @@ private:
 
     mutable CCriticalSection cs_feeEstimator;
 
+    /** Stop tracking a transaction, passing back the bucket it was tracked in */
+    bool removeTx(const uint256& hash, bool inBlock, unsigned int* pbucketIndex);
+
     /** Process a transaction confirmed in a block*/
     bool processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry);
 
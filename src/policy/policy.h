@@ -22,6 +22,10 @@ static const unsigned int DEFAULT_BLOCK_MAX_WEIGHT = MAX_BLOCK_WEIGHT - 4000;
 static const unsigned int DEFAULT_BLOCK_MIN_TX_FEE = 1000;
 /** The maximum weight for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_WEIGHT = 400000;
+/** The maximum number of transactions submitted together with sendrawtransactions */
+static const unsigned int MAX_PACKAGE_COUNT = 1000;
+/** The maximum total weight of transactions submitted together with sendrawtransactions */
+static const unsigned int MAX_PACKAGE_WEIGHT = 10 * MAX_STANDARD_TX_WEIGHT;
 /** Maximum number of signature check operations in an IsStandard() P2SH script */
 static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** The maximum number of sigops we're willing to relay/mine in a single tx */
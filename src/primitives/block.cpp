@@ -10,6 +10,8 @@
 #include <utilstrencodings.h>
 #include <crypto/common.h>
 
+#include <cstring>
+
 uint256 CBlockHeader::GetHash() const
 {
     return SerializeHash(*this);
@@ -30,3 +32,116 @@ std::string CBlock::ToString() const
     }
     return s.str();
 }
+
+namespace {
+/** Read-only stream over a serialized block that keeps track of its position. */
+class RawBlockReader
+{
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+
+public:
+    explicit RawBlockReader(const std::vector<unsigned char>& vchIn) : vch(vchIn), nPos(0) {}
+
+    size_t GetPos() const { return nPos; }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > vch.size() - nPos) {
+            throw std::ios_base::failure("RawBlockReader::ignore(): end of data");
+        }
+        nPos += nSize;
+    }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > vch.size() - nPos) {
+            throw std::ios_base::failure("RawBlockReader::read(): end of data");
+        }
+        memcpy(pch, vch.data() + nPos, nSize);
+        nPos += nSize;
+    }
+};
+
+void SkipVector(RawBlockReader& s)
+{
+    s.ignore(ReadCompactSize(s));
+}
+} // namespace
+
+bool StripBlockWitness(const std::vector<unsigned char>& vchBlock, std::vector<unsigned char>& vchStripped)
+{
+    vchStripped.clear();
+    vchStripped.reserve(vchBlock.size());
+
+    // Everything is copied as is, except for the extended format marker and
+    // flags, and the witnesses themselves. This mirrors UnserializeTransaction.
+    RawBlockReader s(vchBlock);
+    size_t nCopied = 0;
+    auto copy = [&]() {
+        vchStripped.insert(vchStripped.end(), vchBlock.begin() + nCopied, vchBlock.begin() + s.GetPos());
+        nCopied = s.GetPos();
+    };
+    try {
+        s.ignore(::GetSerializeSize(CBlockHeader(), SER_NETWORK, PROTOCOL_VERSION));
+        uint64_t nTx = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nTx; i++) {
+            s.ignore(4); // nVersion
+            copy();
+            unsigned char flags = 0;
+            uint64_t nIn = ReadCompactSize(s);
+            if (nIn == 0) {
+                // Extended format: the dummy empty vin is followed by flags
+                flags = ser_readdata8(s);
+                if (flags & ~3) {
+                    return false;
+                }
+                unsigned char flagsStripped = flags & ~1;
+                if (flagsStripped != 0) {
+                    vchStripped.push_back(0);
+                    vchStripped.push_back(flagsStripped);
+                }
+                nCopied = s.GetPos();
+                if (flags != 0) {
+                    nIn = ReadCompactSize(s);
+                }
+            }
+            if (nIn != 0 || flags != 0) {
+                for (uint64_t j = 0; j < nIn; j++) {
+                    s.ignore(36); // prevout
+                    SkipVector(s); // scriptSig
+                    s.ignore(4); // nSequence
+                }
+                uint64_t nOut = ReadCompactSize(s);
+                for (uint64_t j = 0; j < nOut; j++) {
+                    s.ignore(8); // nValue
+                    SkipVector(s); // scriptPubKey
+                }
+            } else {
+                // Empty vin with zero flags: no vout follows, so write out an
+                // empty vin and vout.
+                vchStripped.push_back(0);
+                vchStripped.push_back(0);
+            }
+            copy();
+            if (flags & 1) {
+                for (uint64_t j = 0; j < nIn; j++) {
+                    uint64_t nItems = ReadCompactSize(s);
+                    for (uint64_t k = 0; k < nItems; k++) {
+                        SkipVector(s);
+                    }
+                }
+                nCopied = s.GetPos();
+            }
+            if (flags & 2) {
+                SkipVector(s); // criticalData.bytes
+                s.ignore(32); // criticalData.hashCritical
+            }
+            s.ignore(4); // nLockTime
+        }
+        copy();
+    } catch (const std::ios_base::failure&) {
+        return false;
+    }
+    return s.GetPos() == vchBlock.size();
+}
@@ -119,6 +119,14 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * Transcode a serialized block with witness data into the serialization
+ * without it, as if it had been serialized with
+ * SERIALIZE_TRANSACTION_NO_WITNESS, without deserializing its transactions.
+ * Returns false if vchBlock is not a well-formed block.
+ */
+bool StripBlockWitness(const std::vector<unsigned char>& vchBlock, std::vector<unsigned char>& vchStripped);
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
@@ -12,6 +12,7 @@
 #include <httpserver.h>
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
+#include <scriptindex.h>
 #include <streams.h>
 #include <sync.h>
 #include <txmempool.h>
@@ -209,6 +210,7 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    std::vector<unsigned char> vchBlock;
     CBlockIndex* pblockindex = nullptr;
     {
         LOCK(cs_main);
@@ -219,23 +221,25 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        // The serialized formats are served as stored on disk
+        if (rf == RF_BINARY || rf == RF_HEX) {
+            if (!ReadRawBlockFromDisk(vchBlock, pblockindex, Params().MessageStart(), !(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS)))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        } else if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus())) {
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        }
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        std::string binaryBlock = ssBlock.str();
+        std::string binaryBlock(vchBlock.begin(), vchBlock.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        std::string strHex = HexStr(vchBlock.begin(), vchBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -388,6 +392,64 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     }
 }
 
+static bool rest_scripthash(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() < 2 || path.size() > 5)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/scripthash/<count>/<scripthash>[/<start_height>[/<end_height>[/<cursor>]]].<ext>.");
+
+    int nCount;
+    if (!ParseInt32(path[0], &nCount) || nCount < 1 || nCount > 1000)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Output count out of range: " + path[0]);
+    uint256 hashScript;
+    if (!ParseHashStr(path[1], hashScript))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[1]);
+    int nStartHeight = 0;
+    if (path.size() > 2 && (!ParseInt32(path[2], &nStartHeight) || nStartHeight < 0))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid start height: " + path[2]);
+    int nEndHeight = -1;
+    if (path.size() > 3 && !ParseInt32(path[3], &nEndHeight))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid end height: " + path[3]);
+    if (nEndHeight < 0)
+        nEndHeight = std::numeric_limits<int>::max();
+    CScriptOutputKey cursor;
+    if (path.size() > 4 && (!DecodeScriptIndexCursor(path[4], cursor) || cursor.hashScript != hashScript))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid cursor: " + path[4]);
+
+    std::shared_ptr<CScriptIndex> scriptindex;
+    {
+        LOCK(cs_main);
+        scriptindex = g_scriptindex;
+    }
+    if (!scriptindex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Script index not enabled");
+    scriptindex->BlockUntilSyncedToCurrentChain();
+
+    const CBlockIndex* pindexBest = scriptindex->GetBestBlock();
+    std::vector<std::pair<CScriptOutputKey, CScriptOutputValue>> vOutputs;
+    bool fMore;
+    if (!scriptindex->FindOutputs(hashScript, nStartHeight, nEndHeight, path.size() > 4 ? &cursor : nullptr, nCount, vOutputs, fMore))
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Failed to read the script index");
+
+    switch (rf) {
+    case RF_JSON: {
+        std::string strJSON = scriptOutputsToJSON(vOutputs, fMore, pindexBest).write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+}
+
 static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -582,6 +644,7 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/scripthash/", rest_scripthash},
 };
 
 bool StartREST()
@@ -6,10 +6,12 @@
 #include <rpc/blockchain.h>
 
 #include <amount.h>
+#include <base58.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinstatsindex.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <core_io.h>
@@ -17,12 +19,16 @@
 #include <policy/policy.h>
 #include <primitives/transaction.h>
 #include <rpc/server.h>
+#include <script/standard.h>
+#include <scriptindex.h>
 #include <streams.h>
 #include <sync.h>
 #include <txdb.h>
+#include <txindex.h>
 #include <txmempool.h>
 #include <util.h>
 #include <utilstrencodings.h>
+#include <utxosnapshot.h>
 #include <hash.h>
 #include <validationinterface.h>
 #include <warnings.h>
@@ -785,6 +791,15 @@ UniValue getblock(const JSONRPCRequest& request)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
 
+    if (verbosity <= 0)
+    {
+        // Serve the block as stored on disk
+        std::vector<unsigned char> vchBlock;
+        if (!ReadRawBlockFromDisk(vchBlock, pblockindex, Params().MessageStart(), !(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS)))
+            throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+        return HexStr(vchBlock.begin(), vchBlock.end());
+    }
+
     if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
@@ -793,14 +808,6 @@ UniValue getblock(const JSONRPCRequest& request)
         // block).
         throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
 
-    if (verbosity <= 0)
-    {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
-    }
-
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
@@ -812,6 +819,7 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nBogoSize;
     uint256 hashSerialized;
+    uint256 hashMuHash;
     uint64_t nDiskSize;
     CAmount nTotalAmount;
 
@@ -830,14 +838,13 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
         ss << VARINT(output.second.out.nValue);
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.nBogoSize += GetBogoSize(output.second);
     }
     ss << VARINT(0);
 }
 
 //! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats, bool fMuHash = false)
 {
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
     assert(pcursor);
@@ -851,11 +858,15 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
     ss << stats.hashBlock;
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
+    MuHash3072 muhash;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         COutPoint key;
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (fMuHash) {
+                ApplyCoinHash(muhash, key, coin);
+            }
             if (!outputs.empty() && key.hash != prevkey) {
                 ApplyStats(stats, ss, prevkey, outputs);
                 outputs.clear();
@@ -871,6 +882,9 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         ApplyStats(stats, ss, prevkey, outputs);
     }
     stats.hashSerialized = ss.GetHash();
+    if (fMuHash) {
+        muhash.Finalize(stats.hashMuHash.begin());
+    }
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
@@ -926,38 +940,107 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" hash_or_height )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless the coin stats index is enabled (-coinstatsindex)\n"
+            "and hash_type is not hash_serialized_2.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"      (string, optional, default=hash_serialized_2) Which UTXO set hash should be calculated.\n"
+            "                     Options: 'hash_serialized_2' (the legacy algorithm), 'muhash', 'none'.\n"
+            "2. hash_or_height   (string or numeric, optional) The block hash or height of the target block.\n"
+            "                     Only available with the coin stats index and a hash_type other than hash_serialized_2.\n"
             "\nResult:\n"
             "{\n"
-            "  \"height\":n,     (numeric) The current block height (index)\n"
-            "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"height\":n,     (numeric) The block height (index) of the returned statistics\n"
+            "  \"bestblock\": \"hex\",   (string) The hash of the block at which these statistics are calculated\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (not available when using the coin stats index)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only present if 'hash_serialized_2' hash_type is chosen)\n"
+            "  \"muhash\": \"hash\",      (string) The MuHash of the UTXO set (only present if 'muhash' hash_type is chosen)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (not available when using the coin stats index)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    std::string strHashType = "hash_serialized_2";
+    if (!request.params[0].isNull()) {
+        strHashType = request.params[0].get_str();
+        if (strHashType != "hash_serialized_2" && strHashType != "muhash" && strHashType != "none") {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", strHashType));
+        }
+    }
+
     UniValue ret(UniValue::VOBJ);
 
+    if (strHashType != "hash_serialized_2") {
+        LOCK(cs_main);
+        if (g_coin_stats_index) {
+            const CBlockIndex* pindex = chainActive.Tip();
+            if (!request.params[1].isNull()) {
+                const UniValue& target = request.params[1];
+                if (target.isNum() || (target.isStr() && target.get_str().size() != 64)) {
+                    int nHeight;
+                    if (target.isNum()) {
+                        nHeight = target.get_int();
+                    } else if (!ParseInt32(target.get_str(), &nHeight)) {
+                        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block hash or height");
+                    }
+                    if (nHeight < 0 || nHeight > chainActive.Height()) {
+                        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+                    }
+                    pindex = chainActive[nHeight];
+                } else {
+                    uint256 hash = ParseHashV(target, "hash_or_height");
+                    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+                    if (it == mapBlockIndex.end()) {
+                        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+                    }
+                    pindex = it->second;
+                }
+            }
+
+            CCoinStatsIndexEntry entry;
+            if (!g_coin_stats_index->ReadEntry(pindex->GetBlockHash(), entry)) {
+                throw JSONRPCError(RPC_MISC_ERROR, "Coin stats index has no entry for this block");
+            }
+            ret.push_back(Pair("height", (int64_t)pindex->nHeight));
+            ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+            ret.push_back(Pair("txouts", (int64_t)entry.nTransactionOutputs));
+            ret.push_back(Pair("bogosize", (int64_t)entry.nBogoSize));
+            if (strHashType == "muhash") {
+                uint256 hashMuHash;
+                entry.muhash.Finalize(hashMuHash.begin());
+                ret.push_back(Pair("muhash", hashMuHash.GetHex()));
+            }
+            ret.push_back(Pair("total_amount", ValueFromAmount(entry.nTotalAmount)));
+            return ret;
+        }
+    }
+
+    if (!request.params[1].isNull()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Querying specific block heights requires the coin stats index (-coinstatsindex) and a hash_type other than hash_serialized_2");
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (GetUTXOStats(pcoinsdbview.get(), stats, strHashType == "muhash")) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        if (strHashType == "hash_serialized_2") {
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        } else if (strHashType == "muhash") {
+            ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
+        }
         ret.push_back(Pair("disk_size", stats.nDiskSize));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     } else {
@@ -1368,9 +1451,11 @@ UniValue getchaintips(const JSONRPCRequest& request)
 UniValue mempoolInfoToJSON()
 {
     UniValue ret(UniValue::VOBJ);
+    LOCK(mempool.cs);
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("usagepertx", (int64_t) (mempool.size() ? mempool.DynamicMemoryUsage() / mempool.size() : 0)));
     size_t maxmempool = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(std::max(mempool.GetMinFee(maxmempool), ::minRelayTxFee).GetFeePerK())));
@@ -1390,6 +1475,7 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
             "  \"size\": xxxxx,               (numeric) Current tx count\n"
             "  \"bytes\": xxxxx,              (numeric) Sum of all virtual transaction sizes as defined in BIP 141. Differs from actual serialized size because witness data is discounted\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
+            "  \"usagepertx\": xxxxx,         (numeric) Average memory usage per transaction, including the transaction itself\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
             "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for tx to be accepted. Is the maximum of minrelaytxfee and minimum mempool fee\n"
             "  \"minrelaytxfee\": xxxxx       (numeric) Current minimum relay fee for transactions\n"
@@ -1402,6 +1488,268 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue getmempoolfeehistogram(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getmempoolfeehistogram\n"
+            "\nReturns the transactions in the mempool grouped by feerate, from the highest feerate down.\n"
+            "Each transaction counts at its own feerate, ignoring prioritisation and the feerates of its\n"
+            "ancestors and descendants. Empty groups are left out.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"feerate\": xxxxx,      (numeric) Lowest feerate in the group, in " + CURRENCY_UNIT + "/kB\n"
+            "    \"count\": xxxxx,        (numeric) Number of transactions\n"
+            "    \"bytes\": xxxxx,        (numeric) Sum of their virtual sizes\n"
+            "    \"fees\": xxxxx,         (numeric) Sum of their fees in " + CURRENCY_UNIT + "\n"
+            "    \"bytesabove\": xxxxx    (numeric) Sum of the virtual sizes of the transactions in this group and those above it\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolfeehistogram", "")
+            + HelpExampleRpc("getmempoolfeehistogram", "")
+        );
+
+    const std::vector<CFeeRateHistogram::Bucket> vBuckets = mempool.GetFeeHistogram();
+    UniValue ret(UniValue::VARR);
+    uint64_t nSizeAbove = 0;
+    for (auto it = vBuckets.rbegin(); it != vBuckets.rend(); ++it) {
+        if (it->nCount == 0)
+            continue;
+        nSizeAbove += it->nSize;
+        UniValue bucket(UniValue::VOBJ);
+        bucket.push_back(Pair("feerate", ValueFromAmount(it->nMinFeeRate)));
+        bucket.push_back(Pair("count", it->nCount));
+        bucket.push_back(Pair("bytes", it->nSize));
+        bucket.push_back(Pair("fees", ValueFromAmount(it->nFees)));
+        bucket.push_back(Pair("bytesabove", nSizeAbove));
+        ret.push_back(bucket);
+    }
+    return ret;
+}
+
+UniValue scriptOutputsToJSON(const std::vector<std::pair<CScriptOutputKey, CScriptOutputValue>>& vOutputs, bool fMore, const CBlockIndex* pindexBest)
+{
+    UniValue outputs(UniValue::VARR);
+    for (const auto& output : vOutputs) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("height", output.first.nHeight));
+        entry.push_back(Pair("txid", output.first.outpoint.hash.GetHex()));
+        entry.push_back(Pair("vout", (int)output.first.outpoint.n));
+        entry.push_back(Pair("value", ValueFromAmount(output.second.nValue)));
+        if (output.second.IsSpent()) {
+            UniValue spent(UniValue::VOBJ);
+            spent.push_back(Pair("txid", output.second.spentBy.hash.GetHex()));
+            spent.push_back(Pair("vin", (int)output.second.spentBy.n));
+            spent.push_back(Pair("height", output.second.nSpentHeight));
+            entry.push_back(Pair("spent_by", spent));
+        }
+        outputs.push_back(entry);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("best_block_height", pindexBest ? pindexBest->nHeight : -1));
+    ret.push_back(Pair("outputs", outputs));
+    if (fMore) {
+        ret.push_back(Pair("cursor", EncodeScriptIndexCursor(vOutputs.back().first)));
+    }
+    return ret;
+}
+
+UniValue getscripthashoutputs(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 5)
+        throw std::runtime_error(
+            "getscripthashoutputs \"scripthash\" ( start_height end_height count \"cursor\" )\n"
+            "\nReturns the outputs paying to a script, and the inputs spending them, in order of height.\n"
+            "Requires -scriptindex. Long results are returned in pages: pass the cursor of a page\n"
+            "to get the next one.\n"
+            "\nArguments:\n"
+            "1. \"scripthash\"   (string, required) The SHA256 of the scriptPubKey in reversed hex, as used by\n"
+            "                    Electrum servers, or an address\n"
+            "2. start_height   (numeric, optional, default=0) The lowest height of the outputs\n"
+            "3. end_height     (numeric, optional, default=-1) The highest height of the outputs, -1 for no limit\n"
+            "4. count          (numeric, optional, default=100) The number of outputs per page, at most 1000\n"
+            "5. \"cursor\"       (string, optional) The cursor returned with the previous page\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"best_block_height\": xxxxx,   (numeric) The height the script index is at\n"
+            "  \"outputs\": [\n"
+            "    {\n"
+            "      \"height\": xxxxx,          (numeric) The height of the block the output was created in\n"
+            "      \"txid\": \"hex\",            (string) The transaction id\n"
+            "      \"vout\": n,                (numeric) The output number\n"
+            "      \"value\": x.xxx,           (numeric) The value in " + CURRENCY_UNIT + "\n"
+            "      \"spent_by\": {             (json object) The spending input, if spent\n"
+            "        \"txid\": \"hex\",          (string) The spending transaction id\n"
+            "        \"vin\": n,               (numeric) The input number\n"
+            "        \"height\": xxxxx         (numeric) The height of the block it was spent in\n"
+            "      }\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"cursor\": \"hex\"             (string) The cursor to the next page, if there are more outputs\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getscripthashoutputs", "\"myscripthash\"")
+            + HelpExampleCli("getscripthashoutputs", "\"myaddress\" 1000 2000 50")
+            + HelpExampleRpc("getscripthashoutputs", "\"myscripthash\", 0, -1, 100, \"mycursor\"")
+        );
+
+    const std::string strScript = request.params[0].get_str();
+    uint256 hashScript;
+    if (strScript.size() == 64 && IsHex(strScript)) {
+        hashScript = uint256S(strScript);
+    } else {
+        CTxDestination dest = DecodeDestination(strScript);
+        if (!IsValidDestination(dest))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid script hash or address");
+        hashScript = GetScriptHash(GetScriptForDestination(dest));
+    }
+
+    const int nStartHeight = request.params[1].isNull() ? 0 : request.params[1].get_int();
+    int nEndHeight = request.params[2].isNull() ? -1 : request.params[2].get_int();
+    if (nEndHeight < 0)
+        nEndHeight = std::numeric_limits<int>::max();
+    const int nCount = request.params[3].isNull() ? 100 : request.params[3].get_int();
+    if (nStartHeight < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative start height");
+    if (nCount < 1 || nCount > 1000)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Count out of range");
+    CScriptOutputKey cursor;
+    if (!request.params[4].isNull()) {
+        if (!DecodeScriptIndexCursor(request.params[4].get_str(), cursor) || cursor.hashScript != hashScript)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+
+    std::shared_ptr<CScriptIndex> scriptindex;
+    {
+        LOCK(cs_main);
+        scriptindex = g_scriptindex;
+    }
+    if (!scriptindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "The script index is not enabled. Use -scriptindex to enable it");
+    scriptindex->BlockUntilSyncedToCurrentChain();
+
+    // Read the best block first, so that the outputs are at least up to it
+    const CBlockIndex* pindexBest = scriptindex->GetBestBlock();
+    std::vector<std::pair<CScriptOutputKey, CScriptOutputValue>> vOutputs;
+    bool fMore;
+    if (!scriptindex->FindOutputs(hashScript, nStartHeight, nEndHeight, request.params[4].isNull() ? nullptr : &cursor,
+                                  nCount, vOutputs, fMore)) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the script index");
+    }
+    return scriptOutputsToJSON(vOutputs, fMore, pindexBest);
+}
+
+static UniValue IndexInfoToJSON(const CBaseIndex& index)
+{
+    const CBlockIndex* pindexBest = index.GetBestBlock();
+    UniValue info(UniValue::VOBJ);
+    info.push_back(Pair("synced", index.IsSynced()));
+    info.push_back(Pair("best_block_height", pindexBest ? pindexBest->nHeight : -1));
+    return info;
+}
+
+UniValue getindexinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getindexinfo\n"
+            "\nReturns the status of the enabled indexes that are built in the background.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {                   (json object) The name of the index, eg 'txindex'\n"
+            "    \"synced\": true|false,      (boolean) Whether the index has caught up with the chain\n"
+            "    \"best_block_height\": xxxxx (numeric) The height the index is at, -1 if it has none yet\n"
+            "  }\n"
+            "  ,...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "")
+        );
+
+    LOCK(cs_main);
+
+    UniValue ret(UniValue::VOBJ);
+    if (g_txindex) {
+        ret.push_back(Pair("txindex", IndexInfoToJSON(*g_txindex)));
+    }
+    if (g_scriptindex) {
+        ret.push_back(Pair("scriptindex", IndexInfoToJSON(*g_scriptindex)));
+    }
+    return ret;
+}
+
+/** Enable or disable an index kept in a shared pointer, see setindex. */
+template <typename Index>
+static void SetIndex(std::shared_ptr<Index>& g_index, bool fEnable, int64_t nMaxCache)
+{
+    if (fEnable) {
+        {
+            LOCK(cs_main);
+            if (g_index)
+                return;
+        }
+        const int64_t nCacheSize = std::min(gArgs.GetArg("-dbcache", nDefaultDbCache) / 8, nMaxCache) << 20;
+        std::shared_ptr<Index> index = std::make_shared<Index>(nCacheSize);
+        index->Start();
+        LOCK(cs_main);
+        g_index = index;
+    } else {
+        std::shared_ptr<Index> index;
+        {
+            LOCK(cs_main);
+            index.swap(g_index);
+        }
+        // Not holding cs_main, which the sync thread may be waiting for
+        if (index) {
+            index->Stop();
+            // Let the notifications already queued for it run before it goes away
+            SyncWithValidationInterfaceQueue();
+        }
+    }
+}
+
+UniValue setindex(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2)
+        throw std::runtime_error(
+            "setindex \"index\" enable\n"
+            "\nEnables or disables an index until the node is restarted, without a reindex.\n"
+            "An enabled index catches up with the chain in the background, see getindexinfo.\n"
+            "A disabled index keeps its data, so enabling it again only catches up with the blocks\n"
+            "connected in the meantime. To keep the setting, also set it in the configuration file.\n"
+            "\nArguments:\n"
+            "1. \"index\"     (string, required) The index: \"txindex\" or \"scriptindex\"\n"
+            "2. enable      (boolean, required) Whether to enable or disable it\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setindex", "\"txindex\" true")
+            + HelpExampleRpc("setindex", "\"scriptindex\", true")
+        );
+
+    const std::string strIndex = request.params[0].get_str();
+    const bool fEnable = request.params[1].get_bool();
+    if (strIndex != "txindex" && strIndex != "scriptindex")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown index: " + strIndex);
+    if (fEnable && fPruneMode)
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot enable indexes in prune mode");
+
+    // Serializes opening and closing the index databases
+    static CCriticalSection cs_setindex;
+    LOCK(cs_setindex);
+
+    if (strIndex == "txindex") {
+        SetIndex(g_txindex, fEnable, nMaxTxIndexCache);
+    } else {
+        SetIndex(g_scriptindex, fEnable, nMaxScriptIndexCache);
+    }
+    return NullUniValue;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1615,9 +1963,87 @@ UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the current tip to a snapshot file.\n"
+            "The snapshot can be loaded with -loadutxosnapshot to rebuild the chainstate of a node.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) path to the output file. If relative, will be prefixed by datadir.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,     (numeric) the number of coins written to the snapshot\n"
+            "  \"base_hash\": \"hex\",    (string) the hash of the block at which the snapshot was taken\n"
+            "  \"base_height\": n,       (numeric) the height of the block at which the snapshot was taken\n"
+            "  \"path\": \"path\",        (string) the absolute path that the snapshot was written to\n"
+            "  \"content_hash\": \"hex\", (string) the hash of the snapshot contents\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+    }
+
+    fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    // Write to a temporary path and then move into place, so that a partial
+    // snapshot is never mistaken for a complete one.
+    fs::path temppath = fs::absolute(request.params[0].get_str() + ".incomplete", GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists. If you are sure this is what you want, move it out of the way first");
+    }
+
+    FILE* filestr = fsbridge::fopen(temppath, "wb");
+    if (!filestr) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + temppath.string() + " for writing");
+    }
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+    // Make the chainstate database current, then take a cursor on it. The
+    // cursor iterates over a consistent database snapshot, so block
+    // validation can continue while the file is written.
+    SnapshotMetadata metadata;
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        metadata.nBaseHeight = mapBlockIndex.at(pcursor->GetBestBlock())->nHeight;
+    }
+
+    uint256 hashContents;
+    bool fWritten;
+    try {
+        fWritten = WriteUTXOSnapshot(*pcursor, file, metadata, hashContents);
+    } catch (...) {
+        // Write errors and interruption; do not leave the partial file behind
+        file.fclose();
+        fs::remove(temppath);
+        throw;
+    }
+    if (!fWritten) {
+        file.fclose();
+        fs::remove(temppath);
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+    }
+    FileCommit(file.Get());
+    file.fclose();
+    RenameOver(temppath, path);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)metadata.nCoinsCount));
+    ret.push_back(Pair("base_hash", metadata.hashBaseBlock.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nBaseHeight));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("content_hash", hashContents.GetHex()));
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      {} },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        {"nblocks", "blockhash"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       {} },
@@ -1631,11 +2057,15 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
+    { "blockchain",         "getmempoolfeehistogram", &getmempoolfeehistogram, {} },
+    { "blockchain",         "getscripthashoutputs",   &getscripthashoutputs,   {"scripthash","start_height","end_height","count","cursor"} },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type","hash_or_height"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
+    { "blockchain",         "setindex",               &setindex,               {"index","enable"} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
@@ -5,9 +5,14 @@
 #ifndef BITCOIN_RPC_BLOCKCHAIN_H
 #define BITCOIN_RPC_BLOCKCHAIN_H
 
+#include <utility>
+#include <vector>
+
 class CBlock;
 class CBlockIndex;
 class UniValue;
+struct CScriptOutputKey;
+struct CScriptOutputValue;
 
 /**
  * Get the difficulty of the net wrt to the given block index, or the chain tip if
@@ -33,5 +38,8 @@ UniValue mempoolToJSON(bool fVerbose = false);
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
+/** Outputs found in the script index to JSON, with a cursor to the next ones if fMore */
+UniValue scriptOutputsToJSON(const std::vector<std::pair<CScriptOutputKey, CScriptOutputValue>>& vOutputs, bool fMore, const CBlockIndex* pindexBest);
+
 #endif
 
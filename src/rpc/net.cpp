@@ -101,6 +101,8 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflightlimit\": n,        (numeric) The number of blocks we ask from this peer at most, which grows as it delivers them faster\n"
+            "    \"blockdeliverytime\": n,    (numeric) The average time in seconds this peer took to deliver each requested block (if any)\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -167,6 +169,9 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflightlimit", statestats.nMaxBlocksInFlight));
+            if (statestats.nBlockDeliveryUsec > 0)
+                obj.push_back(Pair("blockdeliverytime", statestats.nBlockDeliveryUsec / 1e6));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
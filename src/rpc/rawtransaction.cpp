@@ -23,6 +23,7 @@
 #include <script/script_error.h>
 #include <script/sign.h>
 #include <script/standard.h>
+#include <txindex.h>
 #include <txmempool.h>
 #include <uint256.h>
 #include <utilstrencodings.h>
@@ -141,6 +142,16 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
             + HelpExampleCli("getrawtransaction", "\"mytxid\" true \"myblockhash\"")
         );
 
+    // Let the transaction index catch up with the tip first, without cs_main
+    std::shared_ptr<CTxIndex> txindex;
+    {
+        LOCK(cs_main);
+        txindex = g_txindex;
+    }
+    if (txindex) {
+        txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     LOCK(cs_main);
 
     bool in_active_chain = true;
@@ -178,9 +189,13 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
             }
             errmsg = "No such transaction found in the provided block";
         } else {
-            errmsg = fTxIndex
-              ? "No such mempool or blockchain transaction"
-              : "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+            if (!txindex) {
+                errmsg = "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+            } else if (!txindex->IsSynced()) {
+                errmsg = "No such mempool or blockchain transaction. The transaction index is still being built";
+            } else {
+                errmsg = "No such mempool or blockchain transaction";
+            }
         }
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
     }
@@ -965,20 +980,23 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     if (!request.params[1].isNull() && request.params[1].get_bool())
         nMaxRawTxFee = 0;
 
+    bool fHaveChain = false;
+    bool fHaveMempool;
     { // cs_main scope
     LOCK(cs_main);
     CCoinsViewCache &view = *pcoinsTip;
-    bool fHaveChain = false;
     for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
         const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
         fHaveChain = !existingCoin.IsSpent();
     }
-    bool fHaveMempool = mempool.exists(hashTx);
+    fHaveMempool = mempool.exists(hashTx);
+    } // cs_main
+
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
         bool fMissingInputs;
-        if (!AcceptToMemoryPool(mempool, state, std::move(tx), &fMissingInputs,
+        if (!AcceptToMemoryPoolConcurrent(mempool, state, std::move(tx), &fMissingInputs,
                                 nullptr /* plTxnReplaced */, false /* bypass_limits */, nMaxRawTxFee)) {
             if (state.IsInvalid()) {
                 throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
@@ -1006,8 +1024,6 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
         promise.set_value();
     }
 
-    } // cs_main
-
     promise.get_future().wait();
 
     if(!g_connman)
@@ -1022,6 +1038,92 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     return hashTx.GetHex();
 }
 
+UniValue sendrawtransactions(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "sendrawtransactions [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits raw transactions (serialized, hex-encoded) to local node and network, all at once.\n"
+            "Transactions spending outputs of others in the list are accepted after those, whatever\n"
+            "the order they are given in.\n"
+            "At most " + strprintf("%d", MAX_PACKAGE_COUNT) + " transactions, with a total weight of at most " + strprintf("%d", MAX_PACKAGE_WEIGHT) + ",\n"
+            "are submitted at once.\n"
+            "\nArguments:\n"
+            "1. [\"hexstring\",...]  (array, required) The hex strings of the raw transactions\n"
+            "2. allowhighfees      (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                        (array) One object per transaction, in the order given\n"
+            "  {\n"
+            "    \"txid\": \"hex\",         (string) The transaction hash in hex\n"
+            "    \"accepted\": true|false,  (boolean) Whether it was accepted to the mempool\n"
+            "    \"reject-reason\": \"str\"   (string) Why it was not, if it was not\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex\\\",\\\"signedhex\\\"]\"")
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex\",\"signedhex\"]")
+        );
+
+    ObserveSafeMode();
+
+    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::VBOOL});
+
+    const UniValue& txs = request.params[0].get_array();
+    if (txs.size() > MAX_PACKAGE_COUNT)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Too many transactions, %u > %u", txs.size(), MAX_PACKAGE_COUNT));
+    std::vector<CTransactionRef> vtx;
+    int64_t nWeight = 0;
+    for (size_t i = 0; i < txs.size(); i++) {
+        CMutableTransaction mtx;
+        if (!txs[i].isStr() || !DecodeHexTx(mtx, txs[i].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", i));
+        vtx.push_back(MakeTransactionRef(std::move(mtx)));
+        nWeight += GetTransactionWeight(*vtx.back());
+        if (nWeight > MAX_PACKAGE_WEIGHT)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Transactions too heavy, total weight above %u", MAX_PACKAGE_WEIGHT));
+    }
+
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (!request.params[1].isNull() && request.params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    std::vector<PackageTxResult> vResults = AcceptPackageToMemoryPool(mempool, vtx, false /* bypass_limits */, nMaxRawTxFee);
+
+    // As sendrawtransaction does, let wallets see the new transactions first.
+    std::promise<void> promise;
+    CallFunctionInValidationInterfaceQueue([&promise] {
+        promise.set_value();
+    });
+    promise.get_future().wait();
+
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        const PackageTxResult& txresult = vResults[i];
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("txid", vtx[i]->GetHash().GetHex()));
+        entry.push_back(Pair("accepted", txresult.fAccepted));
+        if (txresult.fAccepted) {
+            CInv inv(MSG_TX, vtx[i]->GetHash());
+            g_connman->ForEachNode([&inv](CNode* pnode)
+            {
+                pnode->PushInventory(inv);
+            });
+        } else if (txresult.state.IsInvalid()) {
+            entry.push_back(Pair("reject-reason", strprintf("%i: %s", txresult.state.GetRejectCode(), txresult.state.GetRejectReason())));
+        } else if (txresult.fMissingInputs) {
+            entry.push_back(Pair("reject-reason", "Missing inputs"));
+        } else {
+            entry.push_back(Pair("reject-reason", txresult.state.GetRejectReason()));
+        }
+        result.push_back(entry);
+    }
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1030,6 +1132,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   {"hexstring","iswitness"} },
     { "rawtransactions",    "decodescript",           &decodescript,           {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "sendrawtransactions",    &sendrawtransactions,    {"hexstrings","allowhighfees"} },
     { "rawtransactions",    "combinerawtransaction",  &combinerawtransaction,  {"txs"} },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     {"hexstring","prevtxs","privkeys","sighashtype"} }, /* uses wallet if enabled */
 
@@ -5,20 +5,30 @@
 
 #include <script/sigcache.h>
 
+#include <clientversion.h>
 #include <memusage.h>
 #include <pubkey.h>
 #include <random.h>
+#include <streams.h>
 #include <uint256.h>
 #include <util.h>
+#include <utiltime.h>
 
 #include <cuckoocache.h>
 #include <boost/thread.hpp>
 
+#include <array>
+#include <deque>
+
 namespace {
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * The cache is split into SIGCACHE_SHARDS independently locked shards, so
+ * that script check threads looking up and inserting different entries
+ * rarely contend on the same lock.
  */
 class CSignatureCache
 {
@@ -26,8 +36,27 @@ private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+    struct Shard {
+        map_type setValid;
+        boost::shared_mutex cs_sigcache;
+    };
+    std::array<Shard, SIGCACHE_SHARDS> shards;
+    uint32_t nMaxEntries = 0;
+
+    Shard& GetShard(const uint256& entry)
+    {
+        return shards[GetSignatureCacheShard(entry, SIGCACHE_SHARDS)];
+    }
+
+    //! Lock all shards exclusively, for operations on the cache as a whole
+    std::vector<boost::unique_lock<boost::shared_mutex>> LockAll()
+    {
+        std::vector<boost::unique_lock<boost::shared_mutex>> locks;
+        for (Shard& shard : shards) {
+            locks.emplace_back(shard.cs_sigcache);
+        }
+        return locks;
+    }
 
 public:
     CSignatureCache()
@@ -44,18 +73,45 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        Shard& shard = GetShard(entry);
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+        return shard.setValid.contains(entry, erase);
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+        shard.setValid.insert(entry);
     }
     uint32_t setup_bytes(size_t n)
     {
-        return setValid.setup_bytes(n);
+        auto locks = LockAll();
+        nMaxEntries = 0;
+        for (Shard& shard : shards) {
+            nMaxEntries += shard.setValid.setup_bytes(n / SIGCACHE_SHARDS);
+        }
+        return nMaxEntries;
+    }
+
+    bool Dump(const fs::path& path)
+    {
+        auto locks = LockAll();
+        std::vector<const map_type*> caches;
+        for (const Shard& shard : shards) {
+            caches.push_back(&shard.setValid);
+        }
+        return DumpNoncedCache(path, nonce, caches);
+    }
+
+    bool Load(const fs::path& path)
+    {
+        auto locks = LockAll();
+        std::vector<map_type*> caches;
+        for (Shard& shard : shards) {
+            caches.push_back(&shard.setValid);
+        }
+        return LoadNoncedCache(path, nonce, caches, nMaxEntries);
     }
 };
 
@@ -80,6 +136,105 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+bool DumpSignatureCache()
+{
+    return signatureCache.Dump(GetDataDir() / "sigcache.dat");
+}
+
+bool LoadSignatureCache()
+{
+    return signatureCache.Load(GetDataDir() / "sigcache.dat");
+}
+
+static const uint64_t NONCED_CACHE_DUMP_VERSION = 1;
+
+bool DumpNoncedCache(const fs::path& path, const uint256& nonce, const std::vector<const CuckooCache::cache<uint256, SignatureCacheHasher>*>& caches)
+{
+    int64_t start = GetTimeMicros();
+
+    uint64_t nEntries = 0;
+    for (const auto* cache : caches) {
+        cache->for_each([&nEntries](const uint256&) { ++nEntries; });
+    }
+
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    try {
+        CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            return false;
+        }
+        file << NONCED_CACHE_DUMP_VERSION;
+        file << (int32_t)CLIENT_VERSION;
+        file << nonce;
+        file << nEntries;
+        for (const auto* cache : caches) {
+            cache->for_each([&file](const uint256& entry) { file << entry; });
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, path)) {
+            return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump %s: %s. Continuing anyway.\n", path.filename().string(), e.what());
+        return false;
+    }
+    LogPrintf("Dumped %u entries to %s in %dms\n", nEntries, path.filename().string(), (GetTimeMicros() - start) / 1000);
+    return true;
+}
+
+bool LoadNoncedCache(const fs::path& path, uint256& nonce, const std::vector<CuckooCache::cache<uint256, SignatureCacheHasher>*>& caches, size_t nMaxEntries)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        return false;
+    }
+
+    uint256 nonceFile;
+    // The most recent entries of each shard, each shard being given an equal
+    // part of nMaxEntries.
+    std::vector<std::deque<uint256>> entries(caches.size());
+    const size_t nMaxShardEntries = caches.empty() ? 0 : nMaxEntries / caches.size();
+    size_t nLoaded = 0;
+    try {
+        uint64_t version;
+        int32_t nClientVersion;
+        file >> version >> nClientVersion;
+        if (version != NONCED_CACHE_DUMP_VERSION || nClientVersion != CLIENT_VERSION) {
+            LogPrintf("Ignoring %s written by a different version\n", path.filename().string());
+            return false;
+        }
+        file >> nonceFile;
+        uint64_t nEntries;
+        file >> nEntries;
+        // Entries are stored shard by shard, oldest first within each. Drop
+        // the oldest of a shard when it would not fit.
+        for (uint64_t i = 0; i < nEntries && nMaxShardEntries > 0; ++i) {
+            uint256 entry;
+            file >> entry;
+            std::deque<uint256>& shard = entries[GetSignatureCacheShard(entry, caches.size())];
+            shard.push_back(entry);
+            if (shard.size() > nMaxShardEntries) {
+                shard.pop_front();
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize %s: %s. Continuing anyway.\n", path.filename().string(), e.what());
+        return false;
+    }
+
+    nonce = nonceFile;
+    for (size_t i = 0; i < caches.size(); ++i) {
+        for (const uint256& entry : entries[i]) {
+            caches[i]->insert(entry);
+        }
+        nLoaded += entries[i].size();
+    }
+    LogPrintf("Loaded %u entries from %s\n", nLoaded, path.filename().string());
+    return true;
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
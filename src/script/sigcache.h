@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "fs.h"
 #include "script/interpreter.h"
 #include "sidechaindb.h"
 
@@ -17,9 +18,18 @@
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 // Maximum sig cache size allowed
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+/** Default for -persistsigcache */
+static const bool DEFAULT_PERSIST_SIGCACHE = true;
+/** Number of independently locked shards of the signature cache (a power of two) */
+static const size_t SIGCACHE_SHARDS = 16;
 
 class CPubKey;
 
+namespace CuckooCache {
+template <typename Element, typename Hash>
+class cache;
+}
+
 /**
  * We're hashing a nonce into the entries themselves, so we don't need extra
  * blinding in the set hash computation.
@@ -41,6 +51,16 @@ public:
     }
 };
 
+/**
+ * Shard (out of nShards) that a cache entry belongs to. The low bits of the
+ * first byte are used: they hardly affect the bucket chosen by
+ * SignatureCacheHasher within the shard.
+ */
+inline size_t GetSignatureCacheShard(const uint256& entry, size_t nShards)
+{
+    return *entry.begin() % nShards;
+}
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -54,4 +74,26 @@ public:
 
 void InitSignatureCache();
 
+/** Save the signature cache to sigcache.dat in the data directory. */
+bool DumpSignatureCache();
+/** Load the signature cache saved by DumpSignatureCache. Must be called
+ * right after InitSignatureCache, before the cache is used. */
+bool LoadSignatureCache();
+
+/**
+ * Write the live entries of a nonced cache (made of one or more shards), and
+ * the nonce they were computed with, to path. Entries are only meaningful with
+ * their nonce, and only to the client version that created them, as the rules
+ * they were checked against may change between versions.
+ */
+bool DumpNoncedCache(const fs::path& path, const uint256& nonce, const std::vector<const CuckooCache::cache<uint256, SignatureCacheHasher>*>& caches);
+/**
+ * Read a cache written by DumpNoncedCache into freshly set up shards, chosen
+ * with GetSignatureCacheShard, and replace nonce with the one its entries were
+ * computed with. Each shard gets an equal part of nMaxEntries, filled with
+ * the most recent of its entries.
+ * On failure, neither nonce nor caches are modified.
+ */
+bool LoadNoncedCache(const fs::path& path, uint256& nonce, const std::vector<CuckooCache::cache<uint256, SignatureCacheHasher>*>& caches, size_t nMaxEntries);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,169 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <scriptindex.h>
+
+#include <chain.h>
+#include <coins.h>
+#include <crypto/sha256.h>
+#include <script/script.h>
+#include <streams.h>
+#include <undo.h>
+#include <util.h>
+#include <utilstrencodings.h>
+#include <validation.h>
+
+static const char DB_SCRIPT_OUTPUT = 'o';
+
+std::shared_ptr<CScriptIndex> g_scriptindex;
+
+uint256 GetScriptHash(const CScript& scriptPubKey)
+{
+    uint256 hash;
+    CSHA256().Write(scriptPubKey.data(), scriptPubKey.size()).Finalize(hash.begin());
+    return hash;
+}
+
+class CScriptIndex::DB : public CBaseIndex::DB
+{
+public:
+    DB(size_t nCacheSize, bool fMemory, bool fWipe)
+        : CBaseIndex::DB(GetDataDir() / "indexes" / "scriptindex", nCacheSize, fMemory, fWipe)
+    {
+    }
+};
+
+CScriptIndex::CScriptIndex(size_t nCacheSize, bool fMemory, bool fWipe) : db(new CScriptIndex::DB(nCacheSize, fMemory, fWipe))
+{
+}
+
+CScriptIndex::~CScriptIndex()
+{
+    // Stop the sync thread while the database is still there.
+    Stop();
+}
+
+CBaseIndex::DB& CScriptIndex::GetDB() const
+{
+    return *db;
+}
+
+static bool ReadBlockUndo(CBlockUndo& blockundo, const CBlock& block, const CBlockIndex* pindex)
+{
+    // The genesis block has no undo data, and spends nothing
+    if (!pindex->pprev)
+        return true;
+    if (!UndoReadFromDisk(blockundo, pindex))
+        return false;
+    return blockundo.vtxundo.size() + 1 == block.vtx.size();
+}
+
+bool CScriptIndex::WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo blockundo;
+    if (!ReadBlockUndo(blockundo, block, pindex))
+        return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        // Mark the outputs spent, from the coins the undo data restores
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin& coin = txundo.vprevout[j];
+                CScriptOutputValue value(coin.out.nValue);
+                value.spentBy = COutPoint(tx.GetHash(), j);
+                value.nSpentHeight = pindex->nHeight;
+                batch.Write(std::make_pair(DB_SCRIPT_OUTPUT, CScriptOutputKey(GetScriptHash(coin.out.scriptPubKey), coin.nHeight, tx.vin[j].prevout)), value);
+            }
+        }
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& out = tx.vout[j];
+            if (out.scriptPubKey.IsUnspendable())
+                continue;
+            batch.Write(std::make_pair(DB_SCRIPT_OUTPUT, CScriptOutputKey(GetScriptHash(out.scriptPubKey), pindex->nHeight, COutPoint(tx.GetHash(), j))), CScriptOutputValue(out.nValue));
+        }
+    }
+    return true;
+}
+
+bool CScriptIndex::RewindBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo blockundo;
+    if (!ReadBlockUndo(blockundo, block, pindex))
+        return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+
+    // In reverse, so that outputs both created and spent in the block end
+    // up erased
+    for (size_t i = block.vtx.size(); i-- > 0;) {
+        const CTransaction& tx = *block.vtx[i];
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& out = tx.vout[j];
+            if (out.scriptPubKey.IsUnspendable())
+                continue;
+            batch.Erase(std::make_pair(DB_SCRIPT_OUTPUT, CScriptOutputKey(GetScriptHash(out.scriptPubKey), pindex->nHeight, COutPoint(tx.GetHash(), j))));
+        }
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin& coin = txundo.vprevout[j];
+                batch.Write(std::make_pair(DB_SCRIPT_OUTPUT, CScriptOutputKey(GetScriptHash(coin.out.scriptPubKey), coin.nHeight, tx.vin[j].prevout)), CScriptOutputValue(coin.out.nValue));
+            }
+        }
+    }
+    return true;
+}
+
+bool CScriptIndex::FindOutputs(const uint256& hashScript, int nStartHeight, int nEndHeight, const CScriptOutputKey* pCursor,
+                               size_t nMaxCount, std::vector<std::pair<CScriptOutputKey, CScriptOutputValue>>& vOutputs,
+                               bool& fMore) const
+{
+    vOutputs.clear();
+    fMore = false;
+
+    std::unique_ptr<CDBIterator> pcursor(db->NewIterator());
+    const bool fAfterCursor = pCursor && pCursor->hashScript == hashScript && pCursor->nHeight >= nStartHeight;
+    const CScriptOutputKey start = fAfterCursor ? *pCursor : CScriptOutputKey(hashScript, nStartHeight, COutPoint(uint256(), 0));
+    pcursor->Seek(std::make_pair(DB_SCRIPT_OUTPUT, start));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, CScriptOutputKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_SCRIPT_OUTPUT || key.second.hashScript != hashScript ||
+            key.second.nHeight > nEndHeight) {
+            break;
+        }
+        if (fAfterCursor && key.second.nHeight == start.nHeight && key.second.outpoint == start.outpoint) {
+            continue;
+        }
+        if (vOutputs.size() == nMaxCount) {
+            fMore = true;
+            break;
+        }
+        CScriptOutputValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: Failed to read the output %s of script %s", __func__, key.second.outpoint.ToString(), hashScript.GetHex());
+        vOutputs.emplace_back(key.second, value);
+    }
+    return true;
+}
+
+std::string EncodeScriptIndexCursor(const CScriptOutputKey& key)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+bool DecodeScriptIndexCursor(const std::string& strCursor, CScriptOutputKey& key)
+{
+    if (!IsHex(strCursor))
+        return false;
+    const std::vector<unsigned char> vchCursor = ParseHex(strCursor);
+    CDataStream ss(vchCursor, SER_NETWORK, PROTOCOL_VERSION);
+    try {
+        ss >> key;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return ss.empty();
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SCRIPTINDEX_H
+#define BITCOIN_SCRIPTINDEX_H
+
+#include <amount.h>
+#include <baseindex.h>
+#include <compat/endian.h>
+#include <primitives/transaction.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CScript;
+
+//! -scriptindex default
+static const bool DEFAULT_SCRIPTINDEX = false;
+//! Max memory allocated to the script index database cache (MiB)
+static const int64_t nMaxScriptIndexCache = 256;
+
+/** The SHA256 of a scriptPubKey, shown reversed like Electrum servers do. */
+uint256 GetScriptHash(const CScript& scriptPubKey);
+
+/**
+ * Key of an output in the script index. Outputs sort by script hash, then
+ * height, so that the outputs of a script are a range of the database and
+ * a height range is a range of that.
+ */
+struct CScriptOutputKey
+{
+    uint256 hashScript;
+    int nHeight;
+    COutPoint outpoint;
+
+    CScriptOutputKey() : nHeight(0) {}
+    CScriptOutputKey(const uint256& hashScriptIn, int nHeightIn, const COutPoint& outpointIn)
+        : hashScript(hashScriptIn), nHeight(nHeightIn), outpoint(outpointIn) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        // Big endian, for the database to sort by them
+        const uint32_t nHeightBE = htobe32((uint32_t)nHeight);
+        const uint32_t nBE = htobe32(outpoint.n);
+        s << hashScript;
+        s.write((const char*)&nHeightBE, sizeof(nHeightBE));
+        s << outpoint.hash;
+        s.write((const char*)&nBE, sizeof(nBE));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        uint32_t nHeightBE, nBE;
+        s >> hashScript;
+        s.read((char*)&nHeightBE, sizeof(nHeightBE));
+        s >> outpoint.hash;
+        s.read((char*)&nBE, sizeof(nBE));
+        nHeight = (int)be32toh(nHeightBE);
+        outpoint.n = be32toh(nBE);
+    }
+};
+
+/** An output in the script index, and the input spending it, if any. */
+struct CScriptOutputValue
+{
+    CAmount nValue;
+    //! The spending input, null if unspent
+    COutPoint spentBy;
+    int nSpentHeight;
+
+    CScriptOutputValue() : nValue(0), nSpentHeight(0) {}
+    explicit CScriptOutputValue(CAmount nValueIn) : nValue(nValueIn), nSpentHeight(0) {}
+
+    bool IsSpent() const { return !spentBy.IsNull(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(spentBy);
+        READWRITE(VARINT(nSpentHeight));
+    }
+};
+
+/**
+ * Index of the outputs of the active chain by the hash of their scriptPubKey,
+ * with the input spending each of them (indexes/scriptindex/), which tells
+ * which transactions touch a script. Spends are looked up in the undo data of
+ * the block. It is built in the background, see CBaseIndex.
+ */
+class CScriptIndex final : public CBaseIndex
+{
+private:
+    class DB;
+    const std::unique_ptr<DB> db;
+
+protected:
+    bool WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex) override;
+    bool RewindBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex) override;
+    CBaseIndex::DB& GetDB() const override;
+    const char* GetName() const override { return "scriptindex"; }
+
+public:
+    explicit CScriptIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CScriptIndex() override;
+
+    /**
+     * Find up to nMaxCount outputs of a script between two heights
+     * (inclusive), in order of height. With pCursor, only those after it are
+     * returned, to continue from the last output of a previous call. fMore
+     * tells whether there are more outputs in the range.
+     */
+    bool FindOutputs(const uint256& hashScript, int nStartHeight, int nEndHeight, const CScriptOutputKey* pCursor,
+                     size_t nMaxCount, std::vector<std::pair<CScriptOutputKey, CScriptOutputValue>>& vOutputs,
+                     bool& fMore) const;
+};
+
+/** Encode the key of an output as an opaque cursor for FindOutputs. */
+std::string EncodeScriptIndexCursor(const CScriptOutputKey& key);
+bool DecodeScriptIndexCursor(const std::string& strCursor, CScriptOutputKey& key);
+
+/** The script index, if enabled (protected by cs_main, see g_txindex). */
+extern std::shared_ptr<CScriptIndex> g_scriptindex;
+
+#endif // BITCOIN_SCRIPTINDEX_H
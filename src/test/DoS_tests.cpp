@@ -11,6 +11,7 @@
 #include <pow.h>
 #include <script/sign.h>
 #include <serialize.h>
+#include <txorphanpool.h>
 #include <util.h>
 #include <validation.h>
 
@@ -24,12 +25,7 @@
 extern bool AddOrphanTx(const CTransactionRef& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
 extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-struct COrphanTx {
-    CTransactionRef tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern CTxOrphanPool orphanpool;
 
 CService ip(uint32_t i)
 {
@@ -41,6 +37,8 @@ CService ip(uint32_t i)
 static NodeId id = 0;
 
 void UpdateLastBlockAnnounceTime(NodeId node, int64_t time_in_seconds);
+void MarkBlockAsRequested(NodeId node, const uint256& hash);
+bool MarkBlockAsDelivered(NodeId node, const uint256& hash);
 
 BOOST_FIXTURE_TEST_SUITE(DoS_tests, TestingSetup)
 
@@ -175,6 +173,62 @@ BOOST_AUTO_TEST_CASE(stale_tip_peer_management)
     CConnmanTest::ClearNodes();
 }
 
+BOOST_AUTO_TEST_CASE(block_download_limits)
+{
+    // Nothing known about the peer: the defaults apply.
+    BOOST_CHECK_EQUAL(GetMaxBlocksInFlight(0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(0), (int)BLOCK_DOWNLOAD_WINDOW);
+
+    // Slow deliveries never shrink below the defaults.
+    BOOST_CHECK_EQUAL(GetMaxBlocksInFlight(10 * 1000000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(10 * 1000000), (int)BLOCK_DOWNLOAD_WINDOW);
+
+    // In between, the limits cover a fixed amount of download time.
+    BOOST_CHECK_EQUAL(GetMaxBlocksInFlight(BLOCK_DOWNLOAD_QUEUE_TIME / 50), 50);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(BLOCK_DOWNLOAD_WINDOW_TIME / 2000), 2000);
+
+    // Fast deliveries are capped.
+    BOOST_CHECK_EQUAL(GetMaxBlocksInFlight(1), MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(1), (int)MAX_BLOCK_DOWNLOAD_WINDOW);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_limits_per_peer)
+{
+    CAddress addr1(ip(0xa0b0c001), NODE_NONE);
+    CNode dummyNode1(id++, NODE_NETWORK, 0, INVALID_SOCKET, addr1, 0, 0, CAddress(), "", true);
+    peerLogic->InitializeNode(&dummyNode1);
+    CAddress addr2(ip(0xa0b0c002), NODE_NONE);
+    CNode dummyNode2(id++, NODE_NETWORK, 0, INVALID_SOCKET, addr2, 1, 1, CAddress(), "", true);
+    peerLogic->InitializeNode(&dummyNode2);
+
+    // A peer that delivers what it is asked for gets more blocks in flight.
+    for (int i = 0; i < MAX_BLOCKS_IN_TRANSIT_PER_PEER; i++) {
+        const uint256 hash = InsecureRand256();
+        MarkBlockAsRequested(dummyNode1.GetId(), hash);
+        BOOST_CHECK(MarkBlockAsDelivered(dummyNode1.GetId(), hash));
+    }
+    CNodeStateStats stats;
+    BOOST_REQUIRE(GetNodeStateStats(dummyNode1.GetId(), stats));
+    BOOST_CHECK(stats.nBlockDeliveryUsec > 0);
+    BOOST_CHECK(stats.nMaxBlocksInFlight > MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // A stalled peer stays at the floor, even when the blocks requested from
+    // it arrive from another peer instead.
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < MAX_BLOCKS_IN_TRANSIT_PER_PEER; i++) {
+        vHashes.push_back(InsecureRand256());
+        MarkBlockAsRequested(dummyNode2.GetId(), vHashes.back());
+    }
+    BOOST_CHECK(MarkBlockAsDelivered(dummyNode1.GetId(), vHashes[0]));
+    BOOST_REQUIRE(GetNodeStateStats(dummyNode2.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nBlockDeliveryUsec, 0);
+    BOOST_CHECK_EQUAL(stats.nMaxBlocksInFlight, MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    bool dummy;
+    peerLogic->FinalizeNode(dummyNode1.GetId(), dummy);
+    peerLogic->FinalizeNode(dummyNode2.GetId(), dummy);
+}
+
 BOOST_AUTO_TEST_CASE(DoS_banning)
 {
     std::atomic<bool> interruptDummy(false);
@@ -291,14 +345,18 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     peerLogic->FinalizeNode(dummyNode.GetId(), dummy);
 }
 
+static std::vector<CTransactionRef> vOrphansAdded;
+
+static bool AddTestOrphan(const CTransactionRef& tx, NodeId peer)
+{
+    if (!AddOrphanTx(tx, peer)) return false;
+    vOrphansAdded.push_back(tx);
+    return true;
+}
+
 CTransactionRef RandomOrphan()
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    LOCK(cs_main);
-    it = mapOrphanTransactions.lower_bound(InsecureRand256());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    return vOrphansAdded[InsecureRandRange(vOrphansAdded.size())];
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -320,7 +378,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        AddTestOrphan(MakeTransactionRef(tx), i);
     }
 
     // ... and 50 that depend on other orphans:
@@ -337,7 +395,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, *txPrev, tx, 0, SIGHASH_ALL);
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        AddTestOrphan(MakeTransactionRef(tx), i);
     }
 
     // This really-big orphan should be ignored:
@@ -361,25 +419,108 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(MakeTransactionRef(tx), i));
+        BOOST_CHECK(!AddTestOrphan(MakeTransactionRef(tx), i));
     }
 
     LOCK(cs_main);
     // Test EraseOrphansFor:
     for (NodeId i = 0; i < 3; i++)
     {
-        size_t sizeBefore = mapOrphanTransactions.size();
+        size_t sizeBefore = orphanpool.size();
         EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        BOOST_CHECK(orphanpool.size() < sizeBefore);
     }
 
     // Test LimitOrphanTxSize() function:
     LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
+    BOOST_CHECK(orphanpool.size() <= 40);
     LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
+    BOOST_CHECK(orphanpool.size() <= 10);
     LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(orphanpool.size() == 0);
+    vOrphansAdded.clear();
+}
+
+static CTransactionRef OrphanSpending(const std::vector<COutPoint>& vPrevouts)
+{
+    CMutableTransaction tx;
+    for (const COutPoint& prevout : vPrevouts) {
+        tx.vin.emplace_back(prevout);
+    }
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 1*CENT;
+    tx.vout[1].nValue = 2*CENT;
+    return MakeTransactionRef(tx);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanpool)
+{
+    CTxOrphanPool pool;
+
+    // A parent we are still missing, with a tree of orphans below it:
+    // a spends it, b spends a, c spends both a and b, d spends the parent
+    // and something else we're missing.
+    const CTransactionRef parent = OrphanSpending({COutPoint(InsecureRand256(), 0)});
+    const CTransactionRef a = OrphanSpending({COutPoint(parent->GetHash(), 0)});
+    const CTransactionRef b = OrphanSpending({COutPoint(a->GetHash(), 1)});
+    const CTransactionRef c = OrphanSpending({COutPoint(b->GetHash(), 0), COutPoint(a->GetHash(), 0)});
+    const CTransactionRef d = OrphanSpending({COutPoint(parent->GetHash(), 1), COutPoint(InsecureRand256(), 0)});
+    const CTransactionRef unrelated = OrphanSpending({COutPoint(InsecureRand256(), 0)});
+    BOOST_CHECK(pool.Add(c, 1, 400));
+    BOOST_CHECK(pool.Add(b, 2, 300));
+    BOOST_CHECK(pool.Add(a, 1, 200));
+    BOOST_CHECK(pool.Add(d, 3, 100));
+    BOOST_CHECK(pool.Add(unrelated, 2, 500));
+    BOOST_CHECK(!pool.Add(a, 3, 600));
+    BOOST_CHECK_EQUAL(pool.size(), 5U);
+    BOOST_CHECK(pool.Have(a->GetHash()));
+    BOOST_CHECK(!pool.Have(parent->GetHash()));
+
+    // Every orphan below the parent, each after those it spends.
+    std::vector<COrphanTx> vDescendants = pool.GetDescendants(*parent);
+    BOOST_REQUIRE_EQUAL(vDescendants.size(), 4U);
+    std::map<uint256, size_t> mapPos;
+    for (size_t i = 0; i < vDescendants.size(); i++) {
+        mapPos[vDescendants[i].tx->GetHash()] = i;
+    }
+    BOOST_CHECK_EQUAL(mapPos.size(), 4U);
+    BOOST_CHECK(mapPos.at(a->GetHash()) < mapPos.at(b->GetHash()));
+    BOOST_CHECK(mapPos.at(b->GetHash()) < mapPos.at(c->GetHash()));
+    BOOST_CHECK(mapPos.count(d->GetHash()));
+    BOOST_CHECK_EQUAL(vDescendants[mapPos.at(b->GetHash())].fromPeer, 2);
+    BOOST_CHECK(pool.GetDescendants(*unrelated).empty());
+
+    // Only the orphans expiring by the given time go.
+    BOOST_CHECK_EQUAL(pool.EraseExpired(99), 0);
+    BOOST_CHECK_EQUAL(pool.EraseExpired(200), 2);
+    BOOST_CHECK(!pool.Have(a->GetHash()));
+    BOOST_CHECK(!pool.Have(d->GetHash()));
+    // With a gone, b is no longer reachable from the parent.
+    BOOST_CHECK(pool.GetDescendants(*parent).empty());
+    vDescendants = pool.GetDescendants(*a);
+    BOOST_REQUIRE_EQUAL(vDescendants.size(), 2U);
+    BOOST_CHECK(vDescendants[0].tx == b);
+    BOOST_CHECK(vDescendants[1].tx == c);
+
+    // Only the orphans of the given peer go.
+    BOOST_CHECK_EQUAL(pool.EraseForPeer(2), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.Have(c->GetHash()));
+
+    // A block spending the same output as an orphan takes it out.
+    CBlock block;
+    block.vtx.push_back(OrphanSpending({COutPoint(a->GetHash(), 0)}));
+    BOOST_CHECK_EQUAL(pool.EraseForBlock(block), 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+
+    // Random eviction down to the limit.
+    for (int i = 0; i < 20; i++) {
+        BOOST_CHECK(pool.Add(OrphanSpending({COutPoint(InsecureRand256(), 0)}), i, 1000));
+    }
+    BOOST_CHECK_EQUAL(pool.LimitSize(15), 5);
+    BOOST_CHECK_EQUAL(pool.size(), 15U);
+    pool.Clear();
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
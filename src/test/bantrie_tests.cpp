@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bantrie.h>
+#include <netbase.h>
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(bantrie_tests, BasicTestingSetup)
+
+static CNetAddr Address(const std::string& str)
+{
+    CNetAddr addr;
+    BOOST_REQUIRE(LookupHost(str.c_str(), addr, false));
+    return addr;
+}
+
+static CSubNet SubNet(const std::string& str)
+{
+    CSubNet subnet;
+    BOOST_REQUIRE(LookupSubNet(str.c_str(), subnet));
+    return subnet;
+}
+
+BOOST_AUTO_TEST_CASE(bantrie_match)
+{
+    CBanTrie trie;
+    const int64_t nNow = 1000;
+    BOOST_CHECK(!trie.Match(Address("1.2.3.4"), nNow));
+
+    trie.Insert(SubNet("1.2.3.0/24"), nNow + 1);
+    trie.Insert(SubNet("1.2.3.4"), nNow - 1);
+    trie.Insert(SubNet("2a00:1450::/32"), nNow + 1);
+    trie.Insert(SubNet("10.0.0.0/255.0.255.0"), nNow + 1);
+    BOOST_CHECK_EQUAL(trie.size(), 4U);
+
+    BOOST_CHECK(trie.Match(Address("1.2.3.4"), nNow));
+    BOOST_CHECK(trie.Match(Address("1.2.3.255"), nNow));
+    BOOST_CHECK(!trie.Match(Address("1.2.4.1"), nNow));
+    BOOST_CHECK(trie.Match(Address("2a00:1450:1::1"), nNow));
+    BOOST_CHECK(!trie.Match(Address("2a00:1451::1"), nNow));
+    // Netmasks that are not a prefix are matched too
+    BOOST_CHECK(trie.Match(Address("10.1.0.1"), nNow));
+    BOOST_CHECK(!trie.Match(Address("10.0.1.1"), nNow));
+    // IPv4 subnets do not match IPv6 addresses with the same bits
+    BOOST_CHECK(!trie.Match(Address("::102:304"), nNow));
+
+    // Only unexpired bans match
+    BOOST_CHECK(!trie.Match(Address("1.2.3.4"), nNow + 1));
+    BOOST_CHECK(trie.Erase(SubNet("1.2.3.0/24")));
+    BOOST_CHECK(!trie.Erase(SubNet("1.2.3.0/24")));
+    BOOST_CHECK(!trie.Match(Address("1.2.3.4"), nNow));
+    trie.Insert(SubNet("1.2.3.4"), nNow + 1);
+    BOOST_CHECK(trie.Match(Address("1.2.3.4"), nNow));
+    BOOST_CHECK(!trie.Match(Address("1.2.3.5"), nNow));
+
+    // Banning everything
+    trie.Insert(SubNet("0.0.0.0/0"), nNow + 1);
+    BOOST_CHECK(trie.Match(Address("8.8.8.8"), nNow));
+    BOOST_CHECK(!trie.Match(Address("2002::1"), nNow));
+
+    trie.Clear();
+    BOOST_CHECK_EQUAL(trie.size(), 0U);
+    BOOST_CHECK(!trie.Match(Address("8.8.8.8"), nNow));
+}
+
+static CNetAddr RandomAddress(int nSpace)
+{
+    // Addresses from a few small ranges, so that subnets overlap often
+    std::vector<unsigned char> bytes = insecure_rand_ctx.randbytes(16);
+    CNetAddr addr;
+    if (nSpace == 0) {
+        bytes[0] = 10;
+        bytes[1] = InsecureRandBits(2);
+        addr.SetRaw(NET_IPV4, bytes.data());
+    } else {
+        bytes[0] = 0x20;
+        bytes[1] = 0x01;
+        bytes[2] = InsecureRandBits(2);
+        addr.SetRaw(NET_IPV6, bytes.data());
+    }
+    return addr;
+}
+
+BOOST_AUTO_TEST_CASE(bantrie_random)
+{
+    // Compare against checking every subnet, while subnets come and go
+    CBanTrie trie;
+    std::map<CSubNet, int64_t> bans;
+    const int64_t nNow = 1000;
+    for (int i = 0; i < 5000; i++) {
+        int nSpace = InsecureRandBits(1);
+        CSubNet subnet(RandomAddress(nSpace), InsecureRandRange(nSpace == 0 ? 33 : 129));
+        if (InsecureRandBits(2) == 0 && !bans.empty()) {
+            auto it = bans.lower_bound(subnet);
+            if (it == bans.end())
+                it = bans.begin();
+            BOOST_CHECK(trie.Erase(it->first));
+            bans.erase(it);
+        } else {
+            int64_t nBanUntil = nNow - 10 + InsecureRandRange(20);
+            trie.Insert(subnet, nBanUntil);
+            bans[subnet] = nBanUntil;
+        }
+        BOOST_CHECK_EQUAL(trie.size(), bans.size());
+
+        CNetAddr addr = RandomAddress(InsecureRandBits(1));
+        bool fBanned = false;
+        for (const auto& ban : bans) {
+            if (ban.first.Match(addr) && nNow < ban.second)
+                fBanned = true;
+        }
+        BOOST_CHECK_EQUAL(trie.Match(addr, nNow), fBanned);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
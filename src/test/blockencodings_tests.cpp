@@ -6,6 +6,7 @@
 #include <consensus/merkle.h>
 #include <chainparams.h>
 #include <random.h>
+#include <validation.h>
 
 #include <test/test_bitcoin.h>
 
@@ -273,6 +274,46 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
     BOOST_CHECK_EQUAL(pool.mapTx.find(txhash)->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
 }
 
+BOOST_AUTO_TEST_CASE(ShardedMempoolScanTest)
+{
+    // Enough mempool transactions for InitData to scan them on several threads
+    BOOST_REQUIRE(nScriptCheckThreads > 1);
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    const size_t nMempoolTxs = 2 * MIN_SHORTID_SCAN_PER_THREAD + 10;
+
+    CBlock block(BuildBlockTestCase());
+    CMutableTransaction tx(*block.vtx[1]);
+    for (size_t i = 0; i < nMempoolTxs; i++) {
+        tx.vin[0].prevout.hash = InsecureRand256();
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        pool.addUnchecked(ptx->GetHash(), entry.FromTx(*ptx));
+        // Pick transactions from the start, the end, and around shard boundaries
+        if (i == 0 || i == MIN_SHORTID_SCAN_PER_THREAD - 1 || i == MIN_SHORTID_SCAN_PER_THREAD || i == nMempoolTxs - 1)
+            block.vtx.push_back(ptx);
+    }
+    // One transaction the mempool does not have
+    tx.vin[0].prevout.hash = InsecureRand256();
+    block.vtx.push_back(MakeTransactionRef(tx));
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())) ++block.nNonce;
+
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    for (size_t i = 3; i < block.vtx.size() - 1; i++)
+        BOOST_CHECK(partialBlock.IsTxAvailable(i));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(block.vtx.size() - 1));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[1], block.vtx[2], block.vtx.back()}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
 BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
 {
     CTxMemPool pool;
@@ -0,0 +1,112 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilereader.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <streams.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilereader_tests, BasicTestingSetup)
+
+static CBlock MakeBlock(uint32_t nNonce)
+{
+    CBlock block = Params().GenesisBlock();
+    block.nNonce = nNonce;
+    return block;
+}
+
+/** Write a block to file the way block files store it. Returns the position of the block itself. */
+static long WriteBlock(FILE* file, const CBlock& block)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    fwrite(Params().MessageStart(), 1, CMessageHeader::MESSAGE_START_SIZE, file);
+    const unsigned int nSize = ss.size();
+    fwrite(&nSize, 1, sizeof(nSize), file);
+    const long nPos = ftell(file);
+    fwrite(ss.data(), 1, ss.size(), file);
+    return nPos;
+}
+
+BOOST_AUTO_TEST_CASE(read_blocks_in_order)
+{
+    FILE* file = tmpfile();
+    BOOST_REQUIRE(file);
+
+    // Blocks among junk, a header with an impossible size and a block that
+    // does not deserialize.
+    std::vector<std::pair<long, uint256>> vBlocks;
+    fwrite("junk", 1, 4, file);
+    for (uint32_t i = 0; i < 200; i++) {
+        const CBlock block = i == 0 ? Params().GenesisBlock() : MakeBlock(i);
+        vBlocks.emplace_back(WriteBlock(file, block), block.GetHash());
+        if (i == 100) {
+            fwrite(Params().MessageStart(), 1, CMessageHeader::MESSAGE_START_SIZE, file);
+            const unsigned int nBadSize = 10;
+            fwrite(&nBadSize, 1, sizeof(nBadSize), file);
+        }
+    }
+    fwrite(Params().MessageStart(), 1, CMessageHeader::MESSAGE_START_SIZE, file);
+    const unsigned int nSize = 100;
+    fwrite(&nSize, 1, sizeof(nSize), file);
+    const long nBadPos = ftell(file);
+    const std::vector<char> vchJunk(nSize, 0x7f);
+    fwrite(vchJunk.data(), 1, vchJunk.size(), file);
+    rewind(file);
+
+    CBlockFileReader reader(file, Params().MessageStart(), Params().GetConsensus(), CDiskBlockPos(7, 0), 3);
+    for (const auto& expected : vBlocks) {
+        std::shared_ptr<CBlockFileReader::PendingBlock> pending = reader.Next();
+        BOOST_REQUIRE(pending);
+        BOOST_REQUIRE(pending->pblock);
+        BOOST_CHECK_EQUAL(pending->pos.nFile, 7);
+        BOOST_CHECK_EQUAL(pending->pos.nPos, (unsigned int)expected.first);
+        BOOST_CHECK(pending->pblock->GetHash() == expected.second);
+    }
+    std::shared_ptr<CBlockFileReader::PendingBlock> pending = reader.Next();
+    BOOST_REQUIRE(pending);
+    BOOST_CHECK(!pending->pblock);
+    BOOST_CHECK(!pending->strError.empty());
+    BOOST_CHECK_EQUAL(pending->pos.nPos, (unsigned int)nBadPos);
+    BOOST_CHECK(!reader.Next());
+    BOOST_CHECK(!reader.Next());
+}
+
+BOOST_AUTO_TEST_CASE(checked_blocks)
+{
+    FILE* file = tmpfile();
+    BOOST_REQUIRE(file);
+    WriteBlock(file, Params().GenesisBlock());
+    WriteBlock(file, MakeBlock(1));
+    rewind(file);
+
+    // The workers run CheckBlock, which marks the blocks that pass it.
+    CBlockFileReader reader(file, Params().MessageStart(), Params().GetConsensus(), CDiskBlockPos(), 1);
+    std::shared_ptr<CBlockFileReader::PendingBlock> pending = reader.Next();
+    BOOST_REQUIRE(pending && pending->pblock);
+    BOOST_CHECK(pending->pblock->fChecked);
+    pending = reader.Next();
+    BOOST_REQUIRE(pending && pending->pblock);
+    BOOST_CHECK(!pending->pblock->fChecked);
+    BOOST_CHECK(!reader.Next());
+}
+
+BOOST_AUTO_TEST_CASE(stop_early)
+{
+    FILE* file = tmpfile();
+    BOOST_REQUIRE(file);
+    for (uint32_t i = 0; i < 500; i++) {
+        WriteBlock(file, MakeBlock(i));
+    }
+    rewind(file);
+
+    // Destroying the reader with blocks in flight stops its threads.
+    CBlockFileReader reader(file, Params().MessageStart(), Params().GetConsensus(), CDiskBlockPos(), 4);
+    BOOST_CHECK(reader.Next());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
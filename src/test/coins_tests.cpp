@@ -52,7 +52,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -63,7 +63,11 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (fErase) {
+                mapCoins.erase(it++);
+            } else {
+                ++it;
+            }
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -120,6 +124,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool found_an_entry = false;
     bool missed_an_entry = false;
     bool uncached_an_entry = false;
+    bool synced_a_cache = false;
+    bool trimmed_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<COutPoint, Coin> result;
@@ -207,12 +213,23 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         }
 
         if (InsecureRandRange(100) == 0) {
-            // Every 100 iterations, flush an intermediate cache
+            // Every 100 iterations, flush or sync an intermediate cache
             if (stack.size() > 1 && InsecureRandBool() == 0) {
                 unsigned int flushIndex = InsecureRandRange(stack.size() - 1);
-                stack[flushIndex]->Flush();
+                if (InsecureRandBool()) {
+                    stack[flushIndex]->Flush();
+                } else {
+                    stack[flushIndex]->Sync();
+                    synced_a_cache = true;
+                }
             }
         }
+        if (InsecureRandRange(100) == 0) {
+            // Every 100 iterations, trim a random cache
+            int cacheid = InsecureRand32() % stack.size();
+            stack[cacheid]->Trim(stack[cacheid]->DynamicMemoryUsage() / 2);
+            trimmed_a_cache = true;
+        }
         if (InsecureRandRange(100) == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && InsecureRandBool() == 0) {
@@ -253,6 +270,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
     BOOST_CHECK(uncached_an_entry);
+    BOOST_CHECK(synced_a_cache);
+    BOOST_CHECK(trimmed_a_cache);
 }
 
 // Store of all necessary tx and undo data for next test
@@ -592,7 +611,7 @@ void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
     CCoinsMap map;
     InsertCoinsMapEntry(map, value, flags);
-    view.BatchWrite(map, {});
+    view.BatchWrite(map, {}, true);
 }
 
 class SingleEntryCacheTest
@@ -859,4 +878,84 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+void CheckSyncCoins(CAmount base_value, CAmount cache_value, CAmount expected_base_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(base_value, cache_value, cache_flags);
+    test.cache.Sync();
+    test.cache.SelfTest();
+    test.base.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+
+    CAmount result_base_value;
+    char result_base_flags;
+    GetCoinsMapEntry(test.base.map(), result_base_value, result_base_flags);
+    BOOST_CHECK_EQUAL(result_base_value, expected_base_value);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync)
+{
+    /* Check Sync behavior, writing one entry from a cache view to the base
+     * view below it, and checking the resulting entries in both views. Spent
+     * entries are dropped from the cache, unspent ones are kept and become
+     * unmodified.
+     *
+     *              Base    Cache   Result  Result  Cache        Result
+     *              Value   Value   Base    Value   Flags        Flags
+     */
+    CheckSyncCoins(ABSENT, ABSENT, ABSENT, ABSENT, NO_ENTRY   , NO_ENTRY   );
+    CheckSyncCoins(ABSENT, PRUNED, ABSENT, ABSENT, 0          , NO_ENTRY   );
+    CheckSyncCoins(ABSENT, PRUNED, PRUNED, ABSENT, DIRTY      , NO_ENTRY   );
+    CheckSyncCoins(ABSENT, PRUNED, ABSENT, ABSENT, DIRTY|FRESH, NO_ENTRY   );
+    CheckSyncCoins(ABSENT, VALUE2, ABSENT, VALUE2, 0          , 0          );
+    CheckSyncCoins(ABSENT, VALUE2, VALUE2, VALUE2, DIRTY      , 0          );
+    CheckSyncCoins(ABSENT, VALUE2, VALUE2, VALUE2, DIRTY|FRESH, 0          );
+    CheckSyncCoins(VALUE1, ABSENT, VALUE1, ABSENT, NO_ENTRY   , NO_ENTRY   );
+    CheckSyncCoins(VALUE1, PRUNED, VALUE1, ABSENT, 0          , NO_ENTRY   );
+    CheckSyncCoins(VALUE1, PRUNED, PRUNED, ABSENT, DIRTY      , NO_ENTRY   );
+    CheckSyncCoins(VALUE1, VALUE2, VALUE1, VALUE2, 0          , 0          );
+    CheckSyncCoins(VALUE1, VALUE2, VALUE2, VALUE2, DIRTY      , 0          );
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_trim)
+{
+    CCoinsView root;
+    CCoinsViewCacheTest cache{&root};
+
+    // Fill the cache with unmodified entries of increasing height, plus one
+    // modified entry at the lowest height.
+    for (uint32_t i = 0; i < 64; ++i) {
+        CCoinsCacheEntry entry;
+        entry.coin.out.nValue = 1;
+        entry.coin.out.scriptPubKey.assign(InsecureRandBits(6), 0);
+        entry.coin.nHeight = i * 1024;
+        entry.flags = i == 0 ? CCoinsCacheEntry::DIRTY : 0;
+        cache.usage() += entry.coin.DynamicMemoryUsage();
+        cache.map().emplace(COutPoint(InsecureRand256(), i), std::move(entry));
+    }
+    cache.SelfTest();
+
+    // Trimming to the current usage is a no-op.
+    cache.Trim(cache.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 64U);
+
+    // Trimming evicts the oldest unmodified entries first.
+    cache.Trim(cache.DynamicMemoryUsage() - 1);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 63U);
+    for (const auto& entry : cache.map()) {
+        BOOST_CHECK(entry.second.coin.nHeight != 1024);
+    }
+
+    // Dirty entries are never evicted.
+    cache.Trim(0);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK_EQUAL(cache.map().begin()->second.flags, CCoinsCacheEntry::DIRTY);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <coinstatsindex.h>
+#include <key.h>
+#include <script/sign.h>
+#include <script/standard.h>
+#include <txdb.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+static uint256 FinalizeHash(CCoinStatsIndexEntry entry)
+{
+    uint256 hash;
+    entry.muhash.Finalize(hash.begin());
+    return hash;
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_incremental, TestChain100Setup)
+{
+    const CBlockIndex* pindexStart;
+    {
+        LOCK(cs_main);
+        g_coin_stats_index.reset(new CCoinStatsIndex(1 << 20, true));
+        FlushStateToDisk();
+        pindexStart = chainActive.Tip();
+        BOOST_REQUIRE(g_coin_stats_index->Init(*pcoinsdbview, pindexStart));
+    }
+
+    // Connect a block that spends a coinbase output.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    spend.vout[1].nValue = 0;
+    spend.vout[1].scriptPubKey = CScript() << OP_RETURN;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+
+    LOCK(cs_main);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    CCoinStatsIndexEntry start, tip;
+    BOOST_REQUIRE(g_coin_stats_index->ReadEntry(pindexStart->GetBlockHash(), start));
+    BOOST_REQUIRE(g_coin_stats_index->ReadEntry(block.GetHash(), tip));
+    BOOST_CHECK_EQUAL(start.nHeight, pindexStart->nHeight);
+    BOOST_CHECK_EQUAL(tip.nHeight, chainActive.Height());
+    // One coinbase output in, one coinbase output spent, one output created;
+    // the OP_RETURN output is not part of the UTXO set.
+    BOOST_CHECK_EQUAL(tip.nTransactionOutputs, start.nTransactionOutputs + 1);
+
+    // The incrementally maintained entry matches a full scan of the UTXO set.
+    FlushStateToDisk();
+    CCoinStatsIndex check(1 << 20, true);
+    BOOST_REQUIRE(check.Init(*pcoinsdbview, chainActive.Tip()));
+    CCoinStatsIndexEntry scanned;
+    BOOST_REQUIRE(check.ReadEntry(block.GetHash(), scanned));
+    BOOST_CHECK_EQUAL(scanned.nTransactionOutputs, tip.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(scanned.nBogoSize, tip.nBogoSize);
+    BOOST_CHECK_EQUAL(scanned.nTotalAmount, tip.nTotalAmount);
+    BOOST_CHECK(FinalizeHash(scanned) == FinalizeHash(tip));
+    BOOST_CHECK(FinalizeHash(start) != FinalizeHash(tip));
+
+    g_coin_stats_index.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
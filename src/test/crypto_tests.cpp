@@ -10,7 +10,9 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
 #include <random.h>
+#include <streams.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
 
@@ -524,6 +526,92 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+static MuHash3072 FromInt(unsigned char i) {
+    unsigned char tmp[32] = {i, 0};
+    return MuHash3072(tmp, 32);
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    uint256 out;
+
+    // Insertion and removal commute, so the same set always hashes the same.
+    for (int iter = 0; iter < 10; ++iter) {
+        uint256 res;
+        int table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i] = InsecureRandBits(3);
+        }
+        for (int order = 0; order < 4; ++order) {
+            MuHash3072 acc;
+            for (int i = 0; i < 4; ++i) {
+                int t = table[i ^ order];
+                if (t & 4) {
+                    acc /= FromInt(t & 3);
+                } else {
+                    acc *= FromInt(t & 3);
+                }
+            }
+            acc.Finalize(out.begin());
+            if (order == 0) {
+                res = out;
+            } else {
+                BOOST_CHECK(res == out);
+            }
+        }
+
+        MuHash3072 x = FromInt(InsecureRandBits(4)); // x=X
+        MuHash3072 y = FromInt(InsecureRandBits(4)); // x=X, y=Y
+        MuHash3072 z; // x=X, y=Y, z=1
+        z *= x; // x=X, y=Y, z=X
+        z *= y; // x=X, y=Y, z=X*Y
+        y *= x; // x=X, y=Y*X, z=X*Y
+        z /= y; // x=X, y=Y*X, z=1
+        z.Finalize(out.begin());
+        MuHash3072 empty;
+        empty.Finalize(res.begin());
+        BOOST_CHECK(res == out);
+    }
+
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    acc.Finalize(out.begin());
+    BOOST_CHECK(out == uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    // Inserting and removing raw elements is the same as combining hashes of singletons.
+    unsigned char elem[32] = {1, 0};
+    MuHash3072 acc2 = FromInt(0);
+    acc2.Insert(elem, sizeof(elem));
+    elem[0] = 2;
+    acc2.Remove(elem, sizeof(elem));
+    acc2.Finalize(out.begin());
+    BOOST_CHECK(out == uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    // The unfinalized state round trips through serialization.
+    MuHash3072 acc3 = FromInt(0);
+    acc3 *= FromInt(1);
+    acc3 /= FromInt(2);
+    CDataStream ss(SER_DISK, 0);
+    ss << acc3;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 acc4;
+    ss >> acc4;
+    acc4.Finalize(out.begin());
+    BOOST_CHECK(out == uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    // Numbers at or just below the modulus are reduced correctly.
+    unsigned char max[Num3072::BYTE_SIZE];
+    memset(max, 0xff, sizeof(max));
+    Num3072 a(max);
+    Num3072 b = a.GetInverse();
+    b.Multiply(a);
+    BOOST_CHECK(b.limbs[0] == 1);
+    for (int i = 1; i < Num3072::LIMBS; ++i) {
+        BOOST_CHECK(b.limbs[i] == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
@@ -377,4 +377,114 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+/* Test that the live entries of a cache survive a dump and reload, that
+ * erased ones do not, and that a reload into a smaller cache keeps the most
+ * recent entries.
+ */
+BOOST_FIXTURE_TEST_CASE(cuckoocache_persist, TestingSetup)
+{
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> Cache;
+    local_rand_ctx = FastRandomContext(true);
+    const fs::path path = GetDataDir() / "cache.dat";
+
+    Cache source{};
+    source.setup_bytes(1 << 20);
+    std::vector<uint256> hashes(1000);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        source.insert(h);
+    }
+    // Erase the first tenth.
+    for (size_t i = 0; i < hashes.size() / 10; ++i)
+        BOOST_CHECK(source.contains(hashes[i], true));
+    size_t nLive = 0;
+    source.for_each([&nLive](const uint256&) { ++nLive; });
+    BOOST_CHECK_EQUAL(nLive, hashes.size() - hashes.size() / 10);
+
+    uint256 nonce;
+    insecure_GetRandHash(nonce);
+    BOOST_REQUIRE(DumpNoncedCache(path, nonce, {&source}));
+
+    // A full reload restores the nonce and every live entry.
+    {
+        Cache target{};
+        uint32_t nElems = target.setup_bytes(1 << 20);
+        uint256 nonceLoaded;
+        BOOST_REQUIRE(LoadNoncedCache(path, nonceLoaded, {&target}, nElems));
+        BOOST_CHECK(nonceLoaded == nonce);
+        for (size_t i = 0; i < hashes.size(); ++i)
+            BOOST_CHECK_EQUAL(target.contains(hashes[i], false), i >= hashes.size() / 10);
+    }
+
+    // A size-limited reload keeps at most that many entries.
+    {
+        Cache target{};
+        target.setup_bytes(1 << 20);
+        uint256 nonceLoaded;
+        BOOST_REQUIRE(LoadNoncedCache(path, nonceLoaded, {&target}, 100));
+        size_t nLoaded = 0;
+        target.for_each([&nLoaded](const uint256&) { ++nLoaded; });
+        BOOST_CHECK_EQUAL(nLoaded, 100U);
+    }
+
+    // A truncated file is rejected without touching the nonce.
+    fs::resize_file(path, fs::file_size(path) - 1);
+    {
+        Cache target{};
+        uint32_t nElems = target.setup_bytes(1 << 20);
+        uint256 nonceLoaded;
+        BOOST_CHECK(!LoadNoncedCache(path, nonceLoaded, {&target}, nElems));
+        BOOST_CHECK(nonceLoaded.IsNull());
+        BOOST_CHECK(!target.contains(hashes.back(), false));
+    }
+}
+
+/* Test that a sharded cache reloads each entry into the shard it belongs to,
+ * whatever the number of shards it was dumped from.
+ */
+BOOST_FIXTURE_TEST_CASE(cuckoocache_persist_sharded, TestingSetup)
+{
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> Cache;
+    local_rand_ctx = FastRandomContext(true);
+    const fs::path path = GetDataDir() / "cache.dat";
+
+    Cache source{};
+    source.setup_bytes(1 << 20);
+    std::vector<uint256> hashes(1000);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        source.insert(h);
+    }
+    uint256 nonce;
+    BOOST_REQUIRE(DumpNoncedCache(path, nonce, {&source}));
+
+    std::vector<Cache> shards(4);
+    std::vector<Cache*> targets;
+    size_t nElems = 0;
+    for (Cache& shard : shards) {
+        nElems += shard.setup_bytes(1 << 18);
+        targets.push_back(&shard);
+    }
+    BOOST_REQUIRE(LoadNoncedCache(path, nonce, targets, nElems));
+    for (const uint256& h : hashes) {
+        for (size_t i = 0; i < shards.size(); ++i)
+            BOOST_CHECK_EQUAL(shards[i].contains(h, false), i == GetSignatureCacheShard(h, shards.size()));
+    }
+
+    // Dumped shard by shard, a size-limited reload still fills every shard.
+    BOOST_REQUIRE(DumpNoncedCache(path, nonce, {&shards[0], &shards[1], &shards[2], &shards[3]}));
+    std::vector<Cache> limited(4);
+    targets.clear();
+    for (Cache& shard : limited) {
+        shard.setup_bytes(1 << 18);
+        targets.push_back(&shard);
+    }
+    BOOST_REQUIRE(LoadNoncedCache(path, nonce, targets, 200));
+    for (const Cache& shard : limited) {
+        size_t nLoaded = 0;
+        shard.for_each([&nLoaded](const uint256&) { ++nLoaded; });
+        BOOST_CHECK_EQUAL(nLoaded, 50U);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -197,7 +197,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK_EQUAL(pool.CalculateMemPoolAncestors(entry.Fee(2000000LL).FromTx(tx7), setAncestorsCalculated, 100, 1000000, 1000, 1000000, dummy), true);
     BOOST_CHECK(setAncestorsCalculated == setAncestors);
 
-    pool.addUnchecked(tx7.GetHash(), entry.FromTx(tx7), setAncestors);
+    pool.addUnchecked(tx7.GetHash(), entry.FromTx(tx7), CTxMemPool::vecEntries(setAncestors.begin(), setAncestors.end()));
     BOOST_CHECK_EQUAL(pool.size(), 7);
 
     // Now tx6 should be sorted higher (high fee child): tx7, tx6, tx2, ...
@@ -215,7 +215,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     tx8.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
     tx8.vout[0].nValue = 10 * COIN;
     setAncestors.insert(pool.mapTx.find(tx7.GetHash()));
-    pool.addUnchecked(tx8.GetHash(), entry.Fee(0LL).Time(2).FromTx(tx8), setAncestors);
+    pool.addUnchecked(tx8.GetHash(), entry.Fee(0LL).Time(2).FromTx(tx8), CTxMemPool::vecEntries(setAncestors.begin(), setAncestors.end()));
 
     // Now tx8 should be sorted low, but tx6/tx both high
     sortedOrder.insert(sortedOrder.begin(), tx8.GetHash().ToString());
@@ -229,7 +229,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     tx9.vout.resize(1);
     tx9.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
     tx9.vout[0].nValue = 1 * COIN;
-    pool.addUnchecked(tx9.GetHash(), entry.Fee(0LL).Time(3).FromTx(tx9), setAncestors);
+    pool.addUnchecked(tx9.GetHash(), entry.Fee(0LL).Time(3).FromTx(tx9), CTxMemPool::vecEntries(setAncestors.begin(), setAncestors.end()));
 
     // tx9 should be sorted low
     BOOST_CHECK_EQUAL(pool.size(), 9);
@@ -255,7 +255,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK_EQUAL(pool.CalculateMemPoolAncestors(entry.Fee(200000LL).Time(4).FromTx(tx10), setAncestorsCalculated, 100, 1000000, 1000, 1000000, dummy), true);
     BOOST_CHECK(setAncestorsCalculated == setAncestors);
 
-    pool.addUnchecked(tx10.GetHash(), entry.FromTx(tx10), setAncestors);
+    pool.addUnchecked(tx10.GetHash(), entry.FromTx(tx10), CTxMemPool::vecEntries(setAncestors.begin(), setAncestors.end()));
 
     /**
      *  tx8 and tx9 should both now be sorted higher
@@ -571,4 +571,226 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolRelayQueueTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    LOCK(pool.cs);
+
+    auto make_tx = [](const uint256& prev_hash) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(prev_hash, 0);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        return tx;
+    };
+    CMutableTransaction txParent = make_tx(InsecureRand256());
+    CMutableTransaction txChild = make_tx(txParent.GetHash());
+    CMutableTransaction txOther = make_tx(InsecureRand256());
+    CMutableTransaction txLate = make_tx(InsecureRand256());
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(100000).FromTx(txChild));
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(5000).FromTx(txOther));
+    pool.addUnchecked(txLate.GetHash(), entry.Fee(2000).FromTx(txLate));
+
+    auto walk = [&pool](RelayQueueCursor& cursor, size_t nMax) {
+        std::vector<uint256> vHashes;
+        pool.ForEachQueuedForRelay(cursor, [&](const TxMempoolInfo& info) {
+            if (vHashes.size() == nMax) return false;
+            vHashes.push_back(info.tx->GetHash());
+            return true;
+        });
+        return vHashes;
+    };
+
+    BOOST_CHECK_EQUAL(pool.GetRelaySequence(), 0U);
+    const size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK(!pool.QueueForRelay(InsecureRand256()));
+    BOOST_CHECK(pool.QueueForRelay(txChild.GetHash()));
+    BOOST_CHECK(pool.QueueForRelay(txOther.GetHash()));
+    BOOST_CHECK(pool.QueueForRelay(txParent.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetRelaySequence(), 3U);
+
+    // The queue does not count towards the size of the mempool.
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), nUsage);
+    BOOST_CHECK(pool.RelayQueueDynamicMemoryUsage() > 0);
+
+    // Parents go first, then the highest fee rate, whatever the order
+    // they were queued in.
+    RelayQueueCursor cursor;
+    std::vector<uint256> vExpected = {txOther.GetHash(), txParent.GetHash(), txChild.GetHash()};
+    BOOST_CHECK(walk(cursor, 10) == vExpected);
+    BOOST_CHECK_EQUAL(cursor.nSequence, 3U);
+    BOOST_CHECK(walk(cursor, 10).empty());
+
+    // A peer that stops early continues after the last transaction it took,
+    // and what is queued in the meantime waits for the next pass.
+    cursor = RelayQueueCursor();
+    vExpected = {txOther.GetHash()};
+    BOOST_CHECK(walk(cursor, 1) == vExpected);
+    BOOST_CHECK_EQUAL(cursor.nSequence, 0U);
+    BOOST_CHECK(pool.QueueForRelay(txLate.GetHash()));
+    vExpected = {txParent.GetHash()};
+    BOOST_CHECK(walk(cursor, 1) == vExpected);
+    vExpected = {txChild.GetHash()};
+    BOOST_CHECK(walk(cursor, 1) == vExpected);
+    BOOST_CHECK_EQUAL(cursor.nSequence, 3U);
+
+    // A peer that has been through the queue only sees what came after.
+    vExpected = {txLate.GetHash()};
+    BOOST_CHECK(walk(cursor, 10) == vExpected);
+    BOOST_CHECK_EQUAL(cursor.nSequence, 4U);
+
+    // Transactions that left the mempool are skipped.
+    pool.removeRecursive(txOther);
+    cursor = RelayQueueCursor();
+    vExpected = {txLate.GetHash(), txParent.GetHash(), txChild.GetHash()};
+    BOOST_CHECK(walk(cursor, 10) == vExpected);
+
+    // Trimming forgets everything up to the given sequence number.
+    pool.TrimRelayQueue(3);
+    cursor = RelayQueueCursor();
+    vExpected = {txLate.GetHash()};
+    BOOST_CHECK(walk(cursor, 10) == vExpected);
+    BOOST_CHECK_EQUAL(cursor.nSequence, 4U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolEpochTraversalTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    LOCK(pool.cs);
+
+    auto make_tx = [](const std::vector<COutPoint>& vPrevout) {
+        CMutableTransaction tx;
+        for (const COutPoint& prevout : vPrevout) {
+            tx.vin.emplace_back(prevout, CScript() << OP_11);
+        }
+        tx.vout.resize(2);
+        for (CTxOut& txout : tx.vout) {
+            txout.scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+            txout.nValue = 1 * COIN;
+        }
+        return tx;
+    };
+    // A diamond: a is spent by b and c, which are both spent by d, which is
+    // spent by e.
+    CMutableTransaction a = make_tx({COutPoint(InsecureRand256(), 0)});
+    CMutableTransaction b = make_tx({COutPoint(a.GetHash(), 0)});
+    CMutableTransaction c = make_tx({COutPoint(a.GetHash(), 1)});
+    CMutableTransaction d = make_tx({COutPoint(b.GetHash(), 0), COutPoint(c.GetHash(), 0)});
+    CMutableTransaction e = make_tx({COutPoint(d.GetHash(), 0)});
+    for (const CMutableTransaction* tx : {&a, &b, &c, &d, &e}) {
+        pool.addUnchecked(tx->GetHash(), entry.Fee(1000).FromTx(*tx));
+    }
+    CTxMemPool::txiter ita = pool.mapTx.find(a.GetHash());
+    CTxMemPool::txiter itd = pool.mapTx.find(d.GetHash());
+    CTxMemPool::txiter ite = pool.mapTx.find(e.GetHash());
+
+    // Entries reachable along several paths are reported once, and the
+    // results agree with the set based versions.
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    CTxMemPool::vecEntries vAncestors;
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*ite, vAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*ite, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK_EQUAL(vAncestors.size(), 4U);
+    BOOST_CHECK(vAncestors[0] == itd);
+    BOOST_CHECK(CTxMemPool::setEntries(vAncestors.begin(), vAncestors.end()) == setAncestors);
+    BOOST_CHECK_EQUAL(ite->GetCountWithAncestors(), vAncestors.size() + 1);
+
+    // Counting d twice would push this over the limit.
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*ite, vAncestors, 5, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(*ite, vAncestors, 4, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+
+    CTxMemPool::vecEntries vDescendants;
+    CTxMemPool::setEntries setDescendants;
+    pool.CalculateDescendants(ita, vDescendants);
+    pool.CalculateDescendants(ita, setDescendants);
+    BOOST_CHECK_EQUAL(vDescendants.size(), 5U);
+    BOOST_CHECK(vDescendants[0] == ita);
+    BOOST_CHECK(CTxMemPool::setEntries(vDescendants.begin(), vDescendants.end()) == setDescendants);
+    BOOST_CHECK_EQUAL(ita->GetCountWithDescendants(), vDescendants.size());
+
+    // Walks reuse the vector they are given.
+    pool.CalculateDescendants(itd, vDescendants);
+    BOOST_CHECK_EQUAL(vDescendants.size(), 2U);
+    BOOST_CHECK(vDescendants[0] == itd && vDescendants[1] == ite);
+
+    // Mining the top of the diamond takes it out of the ancestor state of
+    // everything below it exactly once.
+    pool.removeForBlock({MakeTransactionRef(a)}, 1);
+    BOOST_CHECK_EQUAL(ite->GetCountWithAncestors(), 4U);
+    BOOST_CHECK_EQUAL(itd->GetCountWithAncestors(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolFeeHistogramTest)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // Three unrelated transactions of the same size, with no fee, with a
+    // feerate between bucket boundaries and with one above the top one.
+    std::vector<CMutableTransaction> vtx(3);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        vtx[i].vin[0].scriptSig = CScript() << OP_11;
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        vtx[i].vout[0].nValue = 10 * COIN;
+    }
+    const uint64_t nSize = GetVirtualTransactionSize(vtx[0]);
+    const CAmount nMidFee = 5000 * nSize / 1000;
+    const CAmount nHighFee = CFeeRateHistogram::MAX_BUCKET_FEERATE * 2 * nSize / 1000;
+    pool.addUnchecked(vtx[0].GetHash(), entry.Fee(0).FromTx(vtx[0]));
+    pool.addUnchecked(vtx[1].GetHash(), entry.Fee(nMidFee).FromTx(vtx[1]));
+    pool.addUnchecked(vtx[2].GetHash(), entry.Fee(nHighFee).FromTx(vtx[2]));
+    // Prioritisation does not move a transaction.
+    pool.PrioritiseTransaction(vtx[0].GetHash(), COIN);
+
+    std::vector<CFeeRateHistogram::Bucket> vBuckets = pool.GetFeeHistogram();
+    uint64_t nCount = 0;
+    for (size_t i = 0; i < vBuckets.size(); i++) {
+        const CFeeRateHistogram::Bucket& bucket = vBuckets[i];
+        if (i > 0) {
+            BOOST_CHECK(bucket.nMinFeeRate > vBuckets[i - 1].nMinFeeRate);
+        }
+        nCount += bucket.nCount;
+        BOOST_CHECK_EQUAL(bucket.nSize, bucket.nCount * nSize);
+        if (bucket.nCount == 0)
+            continue;
+        const CAmount nFeeRate = CFeeRate(bucket.nFees, nSize).GetFeePerK();
+        BOOST_CHECK(nFeeRate >= bucket.nMinFeeRate);
+        BOOST_CHECK(i + 1 == vBuckets.size() || nFeeRate < vBuckets[i + 1].nMinFeeRate);
+    }
+    BOOST_CHECK_EQUAL(nCount, 3U);
+    BOOST_CHECK_EQUAL(vBuckets.front().nCount, 1U);
+    BOOST_CHECK_EQUAL(vBuckets.front().nFees, 0);
+    BOOST_CHECK_EQUAL(vBuckets.back().nCount, 1U);
+    BOOST_CHECK_EQUAL(vBuckets.back().nFees, nHighFee);
+
+    // Removing the transactions takes them out again.
+    pool.removeRecursive(vtx[1]);
+    vBuckets = pool.GetFeeHistogram();
+    nCount = 0;
+    for (const CFeeRateHistogram::Bucket& bucket : vBuckets) {
+        nCount += bucket.nCount;
+        BOOST_CHECK(bucket.nFees == 0 || bucket.nFees == nHighFee);
+    }
+    BOOST_CHECK_EQUAL(nCount, 2U);
+    pool.removeRecursive(vtx[0]);
+    pool.removeRecursive(vtx[2]);
+    for (const CFeeRateHistogram::Bucket& bucket : pool.GetFeeHistogram()) {
+        BOOST_CHECK_EQUAL(bucket.nCount, 0U);
+        BOOST_CHECK_EQUAL(bucket.nSize, 0U);
+        BOOST_CHECK_EQUAL(bucket.nFees, 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,7 @@
 #include <miner.h>
 #include <policy/policy.h>
 #include <pubkey.h>
+#include <script/interpreter.h>
 #include <script/standard.h>
 #include <txmempool.h>
 #include <uint256.h>
@@ -520,4 +521,82 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_FIXTURE_TEST_CASE(block_template_manager, TestChain100Setup)
+{
+    BlockTemplateManager templates(Params());
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+
+    // Spend the first output of txPrev to the mempool, as the validation
+    // interface would report it.
+    auto spend = [&](const CTransaction& txPrev, CAmount nFee) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = txPrev.vout[0].nValue - nFee;
+        tx.vout[0].scriptPubKey = txPrev.vout[0].scriptPubKey;
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(txPrev.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << vchSig;
+        CTransactionRef ptx = MakeTransactionRef(std::move(tx));
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_CHECK(AcceptToMemoryPool(mempool, state, ptx, nullptr, nullptr, true, 0));
+        }
+        templates.TransactionAddedToMempool(ptx);
+        return ptx;
+    };
+    auto check_validity = [](const CBlockTemplate& tmpl) {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(TestBlockValidity(state, Params(), tmpl.block, chainActive.Tip(), false, false));
+    };
+
+    const uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    BOOST_CHECK_EQUAL(templates.GetTemplateFees(hashTip), -1);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = templates.GetTemplate(scriptPubKey, true);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(templates.GetTemplateFees(hashTip), 0);
+    const CAmount nSubsidy = pblocktemplate->block.vtx[0]->vout[0].nValue;
+
+    // A transaction and its child are added to the template as they enter
+    // the mempool, paying their fees to the coinbase.
+    CTransactionRef tx1 = spend(coinbaseTxns[0], 10000);
+    CTransactionRef tx2 = spend(*tx1, 20000);
+    BOOST_CHECK_EQUAL(templates.GetTemplateFees(hashTip), 30000);
+    pblocktemplate = templates.GetTemplate(scriptPubKey, true);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1] == tx1);
+    BOOST_CHECK(pblocktemplate->block.vtx[2] == tx2);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->vout[0].nValue, nSubsidy + 30000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -30000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[2], 20000);
+    check_validity(*pblocktemplate);
+
+    // A transaction leaving the mempool stays in the template until it is
+    // assembled again.
+    mempool.removeRecursive(*tx2);
+    templates.TransactionRemovedFromMempool(tx2);
+    BOOST_CHECK_EQUAL(templates.GetTemplate(scriptPubKey, true)->block.vtx.size(), 3U);
+    SetMockTime(GetTime() + TEMPLATE_REASSEMBLE_INTERVAL + 1);
+    pblocktemplate = templates.GetTemplate(scriptPubKey, true);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(templates.GetTemplateFees(hashTip), 10000);
+    check_validity(*pblocktemplate);
+    SetMockTime(0);
+
+    // A new tip gets a new template right away.
+    CreateAndProcessBlock({}, scriptPubKey, false);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() != hashTip);
+    templates.UpdatedBlockTip(chainActive.Tip(), nullptr, false);
+    BOOST_CHECK_EQUAL(templates.GetTemplateFees(hashTip), -1);
+    BOOST_CHECK_EQUAL(templates.GetTemplateFees(chainActive.Tip()->GetBlockHash()), 0);
+    check_validity(*templates.GetTemplate(scriptPubKey, true));
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
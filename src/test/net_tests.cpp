@@ -10,8 +10,10 @@
 #include <streams.h>
 #include <net.h>
 #include <netbase.h>
+#include <net_processing.h>
 #include <chainparams.h>
 #include <util.h>
+#include <utiltime.h>
 
 class CAddrManSerializationMock : public CAddrMan
 {
@@ -185,4 +187,233 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static std::vector<unsigned char> SerializeMessage(const std::string& command, const std::vector<unsigned char>& payload)
+{
+    CMessageHeader hdr(Params().MessageStart(), command.c_str(), payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    std::vector<unsigned char> vch;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vch, 0, hdr};
+    vch.insert(vch.end(), payload.begin(), payload.end());
+    return vch;
+}
+
+static void ReceiveMessage(CNetMessage& msg, const std::vector<unsigned char>& vch)
+{
+    const char* pch = reinterpret_cast<const char*>(vch.data());
+    unsigned int nBytes = vch.size();
+    while (nBytes > 0) {
+        // Deliver in small pieces, as a slow connection would
+        int handled = msg.in_data ? msg.readData(pch, std::min(nBytes, 1000U)) : msg.readHeader(pch, std::min(nBytes, 10U));
+        BOOST_REQUIRE(handled > 0);
+        pch += handled;
+        nBytes -= handled;
+    }
+    BOOST_REQUIRE(msg.complete());
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_reuse)
+{
+    std::vector<unsigned char> tx(100000, 0x03);
+    std::vector<unsigned char> inv(37, 0x04);
+
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveMessage(msg, SerializeMessage(NetMsgType::TX, tx));
+    BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), NetMsgType::TX);
+    BOOST_CHECK(memcmp(msg.GetMessageHash().begin(), msg.hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) == 0);
+    BOOST_CHECK(std::vector<unsigned char>(msg.vRecv.begin(), msg.vRecv.end()) == tx);
+
+    // A reset message parses the next one from scratch, with the checksum
+    // covering only the new payload, but keeps its buffer.
+    msg.Reset(Params().MessageStart(), INIT_PROTO_VERSION);
+    BOOST_CHECK(!msg.complete());
+    BOOST_CHECK(msg.vRecv.empty());
+    BOOST_CHECK(msg.vRecv.capacity() >= tx.size());
+    ReceiveMessage(msg, SerializeMessage(NetMsgType::INV, inv));
+    BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), NetMsgType::INV);
+    BOOST_CHECK(memcmp(msg.GetMessageHash().begin(), msg.hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) == 0);
+    BOOST_CHECK(std::vector<unsigned char>(msg.vRecv.begin(), msg.vRecv.end()) == inv);
+}
+
+#ifndef WIN32
+static CSerializedNetMsg MakeMessage(const std::string& command, const std::vector<unsigned char>& payload)
+{
+    CSerializedNetMsg msg;
+    msg.command = command;
+    msg.data = payload;
+    return msg;
+}
+
+static void ReadAvailable(SOCKET hSocket, std::vector<unsigned char>& vch)
+{
+    unsigned char buf[4096];
+    ssize_t nBytes;
+    while ((nBytes = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        vch.insert(vch.end(), buf, buf + nBytes);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(send_buffer_scatter_gather)
+{
+    CConnman connman(0, 0);
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    int nSendBuffer = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nSendBuffer, sizeof(nSendBuffer));
+    CNode node(0, NODE_NETWORK, 0, fds[0], CAddress(), 0, 0, CAddress(), "", false);
+
+    // A small message is sent right away.
+    const std::vector<unsigned char> ping(8, 0x01);
+    connman.PushMessage(&node, MakeMessage(NetMsgType::PING, ping));
+    BOOST_CHECK(node.vSendMsg.empty());
+    std::vector<unsigned char> received;
+    ReadAvailable(fds[1], received);
+    BOOST_CHECK(received == SerializeMessage(NetMsgType::PING, ping));
+
+    // A large message, shared with whoever else it would be relayed to, does
+    // not fit in the socket buffer. Messages queued behind it follow it out.
+    std::vector<unsigned char> block(1000000);
+    for (unsigned char& c : block) c = InsecureRandBits(8);
+    const std::vector<unsigned char> pong(8, 0x02);
+    CSendBufferRef buffer = connman.PrepareMessage(MakeMessage(NetMsgType::BLOCK, block));
+    connman.PushMessage(&node, buffer);
+    BOOST_CHECK(!node.vSendMsg.empty());
+    BOOST_CHECK(node.nSendOffset > 0);
+    connman.PushMessage(&node, MakeMessage(NetMsgType::PONG, pong));
+    BOOST_CHECK_EQUAL(node.vSendMsg.size(), 2U);
+    BOOST_CHECK_EQUAL(buffer.use_count(), 2);
+
+    std::vector<unsigned char> expected = SerializeMessage(NetMsgType::BLOCK, block);
+    std::vector<unsigned char> vchPong = SerializeMessage(NetMsgType::PONG, pong);
+    expected.insert(expected.end(), vchPong.begin(), vchPong.end());
+    received.clear();
+    for (int i = 0; i < 100000 && received.size() < expected.size(); ++i) {
+        CConnmanTest::SocketSendData(connman, node);
+        ReadAvailable(fds[1], received);
+    }
+    BOOST_CHECK(received == expected);
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    BOOST_CHECK_EQUAL(node.nSendOffset, 0U);
+    BOOST_CHECK_EQUAL(buffer.use_count(), 1);
+
+    // Once released, the payload's storage is handed out again.
+    buffer.reset();
+    BOOST_CHECK(g_send_buffer_pool.GetFreeCount() > 0);
+    std::vector<unsigned char> payload = g_send_buffer_pool.GetPayload();
+    BOOST_CHECK(payload.empty());
+    BOOST_CHECK(payload.capacity() >= block.size());
+
+    SOCKET hPeer = fds[1];
+    CloseSocket(hPeer);
+}
+
+/** Queue a message for processing, the way ThreadSocketHandler does. */
+static void DeliverMessage(CNode& node, const std::string& command, const std::vector<unsigned char>& payload)
+{
+    const std::vector<unsigned char> vch = SerializeMessage(command, payload);
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveMessage(msg, vch);
+    LOCK(node.cs_vProcessMsg);
+    node.nProcessQueueSize += vch.size();
+    node.vProcessMsg.push_back(std::move(msg));
+}
+
+/** Append the nonces of the pong messages in vch to vNonces, and consume them. */
+static void ParsePongs(std::vector<unsigned char>& vch, std::vector<uint64_t>& vNonces)
+{
+    size_t nPos = 0;
+    while (vch.size() - nPos >= CMessageHeader::HEADER_SIZE) {
+        const char* pch = (const char*)vch.data() + nPos;
+        CDataStream ss(pch, pch + CMessageHeader::HEADER_SIZE, SER_NETWORK, PROTOCOL_VERSION);
+        CMessageHeader hdr(Params().MessageStart());
+        ss >> hdr;
+        if (vch.size() - nPos < CMessageHeader::HEADER_SIZE + hdr.nMessageSize)
+            break;
+        if (hdr.GetCommand() == NetMsgType::PONG) {
+            CDataStream payload(pch + CMessageHeader::HEADER_SIZE, pch + CMessageHeader::HEADER_SIZE + hdr.nMessageSize, SER_NETWORK, PROTOCOL_VERSION);
+            uint64_t nonce;
+            payload >> nonce;
+            vNonces.push_back(nonce);
+        }
+        nPos += CMessageHeader::HEADER_SIZE + hdr.nMessageSize;
+    }
+    vch.erase(vch.begin(), vch.begin() + nPos);
+}
+
+BOOST_FIXTURE_TEST_CASE(message_handler_threads, TestingSetup)
+{
+    // Several handler threads process the messages of several peers at
+    // once; each peer's pings are still answered in order.
+    CConnman::Options options;
+    options.nMessageHandlerThreads = 4;
+    options.m_msgproc = peerLogic.get();
+    connman->Init(options);
+
+    const int nNodes = 8, nPings = 50;
+    std::vector<std::unique_ptr<CNode>> vNodes;
+    std::vector<SOCKET> vPeerSockets;
+    for (int i = 0; i < nNodes; i++) {
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        vNodes.emplace_back(new CNode(i, NODE_NETWORK, 0, fds[0], CAddress(), 0, 0, CAddress(), "", true));
+        vPeerSockets.push_back(fds[1]);
+        CNode& node = *vNodes.back();
+        peerLogic->InitializeNode(&node);
+        node.nVersion = PROTOCOL_VERSION;
+        node.SetSendVersion(PROTOCOL_VERSION);
+        node.fSuccessfullyConnected = true;
+        for (uint64_t nonce = 0; nonce < (uint64_t)nPings; nonce++) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << nonce;
+            DeliverMessage(node, NetMsgType::PING, std::vector<unsigned char>(ss.begin(), ss.end()));
+        }
+        CConnmanTest::AddNode(node);
+    }
+
+    CConnmanTest::StartMessageHandlers(*connman);
+    std::vector<std::vector<unsigned char>> vReceived(nNodes);
+    std::vector<std::vector<uint64_t>> vPongs(nNodes);
+    for (int n = 0; n < 1000; n++) {
+        bool fDone = true;
+        for (int i = 0; i < nNodes; i++) {
+            CConnmanTest::SocketSendData(*connman, *vNodes[i]);
+            ReadAvailable(vPeerSockets[i], vReceived[i]);
+            ParsePongs(vReceived[i], vPongs[i]);
+            fDone &= vPongs[i].size() == (size_t)nPings;
+        }
+        if (fDone)
+            break;
+        MilliSleep(10);
+    }
+    for (int i = 0; i < nNodes; i++) {
+        BOOST_REQUIRE_EQUAL(vPongs[i].size(), (size_t)nPings);
+        for (int nonce = 0; nonce < nPings; nonce++) {
+            BOOST_CHECK_EQUAL(vPongs[i][nonce], (uint64_t)nonce);
+        }
+    }
+
+    // Once interrupted, all handler threads exit, and nothing queued after
+    // that is processed.
+    connman->Interrupt();
+    CConnmanTest::StopMessageHandlers(*connman);
+    for (int i = 0; i < nNodes; i++) {
+        DeliverMessage(*vNodes[i], NetMsgType::PING, std::vector<unsigned char>(8, 0));
+    }
+    MilliSleep(50);
+    for (int i = 0; i < nNodes; i++) {
+        LOCK(vNodes[i]->cs_vProcessMsg);
+        BOOST_CHECK_EQUAL(vNodes[i]->vProcessMsg.size(), 1U);
+    }
+
+    CConnmanTest::ClearNodes();
+    bool dummy;
+    for (int i = 0; i < nNodes; i++) {
+        peerLogic->FinalizeNode(vNodes[i]->GetId(), dummy);
+        vNodes[i]->CloseSocketDisconnect();
+        CloseSocket(vPeerSockets[i]);
+    }
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,112 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <validation.h>
+#include <version.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(rawblock_tests, BasicTestingSetup)
+
+static std::vector<unsigned char> SerializeBlock(const CBlock& block, int nVersion)
+{
+    CDataStream ss(SER_NETWORK, nVersion);
+    ss << block;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+static CTransactionRef MakeTx(bool fWitness, bool fCriticalData)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vin[0].scriptSig = CScript() << OP_1;
+    mtx.vin[1].prevout = COutPoint(InsecureRand256(), 1);
+    if (fWitness) {
+        mtx.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 0x30));
+        mtx.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(33, 0x02));
+    }
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    if (fCriticalData) {
+        mtx.criticalData.bytes = std::vector<unsigned char>(4, 0x0a);
+        mtx.criticalData.hashCritical = InsecureRand256();
+    }
+    mtx.nLockTime = 17;
+    return MakeTransactionRef(std::move(mtx));
+}
+
+BOOST_AUTO_TEST_CASE(strip_block_witness)
+{
+    CBlock block;
+    block.nVersion = 0x20000000;
+    block.hashPrevBlock = InsecureRand256();
+    block.nTime = 1234567;
+    block.vtx.push_back(MakeTx(false, false));
+    block.vtx.push_back(MakeTx(true, false));
+    block.vtx.push_back(MakeTx(false, true));
+    block.vtx.push_back(MakeTx(true, true));
+
+    const std::vector<unsigned char> vchWitness = SerializeBlock(block, PROTOCOL_VERSION);
+    const std::vector<unsigned char> vchNoWitness = SerializeBlock(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    BOOST_CHECK(vchWitness != vchNoWitness);
+
+    std::vector<unsigned char> vchStripped;
+    BOOST_CHECK(StripBlockWitness(vchWitness, vchStripped));
+    BOOST_CHECK(vchStripped == vchNoWitness);
+
+    // Stripping a block without witnesses leaves it unchanged.
+    BOOST_CHECK(StripBlockWitness(vchNoWitness, vchStripped));
+    BOOST_CHECK(vchStripped == vchNoWitness);
+
+    // The result deserializes to the same transactions. Critical data is
+    // kept behind the extended-format marker, so read it that way.
+    CBlock blockStripped;
+    CDataStream ss(vchStripped, SER_NETWORK, PROTOCOL_VERSION);
+    ss >> blockStripped;
+    BOOST_CHECK(blockStripped.GetHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(blockStripped.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK(blockStripped.vtx[i]->GetHash() == block.vtx[i]->GetHash());
+        BOOST_CHECK(!blockStripped.vtx[i]->HasWitness());
+        BOOST_CHECK(blockStripped.vtx[i]->criticalData == block.vtx[i]->criticalData);
+    }
+
+    // Truncated or padded blocks are rejected.
+    std::vector<unsigned char> vchBad(vchWitness.begin(), vchWitness.end() - 1);
+    BOOST_CHECK(!StripBlockWitness(vchBad, vchStripped));
+    vchBad = vchWitness;
+    vchBad.push_back(0);
+    BOOST_CHECK(!StripBlockWitness(vchBad, vchStripped));
+}
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup)
+{
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+    }
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+
+    std::vector<unsigned char> vchBlock;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(vchBlock, pindex, Params().MessageStart()));
+    BOOST_CHECK(vchBlock == SerializeBlock(block, PROTOCOL_VERSION));
+
+    BOOST_REQUIRE(ReadRawBlockFromDisk(vchBlock, pindex, Params().MessageStart(), false));
+    BOOST_CHECK(vchBlock == SerializeBlock(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
+
+    // The block file's magic is checked.
+    CMessageHeader::MessageStartChars wrong_start = {0, 0, 0, 0};
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pindex, wrong_start));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
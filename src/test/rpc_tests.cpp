@@ -8,6 +8,9 @@
 #include <base58.h>
 #include <core_io.h>
 #include <netbase.h>
+#include <policy/policy.h>
+#include <primitives/transaction.h>
+#include <script/script.h>
 
 #include <test/test_bitcoin.h>
 
@@ -82,6 +85,18 @@ BOOST_AUTO_TEST_CASE(rpc_rawparams)
     BOOST_CHECK_THROW(CallRPC("sendrawtransaction null"), std::runtime_error);
     BOOST_CHECK_THROW(CallRPC("sendrawtransaction DEADBEEF"), std::runtime_error);
     BOOST_CHECK_THROW(CallRPC(std::string("sendrawtransaction ")+rawtx+" extra"), std::runtime_error);
+
+    // Packages are refused over MAX_PACKAGE_COUNT transactions or MAX_PACKAGE_WEIGHT.
+    std::vector<std::string> vHex(MAX_PACKAGE_COUNT + 1, "\"" + rawtx + "\"");
+    BOOST_CHECK_EXCEPTION(CallRPC("sendrawtransactions [" + boost::algorithm::join(vHex, ",") + "]"), std::runtime_error,
+                          [](const std::runtime_error& e) { return std::string(e.what()).find("Too many transactions") == 0; });
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(MAX_STANDARD_TX_WEIGHT / WITNESS_SCALE_FACTOR, 0);
+    vHex.assign(MAX_PACKAGE_WEIGHT / MAX_STANDARD_TX_WEIGHT + 1, "\"" + EncodeHexTx(mtx) + "\"");
+    BOOST_CHECK_EXCEPTION(CallRPC("sendrawtransactions [" + boost::algorithm::join(vHex, ",") + "]"), std::runtime_error,
+                          [](const std::runtime_error& e) { return std::string(e.what()).find("Transactions too heavy") == 0; });
 }
 
 BOOST_AUTO_TEST_CASE(rpc_togglenetwork)
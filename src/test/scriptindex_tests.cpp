@@ -0,0 +1,132 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <key.h>
+#include <script/sign.h>
+#include <scriptindex.h>
+#include <streams.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(scriptindex_tests)
+
+typedef std::vector<std::pair<CScriptOutputKey, CScriptOutputValue>> ScriptOutputs;
+
+BOOST_FIXTURE_TEST_CASE(scriptindex_keys, BasicTestingSetup)
+{
+    // Outputs of a script sort by height, which is serialized big endian.
+    const uint256 hashScript = GetScriptHash(CScript() << OP_TRUE);
+    CDataStream ssLow(SER_DISK, CLIENT_VERSION), ssHigh(SER_DISK, CLIENT_VERSION);
+    ssLow << CScriptOutputKey(hashScript, 255, COutPoint(uint256S("ff"), 7));
+    ssHigh << CScriptOutputKey(hashScript, 256, COutPoint(uint256S("01"), 0));
+    BOOST_CHECK(ssLow.str() < ssHigh.str());
+
+    CScriptOutputKey key(hashScript, 1000, COutPoint(uint256S("1234"), 70000)), decoded;
+    BOOST_REQUIRE(DecodeScriptIndexCursor(EncodeScriptIndexCursor(key), decoded));
+    BOOST_CHECK(decoded.hashScript == key.hashScript);
+    BOOST_CHECK_EQUAL(decoded.nHeight, key.nHeight);
+    BOOST_CHECK(decoded.outpoint == key.outpoint);
+    BOOST_CHECK(!DecodeScriptIndexCursor("00", decoded));
+    BOOST_CHECK(!DecodeScriptIndexCursor(EncodeScriptIndexCursor(key) + "00", decoded));
+    BOOST_CHECK(!DecodeScriptIndexCursor("xyz", decoded));
+}
+
+BOOST_FIXTURE_TEST_CASE(scriptindex_outputs, TestChain100Setup)
+{
+    CScriptIndex scriptindex(1 << 20, true);
+    scriptindex.Start();
+    for (int i = 0; i < 1000 && !scriptindex.IsSynced(); i++) {
+        MilliSleep(10);
+    }
+    BOOST_REQUIRE(scriptindex.IsSynced());
+    BOOST_REQUIRE(scriptindex.BlockUntilSyncedToCurrentChain());
+
+    // Every block of the test chain pays its coinbase to the same script.
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const uint256 hashScript = GetScriptHash(scriptPubKey);
+    ScriptOutputs vAll;
+    bool fMore;
+    BOOST_REQUIRE(scriptindex.FindOutputs(hashScript, 0, std::numeric_limits<int>::max(), nullptr, 1000, vAll, fMore));
+    BOOST_CHECK(!fMore);
+    BOOST_REQUIRE_EQUAL(vAll.size(), coinbaseTxns.size());
+    for (size_t i = 0; i < vAll.size(); i++) {
+        BOOST_CHECK_EQUAL(vAll[i].first.nHeight, (int)i + 1);
+        BOOST_CHECK(vAll[i].first.outpoint == COutPoint(coinbaseTxns[i].GetHash(), 0));
+        BOOST_CHECK_EQUAL(vAll[i].second.nValue, coinbaseTxns[i].vout[0].nValue);
+        BOOST_CHECK(!vAll[i].second.IsSpent());
+    }
+
+    // Pages continue from the cursor to the same outputs.
+    ScriptOutputs vPaged, vPage;
+    do {
+        const CScriptOutputKey* pCursor = vPaged.empty() ? nullptr : &vPaged.back().first;
+        BOOST_REQUIRE(scriptindex.FindOutputs(hashScript, 0, std::numeric_limits<int>::max(), pCursor, 30, vPage, fMore));
+        vPaged.insert(vPaged.end(), vPage.begin(), vPage.end());
+    } while (fMore);
+    BOOST_REQUIRE_EQUAL(vPaged.size(), vAll.size());
+    for (size_t i = 0; i < vPaged.size(); i++) {
+        BOOST_CHECK(vPaged[i].first.outpoint == vAll[i].first.outpoint);
+    }
+
+    // Height ranges are inclusive.
+    BOOST_REQUIRE(scriptindex.FindOutputs(hashScript, 10, 19, nullptr, 1000, vPage, fMore));
+    BOOST_CHECK_EQUAL(vPage.size(), 10U);
+    BOOST_CHECK_EQUAL(vPage.front().first.nHeight, 10);
+    BOOST_CHECK_EQUAL(vPage.back().first.nHeight, 19);
+    BOOST_REQUIRE(scriptindex.FindOutputs(hashScript, 10, 19, nullptr, 10, vPage, fMore));
+    BOOST_CHECK(!fMore);
+
+    // Spend the first coinbase output to another script.
+    const CScript scriptOther = CScript() << OP_TRUE;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptOther;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CreateAndProcessBlock({spend}, scriptPubKey);
+    BOOST_REQUIRE(scriptindex.BlockUntilSyncedToCurrentChain());
+
+    BOOST_REQUIRE(scriptindex.FindOutputs(hashScript, 1, 1, nullptr, 1000, vPage, fMore));
+    BOOST_REQUIRE_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(vPage[0].second.IsSpent());
+    BOOST_CHECK(vPage[0].second.spentBy == COutPoint(spend.GetHash(), 0));
+    BOOST_CHECK_EQUAL(vPage[0].second.nSpentHeight, 101);
+    BOOST_REQUIRE(scriptindex.FindOutputs(GetScriptHash(scriptOther), 0, std::numeric_limits<int>::max(), nullptr, 1000, vPage, fMore));
+    BOOST_REQUIRE_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(vPage[0].first.outpoint == COutPoint(spend.GetHash(), 0));
+    BOOST_CHECK_EQUAL(vPage[0].first.nHeight, 101);
+
+    // Disconnecting the block undoes both.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_REQUIRE(scriptindex.FindOutputs(hashScript, 1, 1, nullptr, 1000, vPage, fMore));
+    BOOST_REQUIRE_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(!vPage[0].second.IsSpent());
+    BOOST_REQUIRE(scriptindex.FindOutputs(hashScript, 0, std::numeric_limits<int>::max(), nullptr, 1000, vPage, fMore));
+    BOOST_CHECK_EQUAL(vPage.size(), coinbaseTxns.size());
+    BOOST_REQUIRE(scriptindex.FindOutputs(GetScriptHash(scriptOther), 0, std::numeric_limits<int>::max(), nullptr, 1000, vPage, fMore));
+    BOOST_CHECK(vPage.empty());
+
+    scriptindex.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include <test/test_bitcoin.h>
 
+#include <blockencodings.h>
 #include <chainparams.h>
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
@@ -33,6 +34,22 @@ void CConnmanTest::ClearNodes()
     g_connman->vNodes.clear();
 }
 
+size_t CConnmanTest::SocketSendData(CConnman& connman, CNode& node)
+{
+    LOCK(node.cs_vSend);
+    return connman.SocketSendData(&node);
+}
+
+void CConnmanTest::StartMessageHandlers(CConnman& connman)
+{
+    connman.StartMessageHandlers();
+}
+
+void CConnmanTest::StopMessageHandlers(CConnman& connman)
+{
+    connman.StopMessageHandlers();
+}
+
 uint256 insecure_rand_seed = GetRandHash();
 FastRandomContext insecure_rand_ctx(insecure_rand_seed);
 
@@ -90,8 +107,10 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
             }
         }
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadShortIdScan);
+        }
         g_connman = std::unique_ptr<CConnman>(new CConnman(0x1337, 0x1337)); // Deterministic randomness for tests.
         connman = g_connman.get();
         peerLogic.reset(new PeerLogicValidation(connman, scheduler));
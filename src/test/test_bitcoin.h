@@ -53,6 +53,9 @@ class CNode;
 struct CConnmanTest {
     static void AddNode(CNode& node);
     static void ClearNodes();
+    static size_t SocketSendData(CConnman& connman, CNode& node);
+    static void StartMessageHandlers(CConnman& connman);
+    static void StopMessageHandlers(CConnman& connman);
 };
 
 class PeerLogicValidation;
@@ -0,0 +1,101 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <txindex.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txindex_tests, TestChain100Setup)
+
+static bool WaitUntilSynced(const CTxIndex& txindex)
+{
+    // The index catches up in the background
+    for (int i = 0; i < 1000 && !txindex.IsSynced(); i++) {
+        MilliSleep(10);
+    }
+    return txindex.IsSynced();
+}
+
+BOOST_AUTO_TEST_CASE(txindex_initial_sync)
+{
+    CTxIndex txindex(1 << 20, true);
+    CTransactionRef tx;
+    uint256 hashBlock;
+
+    // Nothing is indexed before the index is started, and lookups do not
+    // wait for it.
+    BOOST_CHECK(!txindex.FindTx(coinbaseTxns[0].GetHash(), hashBlock, tx));
+    BOOST_CHECK(!txindex.BlockUntilSyncedToCurrentChain());
+
+    txindex.Start();
+    BOOST_REQUIRE(WaitUntilSynced(txindex));
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(txindex.GetBestBlock() == chainActive.Tip());
+        for (size_t i = 0; i < coinbaseTxns.size(); i++) {
+            BOOST_REQUIRE(txindex.FindTx(coinbaseTxns[i].GetHash(), hashBlock, tx));
+            BOOST_CHECK(tx->GetHash() == coinbaseTxns[i].GetHash());
+            BOOST_CHECK(hashBlock == chainActive[i + 1]->GetBlockHash());
+        }
+    }
+    BOOST_CHECK(!txindex.FindTx(uint256S("01"), hashBlock, tx));
+
+    // Once synced, the index follows connected blocks...
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+    BOOST_REQUIRE(txindex.FindTx(block.vtx[0]->GetHash(), hashBlock, tx));
+    BOOST_CHECK(hashBlock == block.GetHash());
+
+    // ...and rewinds disconnected ones.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK(!txindex.FindTx(block.vtx[0]->GetHash(), hashBlock, tx));
+    BOOST_CHECK(txindex.FindTx(coinbaseTxns.back().GetHash(), hashBlock, tx));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(txindex.GetBestBlock() == chainActive.Tip());
+    }
+
+    txindex.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(txindex_resume)
+{
+    {
+        CTxIndex txindex(1 << 20, false, true);
+        txindex.Start();
+        BOOST_REQUIRE(WaitUntilSynced(txindex));
+        txindex.Stop();
+    }
+
+    // Blocks connected while the index is stopped are caught up with from
+    // where it left off.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock({}, scriptPubKey);
+
+    CTxIndex txindex(1 << 20);
+    txindex.Start();
+    BOOST_REQUIRE(WaitUntilSynced(txindex));
+    CTransactionRef tx;
+    uint256 hashBlock;
+    BOOST_CHECK(txindex.FindTx(coinbaseTxns[0].GetHash(), hashBlock, tx));
+    BOOST_REQUIRE(txindex.FindTx(block.vtx[0]->GetHash(), hashBlock, tx));
+    BOOST_CHECK(hashBlock == block.GetHash());
+    txindex.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
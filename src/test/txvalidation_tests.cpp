@@ -7,14 +7,35 @@
 #include <amount.h>
 #include <consensus/validation.h>
 #include <primitives/transaction.h>
+#include <script/interpreter.h>
 #include <script/script.h>
+#include <key.h>
 #include <test/test_bitcoin.h>
 
+#include <atomic>
+#include <thread>
+
 #include <boost/test/unit_test.hpp>
 
 
 BOOST_AUTO_TEST_SUITE(txvalidation_tests)
 
+/** Spend output n of txPrev, paid to key, into nOutputs outputs of nValue paying to it again. */
+static CMutableTransaction Spend(const CKey& key, const CTransaction& txPrev, uint32_t n, CAmount nValue, int nOutputs)
+{
+    const CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), n);
+    tx.vout.assign(nOutputs, CTxOut(nValue, scriptPubKey));
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
 /**
  * Ensure that the mempool won't accept coinbase transactions.
  */
@@ -58,4 +79,233 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(nDoS, 100);
 }
 
+/**
+ * Transactions accepted from several threads at once, with their scripts
+ * verified outside cs_main, end up in the mempool as if accepted one by one.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_concurrent, TestChain100Setup)
+{
+    // Split the mature coinbase into outputs for the others to spend.
+    const int nOutputs = 10;
+    CTransactionRef ptxSplit = MakeTransactionRef(Spend(coinbaseKey, coinbaseTxns[0], 0, coinbaseTxns[0].vout[0].nValue / nOutputs - CENT, nOutputs));
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, ptxSplit, nullptr, nullptr, false, 0));
+    }
+
+    // One transaction for each of the first eight outputs, and two
+    // conflicting ones for the ninth, only one of which can get in.
+    const CAmount nValue = ptxSplit->vout[0].nValue - CENT;
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < nOutputs - 1; i++) {
+        vtx.push_back(MakeTransactionRef(Spend(coinbaseKey, *ptxSplit, i, nValue, 1)));
+    }
+    vtx.push_back(MakeTransactionRef(Spend(coinbaseKey, *ptxSplit, nOutputs - 2, nValue - CENT, 1)));
+    // And one spending the last output with a signature that does not match.
+    CMutableTransaction txBadSig = Spend(coinbaseKey, *ptxSplit, nOutputs - 1, nValue, 1);
+    txBadSig.vout[0].nValue--;
+    vtx.push_back(MakeTransactionRef(txBadSig));
+
+    std::vector<CValidationState> vState(vtx.size());
+    std::atomic<int> nAccepted(0);
+    std::atomic<int> nMissingInputs(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        threads.emplace_back([&, i] {
+            bool fMissingInputs = false;
+            if (AcceptToMemoryPoolConcurrent(mempool, vState[i], vtx[i], &fMissingInputs, nullptr, false, 0))
+                nAccepted++;
+            if (fMissingInputs)
+                nMissingInputs++;
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    BOOST_CHECK_EQUAL(nMissingInputs, 0);
+
+    BOOST_CHECK_EQUAL(nAccepted, nOutputs - 1);
+    BOOST_CHECK_EQUAL(mempool.size(), (unsigned int)nOutputs);
+    for (int i = 0; i < nOutputs - 2; i++) {
+        BOOST_CHECK(mempool.exists(vtx[i]->GetHash()));
+    }
+    const bool fFirstIn = mempool.exists(vtx[nOutputs - 2]->GetHash());
+    BOOST_CHECK(fFirstIn != mempool.exists(vtx[nOutputs - 1]->GetHash()));
+    BOOST_CHECK_EQUAL(vState[fFirstIn ? nOutputs - 1 : nOutputs - 2].GetRejectReason(), "txn-mempool-conflict");
+
+    int nDoS = 0;
+    BOOST_CHECK(!mempool.exists(txBadSig.GetHash()));
+    BOOST_CHECK(vState.back().IsInvalid(nDoS));
+    BOOST_CHECK_EQUAL(nDoS, 100);
+    BOOST_CHECK_EQUAL(vState.back().GetRejectReason().find("mandatory-script-verify-flag-failed"), 0U);
+
+    // The same transaction from several threads at once is accepted once,
+    // and the threads that lost the race find it in the mempool already,
+    // early or late.
+    const CTransactionRef ptxSpend = MakeTransactionRef(Spend(coinbaseKey, *vtx[0], 0, nValue - CENT, 1));
+    std::vector<CValidationState> vStateSame(8);
+    threads.clear();
+    for (size_t i = 0; i < vStateSame.size(); i++) {
+        threads.emplace_back([&, i] {
+            bool fMissingInputs = false;
+            AcceptToMemoryPoolConcurrent(mempool, vStateSame[i], ptxSpend, &fMissingInputs, nullptr, false, 0);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    BOOST_CHECK(mempool.exists(ptxSpend->GetHash()));
+    for (const CValidationState& stateSame : vStateSame) {
+        BOOST_CHECK(stateSame.IsValid() || stateSame.GetRejectReason() == "txn-already-in-mempool");
+    }
+
+    // Transactions spending unknown outputs are reported as missing inputs.
+    CValidationState state;
+    bool fMissingInputs = false;
+    BOOST_CHECK(!AcceptToMemoryPoolConcurrent(mempool, state, MakeTransactionRef(Spend(coinbaseKey, *vtx[0], 1, nValue, 1)), &fMissingInputs, nullptr, false, 0));
+    BOOST_CHECK(fMissingInputs);
+    BOOST_CHECK(state.IsValid());
+
+    LOCK(cs_main);
+    mempool.check(pcoinsTip.get());
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_package, TestChain100Setup)
+{
+    // A chain of four transactions off the mature coinbase, and off its
+    // second output one with a bad signature and a child of that one.
+    const CAmount nValue = coinbaseTxns[0].vout[0].nValue / 2 - CENT;
+    std::vector<CTransactionRef> vChain{MakeTransactionRef(Spend(coinbaseKey, coinbaseTxns[0], 0, nValue, 2))};
+    for (int i = 1; i < 4; i++) {
+        vChain.push_back(MakeTransactionRef(Spend(coinbaseKey, *vChain.back(), 0, nValue - i * CENT, 1)));
+    }
+    CMutableTransaction txBadSig = Spend(coinbaseKey, *vChain[0], 1, nValue - CENT, 1);
+    txBadSig.vout[0].nValue--;
+    const CTransactionRef ptxBadSig = MakeTransactionRef(txBadSig);
+    const CTransactionRef ptxBadChild = MakeTransactionRef(Spend(coinbaseKey, *ptxBadSig, 0, nValue - 3 * CENT, 1));
+
+    // Submitted children first, the package is still accepted in full, and
+    // the results come back in the order given.
+    const std::vector<CTransactionRef> vtx{ptxBadChild, vChain[3], vChain[2], ptxBadSig, vChain[1], vChain[0]};
+    const std::vector<PackageTxResult> vResults = AcceptPackageToMemoryPool(mempool, vtx, false, 0);
+    BOOST_REQUIRE_EQUAL(vResults.size(), vtx.size());
+
+    for (size_t i : {1, 2, 4, 5}) {
+        BOOST_CHECK(vResults[i].fAccepted);
+        BOOST_CHECK(vResults[i].state.IsValid());
+        BOOST_CHECK(mempool.exists(vtx[i]->GetHash()));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), vChain.size());
+
+    int nDoS = 0;
+    BOOST_CHECK(!vResults[3].fAccepted);
+    BOOST_CHECK(vResults[3].state.IsInvalid(nDoS));
+    BOOST_CHECK_EQUAL(nDoS, 100);
+
+    BOOST_CHECK(!vResults[0].fAccepted);
+    BOOST_CHECK(vResults[0].fMissingInputs);
+    BOOST_CHECK(vResults[0].state.IsValid());
+
+    // Submitting it again finds the chain in the mempool already.
+    const std::vector<PackageTxResult> vAgain = AcceptPackageToMemoryPool(mempool, {vChain[0]}, false, 0);
+    BOOST_CHECK(!vAgain[0].fAccepted);
+    BOOST_CHECK_EQUAL(vAgain[0].state.GetRejectReason(), "txn-already-in-mempool");
+
+    LOCK(cs_main);
+    mempool.check(pcoinsTip.get());
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_preverify, TestChain100Setup)
+{
+    // A chain of four transactions off the mature coinbase. Off the other
+    // outputs of the first, one paying no fee with a child, and one with a
+    // dust output.
+    const CAmount nValue = coinbaseTxns[0].vout[0].nValue / 3 - CENT;
+    std::vector<CTransactionRef> vChain{MakeTransactionRef(Spend(coinbaseKey, coinbaseTxns[0], 0, nValue, 3))};
+    for (int i = 1; i < 4; i++) {
+        vChain.push_back(MakeTransactionRef(Spend(coinbaseKey, *vChain.back(), 0, nValue - i * CENT, 1)));
+    }
+    const CTransactionRef ptxNoFee = MakeTransactionRef(Spend(coinbaseKey, *vChain[0], 1, nValue, 1));
+    const CTransactionRef ptxNoFeeChild = MakeTransactionRef(Spend(coinbaseKey, *ptxNoFee, 0, nValue - CENT, 1));
+    const CTransactionRef ptxDust = MakeTransactionRef(Spend(coinbaseKey, *vChain[0], 2, 1, 1));
+
+    LOCK(cs_main);
+
+    // Only the chain passes the policy checks; the rest is not verified.
+    std::vector<CTransactionRef> vtx(vChain);
+    vtx.insert(vtx.end(), {ptxNoFee, ptxNoFeeChild, ptxDust});
+    BOOST_CHECK_EQUAL(PreverifyTransactionScripts(mempool, vtx, false, 0), vChain.size());
+
+    // Unless fees do not matter, and then the child of the one paying none
+    // is verified too.
+    BOOST_CHECK_EQUAL(PreverifyTransactionScripts(mempool, vtx, true, 0), vChain.size() + 2);
+
+    // An absurd fee on the first leaves out the whole package.
+    BOOST_CHECK_EQUAL(PreverifyTransactionScripts(mempool, vtx, false, 2 * CENT), 0U);
+
+    // Inputs are found in the mempool too, and what it has already is left out.
+    CValidationState state;
+    BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, vChain[0], nullptr, nullptr, false, 0));
+    BOOST_CHECK_EQUAL(PreverifyTransactionScripts(mempool, vtx, false, 0), vChain.size() - 1);
+
+    // Accepting them after gives the same results as without.
+    for (size_t i = 1; i < vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(AcceptToMemoryPool(mempool, state, vtx[i], nullptr, nullptr, false, 0), i < vChain.size());
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), vChain.size());
+    mempool.check(pcoinsTip.get());
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_load, TestChain100Setup)
+{
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    // Confirm a split of the mature coinbase, and hang a chain as long as
+    // the ancestor limit allows off each of its outputs. That is more
+    // transactions than are loaded in one batch.
+    const int nChains = 25;
+    const int nChainLength = 24;
+    const CMutableTransaction txSplit = Spend(coinbaseKey, coinbaseTxns[0], 0, coinbaseTxns[0].vout[0].nValue / nChains - CENT, nChains);
+    CreateAndProcessBlock({txSplit}, scriptPubKey);
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < nChains; i++) {
+        CTransactionRef ptx = MakeTransactionRef(Spend(coinbaseKey, txSplit, i, txSplit.vout[i].nValue - CENT, 1));
+        vtx.push_back(ptx);
+        for (int j = 1; j < nChainLength; j++) {
+            ptx = MakeTransactionRef(Spend(coinbaseKey, *ptx, 0, ptx->vout[0].nValue - CENT, 1));
+            vtx.push_back(ptx);
+        }
+    }
+    {
+        LOCK(cs_main);
+        for (const CTransactionRef& ptx : vtx) {
+            CValidationState state;
+            BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, ptx, nullptr, nullptr, false, 0));
+        }
+    }
+    const uint256 hashPrioritised = vtx[nChainLength + 1]->GetHash();
+    mempool.PrioritiseTransaction(hashPrioritised, 5 * CENT);
+    std::map<uint256, int64_t> mapTime;
+    for (const CTransactionRef& ptx : vtx) {
+        mapTime[ptx->GetHash()] = mempool.info(ptx->GetHash()).nTime;
+    }
+
+    BOOST_REQUIRE(DumpMempool());
+    mempool.clear();
+    mempool.ClearPrioritisation(hashPrioritised);
+    BOOST_REQUIRE(LoadMempool());
+
+    // Everything is back, with the time it first entered and its delta.
+    BOOST_CHECK_EQUAL(mempool.size(), vtx.size());
+    for (const CTransactionRef& ptx : vtx) {
+        BOOST_CHECK(mempool.exists(ptx->GetHash()));
+        BOOST_CHECK_EQUAL(mempool.info(ptx->GetHash()).nTime, mapTime[ptx->GetHash()]);
+    }
+    CAmount nDelta = 0;
+    mempool.ApplyDelta(hashPrioritised, nDelta);
+    BOOST_CHECK_EQUAL(nDelta, 5 * CENT);
+
+    LOCK(cs_main);
+    mempool.check(pcoinsTip.get());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
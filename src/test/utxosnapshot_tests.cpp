@@ -0,0 +1,211 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <clientversion.h>
+#include <coins.h>
+#include <streams.h>
+#include <txdb.h>
+#include <utxosnapshot.h>
+#include <test/test_bitcoin.h>
+
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, TestingSetup)
+
+static void WriteSnapshot(CCoinsViewDB& view, const fs::path& path, SnapshotMetadata& metadata, uint256& hashContents)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    BOOST_REQUIRE(WriteUTXOSnapshot(*pcursor, file, metadata, hashContents));
+}
+
+BOOST_AUTO_TEST_CASE(utxosnapshot_roundtrip)
+{
+    const uint256 hashBase = InsecureRand256();
+    std::map<COutPoint, Coin> coins;
+
+    // Populate a chainstate with a mix of transactions with one and with
+    // several unspent outputs.
+    CCoinsViewDB source(1 << 20, true);
+    {
+        CCoinsViewCache cache(&source);
+        for (int i = 0; i < 200; ++i) {
+            uint256 txid = InsecureRand256();
+            int nOutputs = 1 + InsecureRandRange(4);
+            for (int n = 0; n < nOutputs; ++n) {
+                Coin coin;
+                coin.out.nValue = InsecureRandRange(MAX_MONEY);
+                coin.out.scriptPubKey.assign(1 + InsecureRandBits(5), OP_TRUE);
+                coin.nHeight = InsecureRandRange(1000);
+                coin.fCoinBase = InsecureRandBool();
+                COutPoint outpoint(txid, InsecureRand32());
+                coins[outpoint] = coin;
+                cache.AddCoin(outpoint, std::move(coin), false);
+            }
+        }
+        cache.SetBestBlock(hashBase);
+        BOOST_REQUIRE(cache.Flush());
+    }
+
+    const fs::path path = GetDataDir() / "utxo.dat";
+    SnapshotMetadata metadata;
+    metadata.nBaseHeight = 1000;
+    uint256 hashContents;
+    WriteSnapshot(source, path, metadata, hashContents);
+    BOOST_CHECK_EQUAL(metadata.nCoinsCount, coins.size());
+    BOOST_CHECK(metadata.hashBaseBlock == hashBase);
+
+    std::string strError;
+
+    // A snapshot with an unexpected content hash is rejected before anything is written.
+    {
+        CCoinsViewDB target(1 << 20, true);
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        SnapshotMetadata loaded;
+        BOOST_CHECK(!LoadUTXOSnapshot(file, target, InsecureRand256(), loaded, strError));
+        BOOST_CHECK(target.GetBestBlock().IsNull());
+    }
+
+    // Only snapshots listed in the chain parameters are accepted.
+    {
+        CCoinsViewDB target(1 << 20, true);
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        SnapshotMetadata loaded;
+        BOOST_CHECK(!LoadUTXOSnapshot(file, target, Params(), loaded, strError));
+        BOOST_CHECK(target.GetBestBlock().IsNull());
+
+        // Listed in a copy of the parameters, so later tests see the real ones.
+        std::unique_ptr<CChainParams> params = CreateChainParams(Params().NetworkIDString());
+        AssumeutxoData data;
+        data.hashContents = hashContents;
+        data.nChainTx = 0;
+        params->UpdateAssumeutxo(hashBase, data);
+        CAutoFile file2(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK_MESSAGE(LoadUTXOSnapshot(file2, target, *params, loaded, strError), strError);
+        BOOST_CHECK(target.GetBestBlock() == hashBase);
+    }
+
+    // A matching snapshot is loaded completely.
+    {
+        CCoinsViewDB target(1 << 20, true);
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        SnapshotMetadata loaded;
+        BOOST_CHECK_MESSAGE(LoadUTXOSnapshot(file, target, hashContents, loaded, strError), strError);
+        BOOST_CHECK(target.GetBestBlock() == hashBase);
+        BOOST_CHECK_EQUAL(loaded.nCoinsCount, coins.size());
+        BOOST_CHECK_EQUAL(loaded.nBaseHeight, 1000);
+        for (const auto& entry : coins) {
+            Coin coin;
+            BOOST_CHECK(target.GetCoin(entry.first, coin));
+            BOOST_CHECK(coin.out == entry.second.out);
+            BOOST_CHECK_EQUAL(coin.nHeight, entry.second.nHeight);
+            BOOST_CHECK_EQUAL(coin.fCoinBase, entry.second.fCoinBase);
+        }
+
+        // Loading into a non-empty chainstate is refused.
+        CAutoFile file2(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!LoadUTXOSnapshot(file2, target, hashContents, loaded, strError));
+
+        // Dumping the loaded chainstate again yields the same contents.
+        SnapshotMetadata metadata2;
+        metadata2.nBaseHeight = 1000;
+        uint256 hashContents2;
+        WriteSnapshot(target, GetDataDir() / "utxo2.dat", metadata2, hashContents2);
+        BOOST_CHECK(hashContents2 == hashContents);
+    }
+
+    // Corrupting a byte of the contents is detected.
+    {
+        FILE* f = fsbridge::fopen(path, "r+b");
+        BOOST_REQUIRE(f);
+        BOOST_REQUIRE(fseek(f, 100, SEEK_SET) == 0);
+        int c = fgetc(f);
+        BOOST_REQUIRE(fseek(f, 100, SEEK_SET) == 0);
+        fputc(c ^ 1, f);
+        fclose(f);
+
+        CCoinsViewDB target(1 << 20, true);
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        SnapshotMetadata loaded;
+        BOOST_CHECK(!LoadUTXOSnapshot(file, target, hashContents, loaded, strError));
+        BOOST_CHECK(target.GetBestBlock().IsNull());
+    }
+}
+
+/** A coins view whose writes for one block fail. */
+class CCoinsViewFailingWrite : public CCoinsViewBacked
+{
+public:
+    uint256 hashFail;
+
+    explicit CCoinsViewFailingWrite(CCoinsView* viewIn) : CCoinsViewBacked(viewIn) {}
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase) override
+    {
+        if (hashBlock == hashFail)
+            return false;
+        return CCoinsViewBacked::BatchWrite(mapCoins, hashBlock, fErase);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(utxosnapshot_interrupted_load)
+{
+    // Enough coins for the load to write more than one batch
+    const uint256 hashBase = InsecureRand256();
+    CCoinsViewDB source(1 << 23, true);
+    {
+        CCoinsViewCache cache(&source);
+        for (unsigned int i = 0; i <= UTXO_SNAPSHOT_LOAD_BATCH_SIZE; ++i) {
+            Coin coin;
+            coin.out.nValue = 1 + i;
+            coin.out.scriptPubKey.assign(1, OP_TRUE);
+            coin.nHeight = 1;
+            cache.AddCoin(COutPoint(InsecureRand256(), 0), std::move(coin), false);
+        }
+        cache.SetBestBlock(hashBase);
+        BOOST_REQUIRE(cache.Flush());
+    }
+    const fs::path path = GetDataDir() / "utxo.dat";
+    SnapshotMetadata metadata;
+    uint256 hashContents;
+    WriteSnapshot(source, path, metadata, hashContents);
+
+    // The last write fails, after the first batch made it to the database.
+    CCoinsViewDB target(1 << 23, true);
+    CCoinsViewFailingWrite failing(&target);
+    failing.hashFail = hashBase;
+    std::string strError;
+    SnapshotMetadata loaded;
+    {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!LoadUTXOSnapshot(file, failing, hashContents, loaded, strError));
+    }
+    std::unique_ptr<CCoinsViewCursor> pcursor(target.Cursor());
+    BOOST_CHECK(pcursor->Valid());
+
+    // The partial coins are not taken for the UTXO set of the base block,
+    // and a retry asks for the database to be wiped.
+    BOOST_CHECK(target.GetBestBlock() != hashBase);
+    BOOST_CHECK(IsSnapshotLoadIncomplete(target));
+    {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!LoadUTXOSnapshot(file, target, hashContents, loaded, strError));
+        BOOST_CHECK(strError.find("interrupted") != std::string::npos);
+    }
+
+    // A complete load is not incomplete.
+    CCoinsViewDB target2(1 << 23, true);
+    {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK_MESSAGE(LoadUTXOSnapshot(file, target2, hashContents, loaded, strError), strError);
+    }
+    BOOST_CHECK(target2.GetBestBlock() == hashBase);
+    BOOST_CHECK(!IsSnapshotLoadIncomplete(target2));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txindex.h>
+
+#include <chain.h>
+#include <clientversion.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+
+static const char DB_TXINDEX = 't';
+
+std::shared_ptr<CTxIndex> g_txindex;
+
+class CTxIndex::DB : public CBaseIndex::DB
+{
+public:
+    DB(size_t nCacheSize, bool fMemory, bool fWipe)
+        : CBaseIndex::DB(GetDataDir() / "indexes" / "txindex", nCacheSize, fMemory, fWipe)
+    {
+    }
+
+    bool ReadTxPos(const uint256& txid, CDiskTxPos& pos) const
+    {
+        return Read(std::make_pair(DB_TXINDEX, txid), pos);
+    }
+};
+
+CTxIndex::CTxIndex(size_t nCacheSize, bool fMemory, bool fWipe) : db(new CTxIndex::DB(nCacheSize, fMemory, fWipe))
+{
+}
+
+CTxIndex::~CTxIndex()
+{
+    // Stop the sync thread while the database is still there.
+    Stop();
+}
+
+bool CTxIndex::WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex)
+{
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    for (const CTransactionRef& tx : block.vtx) {
+        batch.Write(std::make_pair(DB_TXINDEX, tx->GetHash()), pos);
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    return true;
+}
+
+bool CTxIndex::RewindBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex)
+{
+    for (const CTransactionRef& tx : block.vtx) {
+        batch.Erase(std::make_pair(DB_TXINDEX, tx->GetHash()));
+    }
+    return true;
+}
+
+CBaseIndex::DB& CTxIndex::GetDB() const
+{
+    return *db;
+}
+
+bool CTxIndex::FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const
+{
+    CDiskTxPos postx;
+    if (!db->ReadTxPos(txid, postx))
+        return false;
+
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+    CBlockHeader header;
+    try {
+        file >> header;
+        if (fseek(file.Get(), postx.nTxOffset, SEEK_CUR))
+            return error("%s: fseek(...) failed", __func__);
+        file >> tx;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (tx->GetHash() != txid)
+        return error("%s: txid mismatch", __func__);
+    hashBlock = header.GetHash();
+    return true;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXINDEX_H
+#define BITCOIN_TXINDEX_H
+
+#include <baseindex.h>
+#include <primitives/transaction.h>
+#include <uint256.h>
+
+#include <memory>
+
+struct CDiskTxPos;
+
+//! Max memory allocated to the transaction index database cache (MiB)
+// Unlike for the UTXO database, for the txindex scenario the leveldb cache make
+// a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
+static const int64_t nMaxTxIndexCache = 1024;
+
+/**
+ * Index of the position on disk of every transaction in the active chain, by
+ * txid (indexes/txindex/). It is built in the background, see CBaseIndex, so
+ * it can be enabled or disabled without a reindex.
+ */
+class CTxIndex final : public CBaseIndex
+{
+private:
+    class DB;
+    const std::unique_ptr<DB> db;
+
+protected:
+    bool WriteBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex) override;
+    bool RewindBlock(CDBBatch& batch, const CBlock& block, const CBlockIndex* pindex) override;
+    CBaseIndex::DB& GetDB() const override;
+    const char* GetName() const override { return "txindex"; }
+
+public:
+    explicit CTxIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CTxIndex() override;
+
+    /** Look up a transaction in the index, reading it from its block file. */
+    bool FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const;
+};
+
+/**
+ * The transaction index, if enabled (protected by cs_main). Shared so that
+ * callers can wait for it to sync without holding cs_main while it may be
+ * disabled at runtime.
+ */
+extern std::shared_ptr<CTxIndex> g_txindex;
+
+#endif // BITCOIN_TXINDEX_H
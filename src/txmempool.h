@@ -6,6 +6,8 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
+#include <functional>
 #include <memory>
 #include <set>
 #include <map>
@@ -16,7 +18,9 @@
 #include <amount.h>
 #include <coins.h>
 #include <indirectmap.h>
+#include <policy/feehistogram.h>
 #include <policy/feerate.h>
+#include <prevector.h>
 #include <primitives/transaction.h>
 #include <sync.h>
 #include <random.h>
@@ -63,6 +67,10 @@ class CTxMemPool;
 
 class CTxMemPoolEntry
 {
+public:
+    //! In-mempool direct parents or children of an entry
+    typedef prevector<2, const CTxMemPoolEntry*> Links;
+
 private:
     CTransactionRef tx;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
@@ -89,6 +97,14 @@ private:
     CAmount nModFeesWithAncestors;
     int64_t nSigOpCostWithAncestors;
 
+    // In-mempool direct parents and children, kept up to date by CTxMemPool.
+    // Few transactions have more than two of either, so these rarely need an
+    // allocation of their own.
+    mutable Links vMemPoolParents;
+    mutable Links vMemPoolChildren;
+
+    friend class CTxMemPool;
+
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                     int64_t _nTime, unsigned int _entryHeight,
@@ -131,6 +147,7 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t m_epoch; //!< Epoch of the mempool traversal that visited this entry last
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -341,6 +358,61 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * A transaction queued for announcement to peers, see CTxMemPool::QueueForRelay.
+ * The ancestor count and fee are those at the time it was queued.
+ */
+struct RelayQueueEntry
+{
+    uint64_t nSequence;
+    uint64_t nCountWithAncestors;
+    CAmount nFee;
+    size_t nTxSize;
+    uint256 hash;
+};
+
+/** \class CompareRelayQueueEntry
+ *
+ *  Sort queued transactions in the order they are announced in: fewest
+ *  ancestors first, so that parents go before their children, then by
+ *  fee rate like CompareTxMemPoolEntryByScore.
+ */
+class CompareRelayQueueEntry
+{
+public:
+    bool operator()(const RelayQueueEntry& a, const RelayQueueEntry& b) const
+    {
+        if (a.nCountWithAncestors != b.nCountWithAncestors) {
+            return a.nCountWithAncestors < b.nCountWithAncestors;
+        }
+        double f1 = (double)a.nFee * b.nTxSize;
+        double f2 = (double)b.nFee * a.nTxSize;
+        if (f1 != f2) {
+            return f1 > f2;
+        }
+        if (a.hash != b.hash) {
+            return b.hash < a.hash;
+        }
+        return a.nSequence < b.nSequence;
+    }
+};
+
+/**
+ * A peer's position in the relay queue, see CTxMemPool::ForEachQueuedForRelay.
+ * The transactions queued up to nSequence have all been gone through. Those
+ * queued after it, up to nPassSequence, are copied to vPass in the order to
+ * announce them in, and gone through up to nPassPos.
+ */
+struct RelayQueueCursor
+{
+    uint64_t nSequence;
+    uint64_t nPassSequence;
+    std::vector<RelayQueueEntry> vPass;
+    size_t nPassPos;
+
+    explicit RelayQueueCursor(uint64_t nSequenceIn = 0) : nSequence(nSequenceIn), nPassSequence(nSequenceIn), nPassPos(0) {}
+};
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -395,8 +467,8 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
- * each CTxMemPoolEntry, we track the size and fees of all descendants.
+ * the in-mempool direct parents and direct children of each CTxMemPoolEntry,
+ * along with the size and fees of all its descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan).  So in
@@ -428,7 +500,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the parent and child links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -449,11 +521,15 @@ private:
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes. Differs from serialized tx size since witness data is discounted. Defined in BIP 141.
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    CFeeRateHistogram feeHistogram; //!< number, size and fees of the mempool txs by feerate
 
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    uint64_t nRelaySequence; //!< Sequence number of the transaction queued for relay last
+    std::deque<RelayQueueEntry> relayQueue; //!< Transactions queued for relay, by sequence number
+
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -498,26 +574,46 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    typedef std::vector<txiter> vecEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const CTxMemPoolEntry::Links & GetMemPoolParents(txiter entry) const;
+    const CTxMemPoolEntry::Links & GetMemPoolChildren(txiter entry) const;
 private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
-
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
-    };
-
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    typedef std::map<txiter, vecEntries, CompareIteratorByHash> cacheMap;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
+    mutable uint64_t m_epoch;
+    mutable bool m_has_epoch_guard;
+
 public:
+    /**
+     * Starts a new mempool graph traversal, during which visited() reports
+     * every entry as new only once. Marking entries this way replaces the
+     * sets of seen entries a traversal would otherwise build. Traversals
+     * cannot be nested, so at most one guard exists at a time; cs must be
+     * held for as long as it does.
+     */
+    class EpochGuard {
+    public:
+        explicit EpochGuard(const CTxMemPool& in);
+        ~EpochGuard();
+    private:
+        const CTxMemPool& pool;
+    };
+
+    /** Mark it as visited by the current traversal. Returns whether it already was. */
+    bool visited(txiter it) const
+    {
+        assert(m_has_epoch_guard);
+        bool ret = it->m_epoch == m_epoch;
+        it->m_epoch = m_epoch;
+        return ret;
+    }
+
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
     std::map<uint256, CAmount> mapDeltas;
 
@@ -542,7 +638,7 @@ public:
     // and any other callers may break wallet's in-mempool tracking (due to
     // lack of CValidationInterface::TransactionAddedToMempool callbacks).
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool validFeeEstimate = true);
-    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool validFeeEstimate = true);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, const vecEntries &vAncestors, bool validFeeEstimate = true);
 
     void removeRecursive(const CTransaction &tx, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
@@ -596,14 +692,22 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up the parents linked to the entry. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
+    /** As above, but vAncestors is replaced by the ancestors in the order
+     *  they are found, parents first. Walks the mempool with an EpochGuard,
+     *  so cannot be called during another traversal. */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, vecEntries &vAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
     void CalculateDescendants(txiter it, setEntries &setDescendants);
+    /** Replace vDescendants by it followed by all its in-mempool descendants.
+     *  Walks the mempool with an EpochGuard, so cannot be called during
+     *  another traversal. */
+    void CalculateDescendants(txiter it, vecEntries &vDescendants) const;
 
     /** The minimum fee to get into the mempool, which may itself not be enough
       *  for larger-sized transactions.
@@ -637,6 +741,13 @@ public:
         return totalTxSize;
     }
 
+    /** The mempool transactions by their own feerate, without prioritisation. */
+    std::vector<CFeeRateHistogram::Bucket> GetFeeHistogram() const
+    {
+        LOCK(cs);
+        return feeHistogram.GetBuckets();
+    }
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
@@ -647,6 +758,29 @@ public:
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
+    /**
+     * Queue a transaction for announcement to all peers. Rather than each
+     * peer keeping a set of the transactions it has to announce, they are
+     * queued here once, and every peer goes through the ones queued since it
+     * last looked. Returns false if hash is not in the mempool.
+     */
+    bool QueueForRelay(const uint256& hash);
+    /** Sequence number of the transaction queued for relay last. */
+    uint64_t GetRelaySequence() const;
+    /**
+     * Call func, in the order to announce them in, for the transactions
+     * queued for relay after cursor that are still in the mempool. Stops
+     * when func returns false, and the next call continues after the last
+     * transaction func took. Once all transactions queued when the pass
+     * started are done, cursor.nSequence is moved past them. Only those are
+     * looked at and sorted, not the whole queue.
+     */
+    void ForEachQueuedForRelay(RelayQueueCursor& cursor, const std::function<bool(const TxMempoolInfo&)>& func);
+    /** Forget the transactions queued for relay up to nSequence. */
+    void TrimRelayQueue(uint64_t nSequence);
+    /** Memory used by the relay queue, which is not counted in DynamicMemoryUsage(). */
+    size_t RelayQueueDynamicMemoryUsage() const;
+
     size_t DynamicMemoryUsage() const;
 
     boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
@@ -670,9 +804,9 @@ private:
             cacheMap &cachedDescendants,
             const std::set<uint256> &setExclude);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
-    void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
+    void UpdateAncestorsOf(bool add, txiter hash, const vecEntries &vAncestors);
     /** Set ancestor state for an entry */
-    void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors);
+    void UpdateEntryForAncestors(txiter it, const vecEntries &vAncestors);
     /** For each transaction being removed, update ancestors and any direct children.
       * If updateDescendants is true, then also update in-mempool descendants'
       * ancestor state. */
@@ -0,0 +1,140 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txorphanpool.h>
+
+#include <random.h>
+
+bool CTxOrphanPool::Add(const CTransactionRef& tx, NodeId peer, int64_t nTimeExpire)
+{
+    if (!setOrphans.insert(COrphanTx{tx, peer, nTimeExpire}).second)
+        return false;
+    for (const CTxIn& txin : tx->vin) {
+        mapOrphansByPrev[txin.prevout].insert(tx->GetHash());
+    }
+    return true;
+}
+
+bool CTxOrphanPool::Have(const uint256& hash) const
+{
+    return setOrphans.count(hash) != 0;
+}
+
+int CTxOrphanPool::Erase(const uint256& hash)
+{
+    auto it = setOrphans.find(hash);
+    if (it == setOrphans.end())
+        return 0;
+    for (const CTxIn& txin : it->tx->vin) {
+        auto itPrev = mapOrphansByPrev.find(txin.prevout);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        itPrev->second.erase(hash);
+        if (itPrev->second.empty())
+            mapOrphansByPrev.erase(itPrev);
+    }
+    setOrphans.erase(it);
+    return 1;
+}
+
+int CTxOrphanPool::EraseForPeer(NodeId peer)
+{
+    auto& index = setOrphans.get<orphan_peer>();
+    int nErased = 0;
+    auto it = index.find(peer);
+    while (it != index.end() && it->fromPeer == peer) {
+        const uint256 hash = (it++)->tx->GetHash(); // increment to avoid iterator becoming invalid
+        nErased += Erase(hash);
+    }
+    return nErased;
+}
+
+int CTxOrphanPool::EraseForBlock(const CBlock& block)
+{
+    std::vector<uint256> vOrphanErase;
+    for (const CTransactionRef& ptx : block.vtx) {
+        for (const CTxIn& txin : ptx->vin) {
+            auto itByPrev = mapOrphansByPrev.find(txin.prevout);
+            if (itByPrev == mapOrphansByPrev.end())
+                continue;
+            vOrphanErase.insert(vOrphanErase.end(), itByPrev->second.begin(), itByPrev->second.end());
+        }
+    }
+    int nErased = 0;
+    for (const uint256& hash : vOrphanErase) {
+        nErased += Erase(hash);
+    }
+    return nErased;
+}
+
+int CTxOrphanPool::EraseExpired(int64_t nNow)
+{
+    auto& index = setOrphans.get<orphan_expiry>();
+    int nErased = 0;
+    while (!index.empty() && index.begin()->nTimeExpire <= nNow) {
+        nErased += Erase(index.begin()->tx->GetHash());
+    }
+    return nErased;
+}
+
+int CTxOrphanPool::LimitSize(size_t nMaxOrphans)
+{
+    int nEvicted = 0;
+    while (setOrphans.size() > nMaxOrphans) {
+        // Evict a random orphan:
+        auto it = setOrphans.lower_bound(GetRandHash());
+        if (it == setOrphans.end())
+            it = setOrphans.begin();
+        nEvicted += Erase(it->tx->GetHash());
+    }
+    return nEvicted;
+}
+
+std::vector<COrphanTx> CTxOrphanPool::GetDescendants(const CTransaction& tx) const
+{
+    // Walk the spends from tx down, noting for every orphan found which
+    // orphans spend it and how many of the ones it spends were found.
+    std::map<uint256, std::vector<uint256>> mapSpenders;
+    std::map<uint256, int> mapParentsLeft;
+    std::vector<uint256> vWork{tx.GetHash()};
+    while (!vWork.empty()) {
+        const uint256 hash = vWork.back();
+        vWork.pop_back();
+        std::set<uint256> setSpenders;
+        for (auto it = mapOrphansByPrev.lower_bound(COutPoint(hash, 0)); it != mapOrphansByPrev.end() && it->first.hash == hash; ++it) {
+            setSpenders.insert(it->second.begin(), it->second.end());
+        }
+        for (const uint256& spender : setSpenders) {
+            mapSpenders[hash].push_back(spender);
+            if (mapParentsLeft[spender]++ == 0) {
+                vWork.push_back(spender);
+            }
+        }
+    }
+
+    // Then hand out every orphan once all of those it spends have been.
+    std::vector<COrphanTx> vOrphans;
+    vOrphans.reserve(mapParentsLeft.size());
+    std::vector<uint256> vReady{tx.GetHash()};
+    while (!vReady.empty()) {
+        const uint256 hash = vReady.back();
+        vReady.pop_back();
+        auto itSpenders = mapSpenders.find(hash);
+        if (itSpenders == mapSpenders.end())
+            continue;
+        for (const uint256& spender : itSpenders->second) {
+            if (--mapParentsLeft[spender] == 0) {
+                vOrphans.push_back(*setOrphans.find(spender));
+                vReady.push_back(spender);
+            }
+        }
+    }
+    return vOrphans;
+}
+
+void CTxOrphanPool::Clear()
+{
+    setOrphans.clear();
+    mapOrphansByPrev.clear();
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXORPHANPOOL_H
+#define BITCOIN_TXORPHANPOOL_H
+
+#include <net.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+/** A transaction we are missing inputs for, kept until its parents show up. */
+struct COrphanTx {
+    CTransactionRef tx;
+    NodeId fromPeer;
+    int64_t nTimeExpire;
+};
+
+/**
+ * Transactions we are missing inputs for, indexed by txid, by expiry time,
+ * by the peer they came from and by the outpoints they spend. Expiring or
+ * evicting an orphan, and forgetting those of a peer, take logarithmic time
+ * per orphan erased instead of a scan over the whole pool.
+ *
+ * Not thread-safe; callers provide their own locking.
+ */
+class CTxOrphanPool
+{
+public:
+    /** Add an orphan received from peer. Returns false if it is already present. */
+    bool Add(const CTransactionRef& tx, NodeId peer, int64_t nTimeExpire);
+    bool Have(const uint256& hash) const;
+    /** Remove an orphan. Returns the number of orphans removed (0 or 1). */
+    int Erase(const uint256& hash);
+    /** Remove the orphans received from peer. */
+    int EraseForPeer(NodeId peer);
+    /** Remove the orphans that spend an output also spent in block, including those in it. */
+    int EraseForBlock(const CBlock& block);
+    /** Remove the orphans that expire at or before nNow. */
+    int EraseExpired(int64_t nNow);
+    /** Remove random orphans until at most nMaxOrphans are left. */
+    int LimitSize(size_t nMaxOrphans);
+
+    /**
+     * The orphans spending outputs of tx, directly or through other orphans,
+     * ordered so that every one comes after the orphans it spends from.
+     */
+    std::vector<COrphanTx> GetDescendants(const CTransaction& tx) const;
+
+    size_t size() const { return setOrphans.size(); }
+    void Clear();
+
+private:
+    struct orphan_txid
+    {
+        typedef uint256 result_type;
+        result_type operator()(const COrphanTx& orphan) const { return orphan.tx->GetHash(); }
+    };
+    struct orphan_expiry {};
+    struct orphan_peer {};
+
+    typedef boost::multi_index_container<
+        COrphanTx,
+        boost::multi_index::indexed_by<
+            // sorted by txid, which lets us pick a random orphan to evict
+            boost::multi_index::ordered_unique<orphan_txid>,
+            // sorted by expiry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_expiry>,
+                boost::multi_index::member<COrphanTx, int64_t, &COrphanTx::nTimeExpire>
+            >,
+            // sorted by the peer it came from
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_peer>,
+                boost::multi_index::member<COrphanTx, NodeId, &COrphanTx::fromPeer>
+            >
+        >
+    > indexed_orphan_set;
+
+    indexed_orphan_set setOrphans;
+    //! The orphans spending each outpoint
+    std::map<COutPoint, std::set<uint256>> mapOrphansByPrev;
+};
+
+#endif // BITCOIN_TXORPHANPOOL_H
@@ -0,0 +1,237 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <utxosnapshot.h>
+
+#include <chainparams.h>
+#include <clientversion.h>
+#include <coins.h>
+#include <hash.h>
+#include <streams.h>
+#include <util.h>
+
+#include <algorithm>
+#include <map>
+
+#include <boost/thread.hpp>
+
+constexpr unsigned char SnapshotMetadata::MAGIC[];
+
+namespace {
+
+/**
+ * Best block of a coins view while a snapshot is being loaded into it. No
+ * block hashes to this, so a view left in this state by an interrupted load
+ * does not correspond to any chain.
+ */
+const uint256 SNAPSHOT_LOADING_MARKER = uint256S("01");
+
+/** Serialize one transaction's worth of unspent outputs into the file and the content hash. */
+void WriteTxOutputs(CAutoFile& file, CHashWriter& hasher, const uint256& txid, const std::map<uint32_t, Coin>& outputs)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << txid;
+    WriteCompactSize(ss, outputs.size());
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first);
+        ss << output.second;
+    }
+    file.write(ss.data(), ss.size());
+    hasher.write(ss.data(), ss.size());
+}
+
+} // namespace
+
+bool WriteUTXOSnapshot(CCoinsViewCursor& cursor, CAutoFile& file, SnapshotMetadata& metadata, uint256& hashContents)
+{
+    // The header carries the coin count, which is only known at the end.
+    // Reserve its space now and fill it in afterwards; the content hash is
+    // computed over the final header and thus started only then.
+    metadata.hashBaseBlock = cursor.GetBestBlock();
+    metadata.nCoinsCount = 0;
+    long nHeaderPos = ftell(file.Get());
+    file << metadata;
+
+    CHashWriter hasherBody(SER_GETHASH, PROTOCOL_VERSION);
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (cursor.Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!cursor.GetKey(key) || !cursor.GetValue(coin)) {
+            return error("%s: unable to read value", __func__);
+        }
+        if (!outputs.empty() && key.hash != prevkey) {
+            WriteTxOutputs(file, hasherBody, prevkey, outputs);
+            outputs.clear();
+        }
+        prevkey = key.hash;
+        outputs[key.n] = std::move(coin);
+        ++metadata.nCoinsCount;
+        cursor.Next();
+    }
+    if (!outputs.empty()) {
+        WriteTxOutputs(file, hasherBody, prevkey, outputs);
+    }
+
+    // Rewrite the header with the final coin count.
+    if (fseek(file.Get(), nHeaderPos, SEEK_SET) != 0) {
+        return error("%s: unable to seek to snapshot header", __func__);
+    }
+    file << metadata;
+    if (fseek(file.Get(), 0, SEEK_END) != 0) {
+        return error("%s: unable to seek to end of snapshot", __func__);
+    }
+
+    // Content hash: Hash(header || Hash(body)), so the body only needs to be
+    // streamed once.
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << metadata << hasherBody.GetHash();
+    hashContents = hasher.GetHash();
+    file << hashContents;
+    return true;
+}
+
+bool LoadUTXOSnapshot(CAutoFile& file, CCoinsView& view, const uint256& hashExpected, SnapshotMetadata& metadata, std::string& strError)
+{
+    if (IsSnapshotLoadIncomplete(view)) {
+        strError = "coins database holds an interrupted snapshot load and has to be wiped first";
+        return false;
+    }
+    if (!view.GetBestBlock().IsNull() || !view.GetHeadBlocks().empty()) {
+        strError = "coins database is not empty";
+        return false;
+    }
+
+    try {
+        file >> metadata;
+        long nBodyPos = ftell(file.Get());
+
+        // First pass: verify the content hash before touching the database.
+        if (fseek(file.Get(), 0, SEEK_END) != 0) {
+            strError = "unable to determine snapshot size";
+            return false;
+        }
+        long nFileSize = ftell(file.Get());
+        long nBodyEnd = nFileSize - (long)sizeof(uint256);
+        if (nBodyEnd < nBodyPos || fseek(file.Get(), nBodyPos, SEEK_SET) != 0) {
+            strError = "snapshot is truncated";
+            return false;
+        }
+        CHashWriter hasherBody(SER_GETHASH, PROTOCOL_VERSION);
+        std::vector<char> buf(1 << 20);
+        for (long nPos = nBodyPos; nPos < nBodyEnd; ) {
+            boost::this_thread::interruption_point();
+            size_t nChunk = std::min<long>(buf.size(), nBodyEnd - nPos);
+            file.read(buf.data(), nChunk);
+            hasherBody.write(buf.data(), nChunk);
+            nPos += nChunk;
+        }
+        uint256 hashContents;
+        file >> hashContents;
+        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+        hasher << metadata << hasherBody.GetHash();
+        if (hasher.GetHash() != hashContents) {
+            strError = "snapshot is corrupted (content hash mismatch)";
+            return false;
+        }
+        if (hashContents != hashExpected) {
+            strError = strprintf("snapshot content hash %s does not match the expected %s", hashContents.ToString(), hashExpected.ToString());
+            return false;
+        }
+
+        // Second pass: import the coins. Mark the view as being loaded
+        // first, and write every batch but the last under that marker, so
+        // that only a complete load ends at the base block.
+        if (fseek(file.Get(), nBodyPos, SEEK_SET) != 0) {
+            strError = "unable to seek to snapshot contents";
+            return false;
+        }
+        CCoinsMap mapCoins;
+        if (!view.BatchWrite(mapCoins, SNAPSHOT_LOADING_MARKER, true)) {
+            strError = "failed to write to coins database";
+            return false;
+        }
+        uint64_t nCoinsRead = 0;
+        while (nCoinsRead < metadata.nCoinsCount) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            file >> txid;
+            uint64_t nOutputs = ReadCompactSize(file);
+            if (nOutputs == 0 || nOutputs > metadata.nCoinsCount - nCoinsRead) {
+                strError = "snapshot contains an invalid number of outputs";
+                return false;
+            }
+            for (uint64_t i = 0; i < nOutputs; ++i) {
+                uint32_t n;
+                Coin coin;
+                file >> VARINT(n);
+                file >> coin;
+                if (coin.IsSpent()) {
+                    strError = "snapshot contains a spent coin";
+                    return false;
+                }
+                CCoinsCacheEntry& entry = mapCoins[COutPoint(txid, n)];
+                entry.coin = std::move(coin);
+                entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            }
+            nCoinsRead += nOutputs;
+            if (mapCoins.size() >= UTXO_SNAPSHOT_LOAD_BATCH_SIZE) {
+                if (!view.BatchWrite(mapCoins, SNAPSHOT_LOADING_MARKER, true)) {
+                    strError = "failed to write to coins database";
+                    return false;
+                }
+                mapCoins.clear();
+            }
+        }
+        if (ftell(file.Get()) != nBodyEnd) {
+            strError = "snapshot contains more data than its header announces";
+            return false;
+        }
+        if (!view.BatchWrite(mapCoins, metadata.hashBaseBlock, true)) {
+            strError = "failed to write to coins database";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("unable to read snapshot: %s", e.what());
+        return false;
+    }
+
+    LogPrintf("Loaded %u coins from UTXO snapshot at block %s\n", metadata.nCoinsCount, metadata.hashBaseBlock.ToString());
+    return true;
+}
+
+bool LoadUTXOSnapshot(CAutoFile& file, CCoinsView& view, const CChainParams& chainparams, SnapshotMetadata& metadata, std::string& strError)
+{
+    // Peek at the header to find the base block the snapshot claims.
+    long nStartPos = ftell(file.Get());
+    try {
+        file >> metadata;
+    } catch (const std::exception& e) {
+        strError = strprintf("unable to read snapshot header: %s", e.what());
+        return false;
+    }
+    if (fseek(file.Get(), nStartPos, SEEK_SET) != 0) {
+        strError = "unable to seek to snapshot header";
+        return false;
+    }
+
+    const MapAssumeutxo& mapAssumeutxo = chainparams.Assumeutxo();
+    auto it = mapAssumeutxo.find(metadata.hashBaseBlock);
+    if (it == mapAssumeutxo.end()) {
+        strError = strprintf("no assumed-valid UTXO set hash known for block %s", metadata.hashBaseBlock.ToString());
+        return false;
+    }
+    return LoadUTXOSnapshot(file, view, it->second.hashContents, metadata, strError);
+}
+
+bool IsSnapshotLoadIncomplete(const CCoinsView& view)
+{
+    if (view.GetBestBlock() == SNAPSHOT_LOADING_MARKER)
+        return true;
+    // Interrupted in the middle of a batch
+    const std::vector<uint256> vHeads = view.GetHeadBlocks();
+    return std::find(vHeads.begin(), vHeads.end(), SNAPSHOT_LOADING_MARKER) != vHeads.end();
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOSNAPSHOT_H
+#define BITCOIN_UTXOSNAPSHOT_H
+
+#include <serialize.h>
+#include <tinyformat.h>
+#include <uint256.h>
+
+#include <ios>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+class CAutoFile;
+class CChainParams;
+class CCoinsView;
+class CCoinsViewCursor;
+
+/** Current version of the UTXO snapshot file format. */
+static const uint16_t UTXO_SNAPSHOT_VERSION = 1;
+
+/** Number of coins written to the base view per batch while loading a snapshot. */
+static const unsigned int UTXO_SNAPSHOT_LOAD_BATCH_SIZE = 100000;
+
+/**
+ * Header of a UTXO snapshot file.
+ *
+ * A snapshot file consists of this header, followed by the unspent outputs
+ * grouped per transaction (in the order the chainstate cursor returns them,
+ * which keeps the outputs of a transaction together), followed by the hash
+ * of everything that precedes it.
+ *
+ * Serialized format of each transaction group:
+ * - txid
+ * - CompactSize number of outputs
+ * - for each output: VARINT(vout index), Coin
+ */
+class SnapshotMetadata
+{
+public:
+    static constexpr unsigned char MAGIC[5] = {'u', 't', 'x', 'o', 0xff};
+
+    uint16_t nVersion;
+    //! Block whose resulting UTXO set this snapshot represents
+    uint256 hashBaseBlock;
+    //! Height of the base block, for informational purposes
+    int nBaseHeight;
+    //! Number of unspent outputs in the snapshot
+    uint64_t nCoinsCount;
+
+    SnapshotMetadata() : nVersion(UTXO_SNAPSHOT_VERSION), nBaseHeight(0), nCoinsCount(0) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        s.write((const char*)MAGIC, sizeof(MAGIC));
+        s << nVersion << hashBaseBlock << nBaseHeight << nCoinsCount;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        unsigned char magic[sizeof(MAGIC)];
+        s.read((char*)magic, sizeof(magic));
+        if (memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+            throw std::ios_base::failure("Invalid UTXO snapshot magic bytes");
+        }
+        s >> nVersion;
+        if (nVersion != UTXO_SNAPSHOT_VERSION) {
+            throw std::ios_base::failure(strprintf("Unsupported UTXO snapshot version %u", nVersion));
+        }
+        s >> hashBaseBlock >> nBaseHeight >> nCoinsCount;
+    }
+};
+
+/**
+ * Stream the UTXO set behind cursor into file. A CCoinsViewDB cursor
+ * iterates over a consistent database snapshot, so the database may be
+ * written to while this runs. metadata.hashBaseBlock is taken from the
+ * cursor, nBaseHeight must be filled in by the caller. On success the coin
+ * count is set in metadata, and hashContents is set to the content hash
+ * written at the end of the file.
+ */
+bool WriteUTXOSnapshot(CCoinsViewCursor& cursor, CAutoFile& file, SnapshotMetadata& metadata, uint256& hashContents);
+
+/**
+ * Bulk-import a UTXO snapshot into an empty coins view (normally a fresh
+ * CCoinsViewDB). The whole file is verified against hashExpected before
+ * anything is written to view. While the coins are written, view's best block
+ * is a marker that is no block hash, so that an interrupted load is never
+ * taken for a UTXO set; only the last batch sets the snapshot's base block.
+ */
+bool LoadUTXOSnapshot(CAutoFile& file, CCoinsView& view, const uint256& hashExpected, SnapshotMetadata& metadata, std::string& strError);
+
+/**
+ * Like LoadUTXOSnapshot, but only accept snapshots whose base block and
+ * content hash are listed in the chain parameters.
+ */
+bool LoadUTXOSnapshot(CAutoFile& file, CCoinsView& view, const CChainParams& chainparams, SnapshotMetadata& metadata, std::string& strError);
+
+/**
+ * Whether view holds the coins of a snapshot load that did not finish. Such
+ * a view has to be wiped before a snapshot can be loaded into it again.
+ */
+bool IsSnapshotLoadIncomplete(const CCoinsView& view);
+
+#endif // BITCOIN_UTXOSNAPSHOT_H
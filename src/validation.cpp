@@ -6,10 +6,12 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfilereader.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <checkqueue.h>
+#include <coinstatsindex.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
@@ -34,6 +36,7 @@
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
+#include <txindex.h>
 #include <txmempool.h>
 #include <ui_interface.h>
 #include <undo.h>
@@ -44,6 +47,7 @@
 #include <versionbits.h>
 #include <warnings.h>
 
+#include <algorithm>
 #include <future>
 #include <sstream>
 
@@ -211,7 +215,6 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
-bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -510,6 +513,29 @@ void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool f
     LimitMempoolSize(mempool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 }
 
+/** Fill in state for the script check that failed, as CheckInputs does */
+static bool InvalidScriptCheck(CValidationState& state, const CScriptCheck& check)
+{
+    if (check.GetFlags() & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+        // Check whether the failure was caused by a
+        // non-mandatory script verification check, such as
+        // non-standard DER encodings or non-null dummy
+        // arguments; if so, don't trigger DoS protection to
+        // avoid splitting the network between upgraded and
+        // non-upgraded nodes.
+        if (check.CheckWithoutFlags(STANDARD_NOT_MANDATORY_VERIFY_FLAGS))
+            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+    }
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after soft-fork
+    // super-majority signaling has occurred.
+    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+}
+
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
 static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, CTxMemPool& pool,
@@ -596,18 +622,12 @@ bool CheckBWTHash(const uint256& wtjID, const CTransaction &tx)
 }
 
 
-static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
-                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+/**
+ * The policy checks of AcceptToMemoryPoolWorker that need nothing but the
+ * transaction itself and whether the mempool has it already.
+ */
+static bool CheckTxPolicy(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransaction& tx)
 {
-    const CTransaction& tx = *ptx;
-    const uint256 hash = tx.GetHash();
-    AssertLockHeld(cs_main);
-    LOCK(pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
-    if (pfMissingInputs) {
-        *pfMissingInputs = false;
-    }
-
     if (!CheckTransaction(tx, state))
         return false; // state filled in by CheckTransaction
 
@@ -639,10 +659,108 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         return state.DoS(0, false, REJECT_NONSTANDARD, "non-final");
 
     // is it already in the memory pool?
-    if (pool.exists(hash)) {
+    if (pool.exists(tx.GetHash())) {
         return state.Invalid(false, REJECT_DUPLICATE, "txn-already-in-mempool");
     }
 
+    return true;
+}
+
+/**
+ * The policy checks of AcceptToMemoryPoolWorker on the coins a transaction
+ * spends, which must all be in view, and the fees nFees it pays: standard
+ * inputs, sigops and fee rate. Sets nModifiedFees and nSigOpsCost.
+ */
+static bool CheckTxInputsPolicy(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, const CCoinsViewCache& view,
+                                const CAmount& nFees, bool bypass_limits, const CAmount& nAbsurdFee,
+                                CAmount& nModifiedFees, int64_t& nSigOpsCost)
+{
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+
+    nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+
+    // nModifiedFees includes any fee deltas from PrioritiseTransaction
+    nModifiedFees = nFees;
+    pool.ApplyDelta(tx.GetHash(), nModifiedFees);
+
+    // Check that the transaction doesn't have an excessive number of
+    // sigops, making it impossible to mine. Since the coinbase transaction
+    // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
+    // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
+    // merely non-standard transaction.
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
+            strprintf("%d", nSigOpsCost));
+
+    const unsigned int nSize = GetVirtualTransactionSize(tx, nSigOpsCost);
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (!bypass_limits && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    }
+
+    // No transactions are allowed below minRelayTxFee except from disconnected blocks
+    if (!bypass_limits && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
+    }
+
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
+
+    return true;
+}
+
+/**
+ * What PreAcceptToMemoryPool found out about a transaction, short of verifying
+ * its scripts, for FinishAcceptToMemoryPool to add it to the mempool with. It
+ * holds for as long as neither the chain tip nor the mempool change.
+ */
+struct MemPoolAcceptData
+{
+    CCoinsView dummy;
+    //! The coins the transaction spends, backed by dummy
+    CCoinsViewCache view;
+    std::unique_ptr<CTxMemPoolEntry> entry;
+    CTxMemPool::vecEntries vAncestors;
+    CTxMemPool::setEntries allConflicting;
+    CAmount nModifiedFees;
+    CAmount nConflictingFees;
+    size_t nConflictingSize;
+    bool fReplacementTransaction;
+    unsigned int scriptVerifyFlags;
+    //! The chain tip and the mempool update count the checks ran against
+    uint256 hashTip;
+    unsigned int nTransactionsUpdated;
+
+    MemPoolAcceptData() : view(&dummy), nModifiedFees(0), nConflictingFees(0), nConflictingSize(0),
+                          fReplacementTransaction(false), scriptVerifyFlags(0), nTransactionsUpdated(0) {}
+};
+
+/** The checks of AcceptToMemoryPoolWorker that come before verifying the scripts */
+static bool PreAcceptToMemoryPool(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool bypass_limits, const CAmount& nAbsurdFee,
+                              std::vector<COutPoint>& coins_to_uncache, MemPoolAcceptData& data)
+{
+    const CTransaction& tx = *ptx;
+    const uint256 hash = tx.GetHash();
+    AssertLockHeld(cs_main);
+    LOCK(pool.cs);
+    if (pfMissingInputs) {
+        *pfMissingInputs = false;
+    }
+
+    if (!CheckTxPolicy(chainparams, pool, state, tx))
+        return false; // state filled in by CheckTxPolicy
+
+    bool drivechainsEnabled = IsDrivechainEnabled(chainActive.Tip(), Params().GetConsensus());
+
     // Sidechain deposit / withdraw checks
     if (drivechainsEnabled)
     {
@@ -723,8 +841,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
 
     {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
+        CCoinsViewCache& view = data.view;
 
         LockPoints lp;
         CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
@@ -755,7 +872,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         view.GetBestBlock();
 
         // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
+        view.SetBackend(data.dummy);
 
         // Only accept BIP68 sequence locked transactions that can be mined in the next
         // block; we don't want our mempool filled up with transactions that can't
@@ -770,19 +887,10 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
         }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
-
-        // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
-
-        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
-
-        // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        CAmount nModifiedFees = nFees;
-        pool.ApplyDelta(hash, nModifiedFees);
+        CAmount& nModifiedFees = data.nModifiedFees;
+        int64_t nSigOpsCost;
+        if (!CheckTxInputsPolicy(pool, state, tx, view, nFees, bypass_limits, nAbsurdFee, nModifiedFees, nSigOpsCost))
+            return false; // state filled in by CheckTxInputsPolicy
 
         // Keep track of transactions that spend a coinbase, which we re-scan
         // during reorgs to ensure COINBASE_MATURITY is still met.
@@ -806,50 +914,27 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             }
         }
 
-        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, chainActive.Height(),
-                              fSpendsCoinbase, fSpendsCriticalData, nSigOpsCost, lp);
+        data.entry.reset(new CTxMemPoolEntry(ptx, nFees, nAcceptTime, chainActive.Height(),
+                                             fSpendsCoinbase, fSpendsCriticalData, nSigOpsCost, lp));
+        const CTxMemPoolEntry& entry = *data.entry;
         unsigned int nSize = entry.GetTxSize();
 
-        // Check that the transaction doesn't have an excessive number of
-        // sigops, making it impossible to mine. Since the coinbase transaction
-        // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
-        // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
-        // merely non-standard transaction.
-        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
-                strprintf("%d", nSigOpsCost));
-
-        CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (!bypass_limits && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
-        }
-
-        // No transactions are allowed below minRelayTxFee except from disconnected blocks
-        if (!bypass_limits && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
-        }
-
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
-
         // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
+        CTxMemPool::vecEntries& vAncestors = data.vAncestors;
         size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
         size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
         size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
         size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
         std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        if (!pool.CalculateMemPoolAncestors(entry, vAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
             return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
         }
 
         // A transaction that spends outputs that would be replaced by it is invalid. Now
         // that we have the set of all ancestors we can detect this
-        // pathological case by making sure setConflicts and setAncestors don't
+        // pathological case by making sure setConflicts and vAncestors don't
         // intersect.
-        for (CTxMemPool::txiter ancestorIt : setAncestors)
+        for (CTxMemPool::txiter ancestorIt : vAncestors)
         {
             const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
             if (setConflicts.count(hashAncestor))
@@ -864,16 +949,16 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 
         // Check if it's economically rational to mine this transaction rather
         // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
+        CAmount& nConflictingFees = data.nConflictingFees;
+        size_t& nConflictingSize = data.nConflictingSize;
         uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
+        CTxMemPool::setEntries& allConflicting = data.allConflicting;
 
         // If we don't hold the lock allConflicting might be incomplete; the
         // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
         // mempool consistency for us.
-        const bool fReplacementTransaction = setConflicts.size();
-        if (fReplacementTransaction)
+        data.fReplacementTransaction = setConflicts.size();
+        if (data.fReplacementTransaction)
         {
             CFeeRate newFeeRate(nModifiedFees, nSize);
             std::set<uint256> setConflictsParents;
@@ -988,90 +1073,98 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             }
         }
 
-        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+        data.scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
         if (!chainparams.RequireStandard()) {
-            scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
-        }
-
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
-            // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
-            // need to turn both off, and compare against just turning off CLEANSTACK
-            // to see if the failure is specifically due to witness validation.
-            CValidationState stateDummy; // Want reported failures to be from first CheckInputs
-            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
-                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
-                // Only the witness is missing, so the transaction itself may be fine.
-                state.SetCorruptionPossible();
-            }
-            return false; // state filled in by CheckInputs
-        }
-
-        // Check again against the current block tip's script verification
-        // flags to cache our script execution flags. This is, of course,
-        // useless if the next block has different script flags from the
-        // previous one, but because the cache tracks script flags for us it
-        // will auto-invalidate and we'll just have a few blocks of extra
-        // misses on soft-fork activation.
-        //
-        // This is also useful in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks (using TestBlockValidity), however allowing such
-        // transactions into the mempool can be exploited as a DoS attack.
-        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
-        {
-            // If we're using promiscuousmempoolflags, we may hit this normally
-            // Check if current block has some flags that scriptVerifyFlags
-            // does not before printing an ominous warning
-            if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
-                return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+            data.scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", data.scriptVerifyFlags);
+        }
+    }
+
+    data.hashTip = chainActive.Tip()->GetBlockHash();
+    data.nTransactionsUpdated = pool.GetTransactionsUpdated();
+    return true;
+}
+
+/**
+ * Add a transaction to the mempool once PreAcceptToMemoryPool has passed it
+ * and its scripts are verified.
+ */
+static bool FinishAcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
+                              std::list<CTransactionRef>* plTxnReplaced, bool bypass_limits, MemPoolAcceptData& data,
+                              PrecomputedTransactionData& txdata)
+{
+    const CTransaction& tx = *ptx;
+    const uint256 hash = tx.GetHash();
+    AssertLockHeld(cs_main);
+    LOCK(pool.cs);
+
+    const CCoinsViewCache& view = data.view;
+    const unsigned int scriptVerifyFlags = data.scriptVerifyFlags;
+    const CAmount nModifiedFees = data.nModifiedFees;
+    const CAmount nConflictingFees = data.nConflictingFees;
+    const unsigned int nSize = data.entry->GetTxSize();
+
+    // Check again against the current block tip's script verification
+    // flags to cache our script execution flags. This is, of course,
+    // useless if the next block has different script flags from the
+    // previous one, but because the cache tracks script flags for us it
+    // will auto-invalidate and we'll just have a few blocks of extra
+    // misses on soft-fork activation.
+    //
+    // This is also useful in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks (using TestBlockValidity), however allowing such
+    // transactions into the mempool can be exploited as a DoS attack.
+    unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+    if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
+    {
+        // If we're using promiscuousmempoolflags, we may hit this normally
+        // Check if current block has some flags that scriptVerifyFlags
+        // does not before printing an ominous warning
+        if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        } else {
+            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
+                return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
                     __func__, hash.ToString(), FormatStateMessage(state));
             } else {
-                if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
-                    return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
-                        __func__, hash.ToString(), FormatStateMessage(state));
-                } else {
-                    LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
-                }
+                LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
             }
         }
+    }
 
-        // Remove conflicting transactions from the mempool
-        for (const CTxMemPool::txiter it : allConflicting)
-        {
-            LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-            if (plTxnReplaced)
-                plTxnReplaced->push_back(it->GetSharedTx());
-        }
-        pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+    // Remove conflicting transactions from the mempool
+    for (const CTxMemPool::txiter it : data.allConflicting)
+    {
+        LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(nModifiedFees - nConflictingFees),
+                (int)nSize - (int)data.nConflictingSize);
+        if (plTxnReplaced)
+            plTxnReplaced->push_back(it->GetSharedTx());
+    }
+    pool.RemoveStaged(data.allConflicting, false, MemPoolRemovalReason::REPLACED);
 
-        // This transaction should only count for fee estimation if:
-        // - it isn't a BIP 125 replacement transaction (may not be widely supported)
-        // - it's not being readded during a reorg which bypasses typical mempool fee limits
-        // - the node is not behind
-        // - the transaction is not dependent on any other transactions in the mempool
-        bool validForFeeEstimation = !fReplacementTransaction && !bypass_limits && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+    // This transaction should only count for fee estimation if:
+    // - it isn't a BIP 125 replacement transaction (may not be widely supported)
+    // - it's not being readded during a reorg which bypasses typical mempool fee limits
+    // - the node is not behind
+    // - the transaction is not dependent on any other transactions in the mempool
+    bool validForFeeEstimation = !data.fReplacementTransaction && !bypass_limits && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
 
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, validForFeeEstimation);
+    // Store transaction in memory
+    pool.addUnchecked(hash, *data.entry, data.vAncestors, validForFeeEstimation);
 
-        // trim mempool and check if tx was trimmed
-        if (!bypass_limits) {
-            LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash))
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
-        }
+    // trim mempool and check if tx was trimmed
+    if (!bypass_limits) {
+        LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     GetMainSignals().TransactionAddedToMempool(ptx);
@@ -1079,6 +1172,39 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     return true;
 }
 
+static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
+                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    const CTransaction& tx = *ptx;
+    AssertLockHeld(cs_main);
+    LOCK(pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
+
+    MemPoolAcceptData data;
+    if (!PreAcceptToMemoryPool(chainparams, pool, state, ptx, pfMissingInputs, nAcceptTime, bypass_limits, nAbsurdFee, coins_to_uncache, data))
+        return false; // state filled in by PreAcceptToMemoryPool
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    const CCoinsViewCache& view = data.view;
+    const unsigned int scriptVerifyFlags = data.scriptVerifyFlags;
+    PrecomputedTransactionData txdata(tx);
+    if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
+        // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
+        // need to turn both off, and compare against just turning off CLEANSTACK
+        // to see if the failure is specifically due to witness validation.
+        CValidationState stateDummy; // Want reported failures to be from first CheckInputs
+        if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+            !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.SetCorruptionPossible();
+        }
+        return false; // state filled in by CheckInputs
+    }
+
+    return FinishAcceptToMemoryPool(pool, state, ptx, plTxnReplaced, bypass_limits, data, txdata);
+}
+
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
@@ -1104,6 +1230,134 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee);
 }
 
+bool AcceptToMemoryPoolConcurrent(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
+                        bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
+                        bool bypass_limits, const CAmount nAbsurdFee)
+{
+    const CChainParams& chainparams = Params();
+    const int64_t nAcceptTime = GetTime();
+    std::vector<COutPoint> coins_to_uncache;
+
+    // Run the policy checks and look up the coins spent under the locks, as
+    // AcceptToMemoryPool would, stopping short of verifying the scripts.
+    MemPoolAcceptData data;
+    PrecomputedTransactionData txdata(*tx);
+    std::vector<CScriptCheck> vChecks;
+    bool res;
+    {
+        LOCK2(cs_main, pool.cs);
+        res = PreAcceptToMemoryPool(chainparams, pool, state, tx, pfMissingInputs, nAcceptTime, bypass_limits, nAbsurdFee, coins_to_uncache, data) &&
+              CheckInputs(*tx, state, data.view, true, data.scriptVerifyFlags, true, false, txdata, &vChecks);
+    }
+
+    if (res) {
+        // Verify the scripts with no locks held, so that other transactions
+        // and blocks can be validated meanwhile.
+        for (CScriptCheck& check : vChecks) {
+            if (check())
+                continue;
+            res = InvalidScriptCheck(state, check);
+            // As in AcceptToMemoryPoolWorker, tell whether only the witness
+            // is missing, in which case the transaction itself may be fine.
+            auto fPassWithout = [&vChecks](unsigned int nFlagsOff) {
+                return std::all_of(vChecks.begin(), vChecks.end(), [nFlagsOff](const CScriptCheck& c) { return c.CheckWithoutFlags(nFlagsOff); });
+            };
+            if (!tx->HasWitness() && fPassWithout(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK) && !fPassWithout(SCRIPT_VERIFY_CLEANSTACK)) {
+                state.SetCorruptionPossible();
+            }
+            break;
+        }
+    }
+
+    if (res) {
+        // Add it under the locks again. Each input commits to the output it
+        // spends, so the scripts need not be verified again. The rest only
+        // has to be checked again if the chain tip or the mempool changed.
+        LOCK2(cs_main, pool.cs);
+        if (data.hashTip == chainActive.Tip()->GetBlockHash() && data.nTransactionsUpdated == pool.GetTransactionsUpdated()) {
+            res = FinishAcceptToMemoryPool(pool, state, tx, plTxnReplaced, bypass_limits, data, txdata);
+        } else {
+            MemPoolAcceptData dataNow;
+            std::vector<CScriptCheck> vChecksDone;
+            res = PreAcceptToMemoryPool(chainparams, pool, state, tx, pfMissingInputs, nAcceptTime, bypass_limits, nAbsurdFee, coins_to_uncache, dataNow) &&
+                  CheckInputs(*tx, state, dataNow.view, true, dataNow.scriptVerifyFlags, true, false, txdata, &vChecksDone) &&
+                  FinishAcceptToMemoryPool(pool, state, tx, plTxnReplaced, bypass_limits, dataNow, txdata);
+            if (!res && state.GetRejectReason() == "txn-already-in-mempool") {
+                // Another thread got it in first.
+                state = CValidationState();
+                res = true;
+            }
+        }
+    }
+
+    LOCK(cs_main);
+    if (!res) {
+        for (const COutPoint& hashTx : coins_to_uncache)
+            pcoinsTip->Uncache(hashTx);
+    }
+    CValidationState stateDummy;
+    FlushStateToDisk(chainparams, stateDummy, FLUSH_STATE_PERIODIC);
+    return res;
+}
+
+static std::vector<PackageTxResult> AcceptPackageToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool,
+                        const std::vector<CTransactionRef>& vtx, const std::vector<int64_t>& vAcceptTime,
+                        bool bypass_limits, const CAmount nAbsurdFee)
+{
+    // Order the package so that every transaction comes after those in it
+    // whose outputs it spends, and in the given order otherwise.
+    std::map<uint256, size_t> mapIndex;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        mapIndex.emplace(vtx[i]->GetHash(), i);
+    }
+    std::vector<std::vector<size_t>> vChildren(vtx.size());
+    std::vector<size_t> vParentsLeft(vtx.size());
+    for (size_t i = 0; i < vtx.size(); i++) {
+        std::set<size_t> setParents;
+        for (const CTxIn& txin : vtx[i]->vin) {
+            auto it = mapIndex.find(txin.prevout.hash);
+            if (it != mapIndex.end() && it->second != i && setParents.insert(it->second).second) {
+                vChildren[it->second].push_back(i);
+            }
+        }
+        vParentsLeft[i] = setParents.size();
+    }
+    std::set<size_t> setReady;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vParentsLeft[i] == 0)
+            setReady.insert(i);
+    }
+    std::vector<size_t> vOrder;
+    std::vector<CTransactionRef> vtxSorted;
+    while (!setReady.empty()) {
+        const size_t i = *setReady.begin();
+        setReady.erase(setReady.begin());
+        vOrder.push_back(i);
+        vtxSorted.push_back(vtx[i]);
+        for (size_t child : vChildren[i]) {
+            if (--vParentsLeft[child] == 0)
+                setReady.insert(child);
+        }
+    }
+
+    std::vector<PackageTxResult> vResults(vtx.size());
+    LOCK(cs_main);
+    PreverifyTransactionScripts(pool, vtxSorted, bypass_limits, nAbsurdFee);
+    for (size_t i : vOrder) {
+        PackageTxResult& result = vResults[i];
+        result.fAccepted = AcceptToMemoryPoolWithTime(chainparams, pool, result.state, vtx[i], &result.fMissingInputs,
+                                                      vAcceptTime[i], nullptr /* plTxnReplaced */, bypass_limits, nAbsurdFee);
+    }
+    return vResults;
+}
+
+std::vector<PackageTxResult> AcceptPackageToMemoryPool(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx,
+                        bool bypass_limits, const CAmount nAbsurdFee)
+{
+    const std::vector<int64_t> vAcceptTime(vtx.size(), GetTime());
+    return AcceptPackageToMemoryPoolWithTime(Params(), pool, vtx, vAcceptTime, bypass_limits, nAbsurdFee);
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1121,28 +1375,14 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
             return true;
         }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut->GetHash() != hash)
-                    return error("%s: txid mismatch", __func__);
+        if (g_txindex) {
+            if (g_txindex->FindTx(hash, hashBlock, txOut))
                 return true;
-            }
 
-            // transaction not found in index, nothing more can be done
-            return false;
+            // While the index is still catching up, fall back to the slow
+            // lookup for transactions it has not reached yet.
+            if (g_txindex->IsSynced())
+                return false;
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
@@ -1238,6 +1478,52 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start, bool fWitness)
+{
+    // Seek back to the index header written by WriteBlockToDisk
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: invalid block position %s", __func__, pos.ToString());
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    // Open history file to read
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int blk_size;
+        filein >> FLATDATA(blk_start) >> blk_size;
+        if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE))
+            return error("%s: Block magic mismatch for %s", __func__, pos.ToString());
+        if (blk_size > MAX_SIZE)
+            return error("%s: Block data is larger than maximum deserialization size for %s", __func__, pos.ToString());
+        block.resize(blk_size);
+        filein.read((char*)block.data(), blk_size);
+    } catch (const std::exception& e) {
+        return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
+    }
+
+    if (!fWitness) {
+        std::vector<unsigned char> stripped;
+        if (!StripBlockWitness(block, stripped))
+            return error("%s: Malformed block data at %s", __func__, pos.ToString());
+        block.swap(stripped);
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start, bool fWitness)
+{
+    CDiskBlockPos blockPos;
+    {
+        LOCK(cs_main);
+        blockPos = pindex->GetBlockPos();
+    }
+    return ReadRawBlockFromDisk(block, blockPos, message_start, fWitness);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1423,6 +1709,11 @@ bool CScriptCheck::operator()() {
     return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata), &error);
 }
 
+bool CScriptCheck::CheckWithoutFlags(unsigned int nFlagsOff) const {
+    CScriptCheck check(m_tx_out, *ptxTo, nIn, nFlags & ~nFlagsOff, cacheStore, txdata);
+    return check();
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1433,16 +1724,30 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 
 static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
+static size_t nScriptExecutionCacheElems = 0;
 
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
     // setup_bytes creates the minimum possible cache (2 elements).
     size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
     size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    nScriptExecutionCacheElems = nElems;
     LogPrintf("Using %zu MiB out of %zu/2 requested for script execution cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+bool DumpScriptExecutionCache()
+{
+    LOCK(cs_main);
+    return DumpNoncedCache(GetDataDir() / "scriptcache.dat", scriptExecutionCacheNonce, {&scriptExecutionCache});
+}
+
+bool LoadScriptExecutionCache()
+{
+    LOCK(cs_main);
+    return LoadNoncedCache(GetDataDir() / "scriptcache.dat", scriptExecutionCacheNonce, {&scriptExecutionCache}, nScriptExecutionCacheElems);
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1533,26 +1838,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
                 } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(coin.out, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after soft-fork
-                    // super-majority signaling has occurred.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+                    return InvalidScriptCheck(state, check);
                 }
             }
 
@@ -1567,36 +1853,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     return true;
 }
 
-namespace {
-
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
-{
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
-
-    // calculate & write checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    fileout << hasher.GetHash();
-
-    return true;
-}
-
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
 {
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
@@ -1627,6 +1884,35 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
+namespace {
+
+bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Open history file to append
+    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: OpenUndoFile failed", __func__);
+
+    // Write index header
+    unsigned int nSize = GetSerializeSize(fileout, blockundo);
+    fileout << FLATDATA(messageStart) << nSize;
+
+    // Write undo data
+    long fileOutPos = ftell(fileout.Get());
+    if (fileOutPos < 0)
+        return error("%s: ftell failed", __func__);
+    pos.nPos = (unsigned int)fileOutPos;
+    fileout << blockundo;
+
+    // calculate & write checksum
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << blockundo;
+    fileout << hasher.GetHash();
+
+    return true;
+}
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1784,31 +2070,70 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     return true;
 }
 
-static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex)
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+void ThreadScriptCheck() {
+    RenameThread("bitcoin-scriptch");
+    scriptcheckqueue.Thread();
+}
+
+size_t PreverifyTransactionScripts(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx,
+                                   bool bypass_limits, const CAmount nAbsurdFee)
 {
-    if (!fTxIndex) return true;
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads || vtx.size() < 2)
+        return 0;
 
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
-    for (const CTransactionRef& tx : block.vtx)
+    // The checks point into these, so they must not move.
+    std::vector<PrecomputedTransactionData> vTxData;
+    vTxData.reserve(vtx.size());
+    std::vector<CScriptCheck> vChecks;
+    size_t nVerified = 0;
     {
-        vPos.push_back(std::make_pair(tx->GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
-    }
+        LOCK(pool.cs);
+        CCoinsView dummy;
+        CCoinsViewCache view(&dummy);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+        view.SetBackend(viewMemPool);
 
-    if (!pblocktree->WriteTxIndex(vPos)) {
-        return AbortNode(state, "Failed to write transaction index");
+        for (const CTransactionRef& ptx : vtx) {
+            const CTransaction& tx = *ptx;
+            // Leave out what AcceptToMemoryPool rejects before verifying any
+            // script, so that this costs no more than accepting one by one.
+            // Failures are left for it to find and report. The descendants
+            // of a transaction left out are left out too, as their inputs are
+            // missing from view.
+            CValidationState state;
+            CAmount nFees = 0;
+            CAmount nModifiedFees;
+            int64_t nSigOpsCost;
+            if (!CheckTxPolicy(Params(), pool, state, tx) || !view.HaveInputs(tx) ||
+                !Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view), nFees) ||
+                !CheckTxInputsPolicy(pool, state, tx, view, nFees, bypass_limits, nAbsurdFee, nModifiedFees, nSigOpsCost)) {
+                continue;
+            }
+            // Only the signature cache is written to, as the flags
+            // AcceptToMemoryPool will check with are not known yet.
+            vTxData.emplace_back(tx);
+            std::vector<CScriptCheck> vTxChecks;
+            if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, true, vTxData.back(), &vTxChecks))
+                continue;
+            for (CScriptCheck& check : vTxChecks) {
+                vChecks.emplace_back();
+                vChecks.back().swap(check);
+            }
+            // Let later transactions spend this one's outputs.
+            AddCoins(view, tx, MEMPOOL_HEIGHT, true);
+            nVerified++;
+        }
     }
 
-    return true;
-}
-
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
-void ThreadScriptCheck() {
-    RenameThread("bitcoin-scriptch");
-    scriptcheckqueue.Thread();
+    // The checks hold copies of the outputs they spend, so the mempool may
+    // change while they run.
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+    return nVerified;
 }
 
 // Protected by cs_main
@@ -2170,8 +2495,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (!WriteTxIndexDataForBlock(block, state, pindex))
-        return false;
+    if (g_coin_stats_index && !g_coin_stats_index->BlockConnected(block, pindex, blockundo))
+        return AbortNode(state, "Failed to write coin stats index");
 
     assert(pindex->phashBlock);
     // add this block to the view's block chain
@@ -2245,7 +2570,7 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
         bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
-        // Combine all conditions that result in a full cache flush.
+        // Combine all conditions that result in the chainstate being written.
         fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
         // Write blocks and block index to disk.
         if (fDoFullFlush || fPeriodicWrite) {
@@ -2286,10 +2611,19 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
-            // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Write the modified part of the chainstate (which may refer to
+            // block index entries), but keep the cache warm for the blocks
+            // that follow.
+            if (!pcoinsTip->Sync())
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
+            // If we got here because the cache is full, make room by evicting
+            // the oldest unmodified entries down to a low-water mark, so that
+            // we don't have to flush again after the next few blocks.
+            if (fCacheLarge || fCacheCritical) {
+                pcoinsTip->Trim(nTotalSpace * COINS_CACHE_LOW_WATER_PERCENT / 100);
+                LogPrint(BCLog::COINDB, "Trimmed coins cache from %.1fMiB to %.1fMiB\n", cacheSize * (1.0 / (1 << 20)), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)));
+            }
         }
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -4249,10 +4583,6 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
-
     return true;
 }
 
@@ -4636,9 +4966,6 @@ bool LoadBlockIndex(const CChainParams& chainparams)
         // needs_init.
 
         LogPrintf("Initializing databases...\n");
-        // Use the provided setting for -txindex in the new database
-        fTxIndex = gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX);
-        pblocktree->WriteFlag("txindex", fTxIndex);
     }
     return true;
 }
@@ -4683,43 +5010,20 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        CBlockFileReader reader(fileIn, chainparams.MessageStart(), chainparams.GetConsensus(),
+                                dbp ? *dbp : CDiskBlockPos(), nScriptCheckThreads);
+        while (std::shared_ptr<CBlockFileReader::PendingBlock> pending = reader.Next()) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+            if (!pending->pblock) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, pending->strError);
+                continue;
             }
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                    dbp->nPos = pending->pos.nPos;
+                std::shared_ptr<CBlock> pblock = pending->pblock;
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -5007,6 +5311,8 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
 }
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Number of mempool.dat entries accepted to the mempool at once when loading it */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 500;
 
 bool LoadMempool(void)
 {
@@ -5025,6 +5331,33 @@ bool LoadMempool(void)
     int64_t already_there = 0;
     int64_t nNow = GetTime();
 
+    // Entries are read in batches, and each batch is accepted at once, so
+    // that its scripts are verified in parallel and cs_main is released in
+    // between for the node to carry on serving its peers.
+    std::vector<CTransactionRef> vtx;
+    std::vector<int64_t> vTime;
+    auto accept_batch = [&]() {
+        const std::vector<PackageTxResult> vResults = AcceptPackageToMemoryPoolWithTime(chainparams, mempool, vtx, vTime,
+                                                          false /* bypass_limits */, 0 /* nAbsurdFee */);
+        for (size_t i = 0; i < vtx.size(); i++) {
+            if (vResults[i].fAccepted) {
+                ++count;
+            } else {
+                // mempool may contain the transaction already, e.g. from
+                // wallet(s) having loaded it while we were processing
+                // mempool transactions; consider these as valid, instead of
+                // failed, but mark them as 'already there'
+                if (mempool.exists(vtx[i]->GetHash())) {
+                    ++already_there;
+                } else {
+                    ++failed;
+                }
+            }
+        }
+        vtx.clear();
+        vTime.clear();
+    };
+
     try {
         uint64_t version;
         file >> version;
@@ -5045,27 +5378,15 @@ bool LoadMempool(void)
             if (amountdelta) {
                 mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
             }
-            CValidationState state;
             if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
-                                           nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    // mempool may contain the transaction already, e.g. from
-                    // wallet(s) having loaded it while we were processing
-                    // mempool transactions; consider these as valid, instead of
-                    // failed, but mark them as 'already there'
-                    if (mempool.exists(tx->GetHash())) {
-                        ++already_there;
-                    } else {
-                        ++failed;
-                    }
-                }
+                vtx.push_back(tx);
+                vTime.push_back(nTime);
             } else {
                 ++expired;
             }
+            if (vtx.size() >= MEMPOOL_LOAD_BATCH_SIZE || (num == 0 && !vtx.empty())) {
+                accept_batch();
+            }
             if (ShutdownRequested())
                 return false;
         }
@@ -12,6 +12,7 @@
 
 #include <amount.h>
 #include <coins.h>
+#include <consensus/validation.h>
 #include <fs.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
 #include <policy/feerate.h>
@@ -32,6 +33,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
 class CCoinsViewDB;
 class CInv;
@@ -39,7 +41,6 @@ class CConnman;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
-class CValidationState;
 class SidechainDB;
 struct ChainTxData;
 
@@ -83,6 +84,10 @@ static const int MAX_SCRIPTCHECK_THREADS = 16;
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Number of blocks that can be requested at any given time from a single peer that delivers them fast enough. */
+static const int MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER = 128;
+/** Time in microseconds worth of blocks, at the rate it delivers them, to keep requested from a peer. */
+static const int64_t BLOCK_DOWNLOAD_QUEUE_TIME = 2 * 1000000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -98,10 +103,16 @@ static const int MAX_BLOCKTXN_DEPTH = 10;
  *  degree of disordering of blocks on disk (which make reindexing and pruning harder). We'll probably
  *  want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Maximum size of the block download window, which grows beyond BLOCK_DOWNLOAD_WINDOW as blocks come in faster. */
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 4096;
+/** Time in microseconds worth of blocks, at the rate they are being downloaded, the block download window spans. */
+static const int64_t BLOCK_DOWNLOAD_WINDOW_TIME = 30 * 1000000;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of the coins cache budget kept resident after the cache was written because it was full. */
+static const unsigned int COINS_CACHE_LOW_WATER_PERCENT = 50;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -171,7 +182,6 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
-extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
@@ -320,6 +330,53 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee);
 
+/**
+ * (try to) add transaction to memory pool as AcceptToMemoryPool does, but
+ * without holding cs_main while its scripts are verified, so that callers on
+ * other threads can validate transactions and blocks at the same time. The
+ * policy checks run under cs_main first, then the scripts with no locks
+ * held, and then the transaction is accepted under cs_main again. The policy
+ * checks are run again only if the chain tip or the mempool changed in the
+ * meantime, and the scripts never are. A transaction another thread added in
+ * the meantime counts as accepted. Should be called without cs_main held.
+ */
+bool AcceptToMemoryPoolConcurrent(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
+                        bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
+                        bool bypass_limits, const CAmount nAbsurdFee);
+
+/** What became of a transaction passed to AcceptPackageToMemoryPool */
+struct PackageTxResult
+{
+    bool fAccepted;
+    bool fMissingInputs;
+    CValidationState state;
+
+    PackageTxResult() : fAccepted(false), fMissingInputs(false) {}
+};
+
+/**
+ * (try to) add transactions to memory pool, taking cs_main once for all of
+ * them. Those spending outputs of others in vtx are accepted after those,
+ * whatever their order in vtx. All scripts are verified at once on the
+ * script check threads before the transactions are accepted one by one.
+ * Returns the outcome for each transaction, in the order of vtx. As cs_main
+ * is held throughout, callers should bound the package, see
+ * MAX_PACKAGE_COUNT and MAX_PACKAGE_WEIGHT.
+ */
+std::vector<PackageTxResult> AcceptPackageToMemoryPool(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx,
+                        bool bypass_limits, const CAmount nAbsurdFee);
+
+/**
+ * Verify the scripts of transactions about to be passed to AcceptToMemoryPool
+ * one after the other, all at once on the script check threads, so that their
+ * signatures are cached by the time each is accepted. Inputs may come from
+ * the chain, the mempool or transactions earlier in vtx. Only transactions
+ * that pass the policy checks short of the mempool limits are verified, and
+ * only if their parents in vtx were. Returns how many were. Requires cs_main.
+ */
+size_t PreverifyTransactionScripts(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx,
+                                   bool bypass_limits, const CAmount nAbsurdFee);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -398,15 +455,30 @@ public:
     }
 
     ScriptError GetScriptError() const { return error; }
+
+    unsigned int GetFlags() const { return nFlags; }
+
+    /** Run the same check with the script verification flags nFlagsOff turned off */
+    bool CheckWithoutFlags(unsigned int nFlagsOff) const;
 };
 
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
+/** Save the script-execution cache to scriptcache.dat in the data directory */
+bool DumpScriptExecutionCache();
+/** Load the script-execution cache saved by DumpScriptExecutionCache. Must be
+ * called right after InitScriptExecutionCache, before the cache is used. */
+bool LoadScriptExecutionCache();
 
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block as it is serialized on disk, without deserializing it. Witness
+ *  data is removed (see StripBlockWitness) if fWitness is false. */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start, bool fWitness = true);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start, bool fWitness = true);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 /** Functions for validating blocks and updating the block tree */
 